@@ -32,7 +32,11 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 #include <Parameter.h>
 #include <IO/LoaderXML.h>
 #include <IO/WriterXML.h>
+#include <IO/StateBinary.h>
+#include <IO/StateJournal.h>
+#include <IO/AsyncStateWriter.h>
 #include "Simulation/MolflowSimGeom.h"
+#include "Simulation/ProfilingCounters.h"
 #include "Initializer.h"
 #include "Helper/MathTools.h"
 #include <sstream>
@@ -111,6 +115,16 @@ public:
                          (double) (globState.globalHits.globalHits.nbDesorbed - oldDesNb) /
                          (elapsedTime));
     }
+    void PrintProfile() const{
+        // Only filled when built with USE_PROFILING_COUNTERS
+        if(!MFSim::Profiling::enabled)
+            return;
+        auto totals = MFSim::Profiling::GetTotals();
+        if(totals.empty())
+            return;
+        Log::console_msg(2, "Hot path profile [{}]:\n{}", MFMPI::world_rank,
+                         MFSim::Profiling::FormatSummary(totals, MFSim::Profiling::GetTicksPerSecond()));
+    }
 };
 
 int main(int argc, char** argv) {
@@ -172,6 +186,9 @@ int main(int argc, char** argv) {
     RuntimeStatPrinter printer(oldHitsNb, oldDesNb);
     // Get autosave file name
     std::string autoSave = Initializer::getAutosaveFile();
+    FlowIO::StateJournal autoSaveJournal(autoSave, Settings::autosaveCompaction);
+    // Serializes snapshots of globState in the background
+    FlowIO::AsyncStateWriter stateWriter;
 
 
     //simManager.ReloadHitBuffer();
@@ -187,6 +204,7 @@ int main(int argc, char** argv) {
 #endif
 
     // Start async simulation run, check state in following loop
+    MFSim::Profiling::ResetTotals();
     try {
         simManager.StartSimulation();
     }
@@ -226,10 +244,10 @@ int main(int argc, char** argv) {
                         .concat("_")
                         .concat(std::filesystem::path(SettingsIO::outputFile).filename().string()).string();
 
+                // 2. Write XML file, use existing file as base or create new file
+                // The geometry is written here, the background writer only serializes the results snapshot
+                Log::console_msg_master(3, " Saving intermediate results: {}\n", outFile);
                 try {
-                    // 2. Write XML file, use existing file as base or create new file
-                    FlowIO::WriterXML writer;
-                    Log::console_msg_master(3, " Saving intermediate results: {}\n", outFile);
                     if(!SettingsIO::workFile.empty() && std::filesystem::exists(SettingsIO::workFile)) {
                         try {
                             std::filesystem::copy_file(SettingsIO::workFile, outFile,
@@ -239,18 +257,28 @@ int main(int argc, char** argv) {
                         }
                     }
                     else {
+                        FlowIO::WriterXML writer;
                         pugi::xml_document newDoc;
                         writer.SaveGeometry(newDoc, model);
                         //writer.SaveSimulationState(newDoc, model, globState);
                         writer.SaveXMLToFile(newDoc, outFile);
                         //SettingsIO::workFile = outFile;
                     }
-                    // 3. append updated results
-                    writer.SaveSimulationState(outFile, model, globState);
                 } catch(std::filesystem::filesystem_error& e) {
                     Log::console_error("Warning: Could not create file: {}\n", e.what());
                 }
+                // 3. append updated results
+                stateWriter.Submit([outFile, model](GlobalSimuState &snapshot) {
+                    try {
+                        FlowIO::WriterXML writer;
+                        writer.SaveSimulationState(outFile, model, snapshot);
+                    } catch(std::filesystem::filesystem_error& e) {
+                        Log::console_error("Warning: Could not create file: {}\n", e.what());
+                    }
+                }, globState, true);
                 // Next choose the next desorption limit and start
+                // Pending writes read the model (e.g. the desorption limit), finish them before it changes
+                stateWriter.Wait();
 
                 model->otfParams.desorptionLimit = Settings::desLimit.front();
                 Settings::desLimit.pop_front();
@@ -271,8 +299,23 @@ int main(int argc, char** argv) {
         else if(Settings::autoSaveDuration && (uint64_t)(elapsedTime)%Settings::autoSaveDuration==0){ // autosave every x seconds
             // Autosave
             Log::console_msg_master(2,"[{:.2}s] Creating auto save file {}\n", elapsedTime, autoSave);
-            FlowIO::WriterXML writer;
-            writer.SaveSimulationState(autoSave, model, globState);
+            if(Settings::deltaAutosave) {
+                // Only facet moments changed since the last autosave are copied from the live state and appended
+                autoSaveJournal.Checkpoint(*model, globState);
+            }
+            else {
+                // Skipped if the previous autosave is still being written
+                stateWriter.Submit([&autoSave, model](GlobalSimuState &snapshot) {
+                    if(Settings::binaryState) {
+                        // Results only go to the sidecar, the XML copy keeps the geometry
+                        FlowIO::StateBinary::Save(FlowIO::StateBinary::GetSidecarName(autoSave), *model, snapshot);
+                    }
+                    else {
+                        FlowIO::WriterXML writer;
+                        writer.SaveSimulationState(autoSave, model, snapshot);
+                    }
+                }, globState, false);
+            }
         }
 
         if(Settings::outputDuration && (uint64_t)(elapsedTime)%Settings::outputDuration==0){ // autosave every x seconds
@@ -281,6 +324,7 @@ int main(int argc, char** argv) {
                 printer.PrintHeader();
             }
             printer.Print(elapsedTime, globState);
+            printer.PrintProfile();
         }
 
         // Check for potential time end
@@ -289,6 +333,7 @@ int main(int argc, char** argv) {
         }
     } while(!endCondition);
     simTimer.Stop();
+    stateWriter.Wait(); // autosave file is reused for the final output
     elapsedTime = simTimer.Elapsed();
 
     // Terminate simulation
@@ -309,6 +354,15 @@ int main(int argc, char** argv) {
     if(elapsedTime > 1e-4) {
         // Global result print --> TODO: ()
         printer.Print(elapsedTime, globState);
+        printer.PrintProfile();
+    }
+    if(MFSim::Profiling::enabled) {
+        std::string profileFile = std::filesystem::path(SettingsIO::outputPath)
+                .append(fmt::format("profile_{}.json", MFMPI::world_rank)).string();
+        if(MFSim::Profiling::WriteJSON(profileFile))
+            Log::console_msg(2, "[{}] Profiling counters written to {}\n", MFMPI::world_rank, profileFile);
+        else
+            Log::console_error("[{}] Could not write profiling counters to {}\n", MFMPI::world_rank, profileFile);
     }
 
 #if defined(USE_MPI)
@@ -374,6 +428,19 @@ int main(int argc, char** argv) {
         writer.SaveSimulationState(newDoc, model, globState);
         writer.SaveXMLToFile(newDoc, fullOutFile);
 
+        std::string autoSaveBinary = FlowIO::StateBinary::GetSidecarName(autoSave);
+        if(!autoSave.empty() && std::filesystem::exists(autoSaveBinary)){
+            std::filesystem::remove(autoSaveBinary);
+        }
+        std::string autoSaveJournalFile = FlowIO::StateJournal::GetJournalName(autoSave);
+        if(!autoSave.empty() && std::filesystem::exists(autoSaveJournalFile)){
+            std::filesystem::remove(autoSaveJournalFile);
+        }
+        std::string fullOutFileBinary = FlowIO::StateBinary::GetSidecarName(fullOutFile);
+        if(Settings::binaryState) {
+            FlowIO::StateBinary::Save(fullOutFileBinary, *model, globState);
+        }
+
         if(createZip){
             Log::console_msg_master(3, "Compressing xml to zip...\n");
 
@@ -388,9 +455,13 @@ int main(int argc, char** argv) {
                 }
             }
             ZipFile::AddFile(fileNameWithZIP, fullOutFile, FileUtils::GetFilename(fullOutFile));
+            if(Settings::binaryState && std::filesystem::exists(fullOutFileBinary))
+                ZipFile::AddFile(fileNameWithZIP, fullOutFileBinary, FileUtils::GetFilename(fullOutFileBinary));
             //At this point, if no error was thrown, the compression is successful
             try {
                 std::filesystem::remove(fullOutFile);
+                if(Settings::binaryState && std::filesystem::exists(fullOutFileBinary))
+                    std::filesystem::remove(fullOutFileBinary);
             }
             catch (std::exception &e) {
                 Log::console_error("Error removing\n{}\nMaybe file is in use:\n{}",fullOutFile,e.what());
@@ -0,0 +1,179 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "AccelCache.h"
+#include "Simulation/MolflowSimGeom.h"
+#include "Simulation/WideBVH.h"
+#include <Helper/ConsoleLogger.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace FlowIO {
+
+    namespace {
+        //! 64 bit FNV-1a hash
+        class Hasher {
+        public:
+            void Add(const void *data, size_t size) {
+                const auto *bytes = static_cast<const unsigned char *>(data);
+                for (size_t i = 0; i < size; i++) {
+                    value ^= bytes[i];
+                    value *= 1099511628211ull;
+                }
+            }
+
+            template<typename T>
+            void Add(const T &v) {
+                Add(&v, sizeof(T));
+            }
+
+            void Add(const Vector3d &v) {
+                Add(v.x);
+                Add(v.y);
+                Add(v.z);
+            }
+
+            [[nodiscard]] uint64_t Get() const { return value; };
+
+        private:
+            uint64_t value{14695981039346656037ull};
+        };
+    }
+
+    /**
+    * \brief Hash of the inputs of the tree build: vertices, facet polygons and their structures, split settings
+    * \param splitMethod split method the trees are built with
+    * \param maxLeafSize facets per leaf
+    */
+    uint64_t AccelCache::ComputeKey(const MolflowSimulationModel &model, int splitMethod, size_t maxLeafSize) {
+        Hasher hasher;
+        hasher.Add(version);
+        hasher.Add(static_cast<int64_t>(splitMethod));
+        hasher.Add(static_cast<uint64_t>(maxLeafSize));
+        hasher.Add(static_cast<uint64_t>(model.sh.nbSuper));
+        hasher.Add(static_cast<uint64_t>(model.vertices3.size()));
+        for (const auto &vertex : model.vertices3)
+            hasher.Add(vertex);
+        hasher.Add(static_cast<uint64_t>(model.facets.size()));
+        for (const auto &facet : model.facets) {
+            hasher.Add(static_cast<int64_t>(facet->sh.superIdx));
+            hasher.Add(static_cast<uint64_t>(facet->indices.size()));
+            for (const auto index : facet->indices)
+                hasher.Add(static_cast<uint64_t>(index));
+            // Facet frame, which bounds the facet in the tree
+            hasher.Add(facet->sh.O);
+            hasher.Add(facet->sh.U);
+            hasher.Add(facet->sh.V);
+        }
+        return hasher.Get();
+    }
+
+    /**
+    * \brief Replaces the acceleration structures of the model with the cached ones if the key matches
+    * \param fileName cache file
+    * \param key ComputeKey() of the current model
+    * \return true if all structures have been loaded, the model is left unchanged otherwise
+    */
+    bool AccelCache::Load(const std::string &fileName, uint64_t key, MolflowSimulationModel &model) {
+        std::ifstream in(fileName, std::ios::binary);
+        if (!in) {
+            Log::console_msg_master(4, "[AccelCache] No cache file {}\n", fileName);
+            return false;
+        }
+
+        Header header{};
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(Header)) || std::memcmp(header.magic, magic, sizeof(magic)) != 0
+            || header.version != version || header.headerSize != sizeof(Header)) {
+            Log::console_msg_master(3, "[AccelCache] Ignoring {}: not a compatible cache file\n", fileName);
+            return false;
+        }
+        if (header.key != key || header.nbStructures != model.sh.nbSuper) {
+            Log::console_msg_master(3, "[AccelCache] Geometry changed, rebuilding acceleration structures\n");
+            return false;
+        }
+
+        std::vector<SimulationFacet *> facetsById(model.facets.size(), nullptr);
+        for (auto &facet : model.facets) {
+            if (facet->globalId < facetsById.size())
+                facetsById[facet->globalId] = facet.get();
+        }
+        decltype(model.accel) accel;
+        accel.reserve(header.nbStructures);
+        for (uint64_t s = 0; s < header.nbStructures; s++) {
+            auto tree = std::make_shared<WideBVHAccel>();
+            if (!tree->Read(in, facetsById)) {
+                Log::console_msg_master(3, "[AccelCache] Ignoring {}: structure {} is damaged\n", fileName, s);
+                return false;
+            }
+            accel.push_back(tree);
+        }
+        model.accel = std::move(accel);
+        return true;
+    }
+
+    /**
+    * \brief Writes the acceleration structures of the model, first to a temporary file that replaces the target
+    * \param fileName cache file
+    * \param key ComputeKey() of the model
+    * \return true on success, false if a structure is not a WideBVHAccel or the file could not be written
+    */
+    bool AccelCache::Save(const std::string &fileName, uint64_t key, const MolflowSimulationModel &model) {
+        std::vector<const WideBVHAccel *> trees;
+        for (const auto &accel : model.accel) {
+            const auto *tree = dynamic_cast<const WideBVHAccel *>(accel.get());
+            if (!tree)
+                return false;
+            trees.push_back(tree);
+        }
+
+        Header header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.headerSize = sizeof(Header);
+        header.key = key;
+        header.nbStructures = trees.size();
+
+        const std::string tmpFileName = fileName + ".tmp";
+        try {
+            std::ofstream out(tmpFileName, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                Log::console_error("[AccelCache] Could not open {} for writing\n", tmpFileName);
+                return false;
+            }
+            out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+            for (const auto *tree : trees)
+                tree->Write(out);
+            out.close();
+            if (!out) {
+                Log::console_error("[AccelCache] Error writing {}\n", tmpFileName);
+                return false;
+            }
+            std::filesystem::rename(tmpFileName, fileName);
+        }
+        catch (const std::exception &e) {
+            Log::console_error("[AccelCache] Could not save {}: {}\n", fileName, e.what());
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,57 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_ACCELCACHE_H
+#define MOLFLOW_PROJ_ACCELCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MolflowSimulationModel;
+
+namespace FlowIO {
+
+    /**
+    * \brief File cache for built acceleration structures, keyed by a hash of everything the build depends on
+    * Layout: header | one serialized tree per structure
+    * Runs that only change sticking, opacity or outgassing (e.g. parameter sweeps) load the trees of the unchanged
+    * geometry instead of rebuilding them. A file with another key or layout is ignored and overwritten.
+     */
+    class AccelCache {
+    public:
+        static constexpr char magic[8] = {'M', 'F', 'A', 'C', 'C', 'E', 'L', '\0'};
+        static constexpr uint32_t version = 1;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t headerSize; // sizeof(Header), guards against layout changes
+            uint64_t key; // ComputeKey() of the geometry the trees were built for
+            uint64_t nbStructures;
+        };
+
+        static uint64_t ComputeKey(const MolflowSimulationModel &model, int splitMethod, size_t maxLeafSize);
+        static bool Load(const std::string &fileName, uint64_t key, MolflowSimulationModel &model);
+        static bool Save(const std::string &fileName, uint64_t key, const MolflowSimulationModel &model);
+    };
+}
+
+#endif //MOLFLOW_PROJ_ACCELCACHE_H
@@ -0,0 +1,112 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "AsyncStateWriter.h"
+#include <Helper/ConsoleLogger.h>
+#include <Helper/Chronometer.h>
+
+namespace FlowIO {
+
+    AsyncStateWriter::AsyncStateWriter() {
+        writerThread = std::thread(&AsyncStateWriter::Run, this);
+    }
+
+    /**
+    * \brief Finishes a pending job before the writer thread is stopped
+    */
+    AsyncStateWriter::~AsyncStateWriter() {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            quit = true;
+        }
+        jobCondition.notify_all();
+        if (writerThread.joinable())
+            writerThread.join();
+    }
+
+    /**
+    * \brief Copies the live state into the snapshot buffer and queues a job serializing it
+    * \param job serialization routine, called on the writer thread with the snapshot
+    * \param globState live state, locked only for the copy
+    * \param waitForPrevious if false, the job is dropped while a previous one is still running
+    * \return true if the job was queued
+    */
+    bool AsyncStateWriter::Submit(const Job &job, GlobalSimuState &globState, bool waitForPrevious) {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        if (busy || hasJob) {
+            if (!waitForPrevious) {
+                Log::console_msg_master(3, "Previous state is still being written, skipping\n");
+                return false;
+            }
+            jobCondition.wait(lock, [this] { return !busy && !hasJob; });
+        }
+
+        Chronometer timer;
+        timer.Start();
+        {
+            std::lock_guard<std::timed_mutex> stateLock(globState.tMutex);
+            snapshot = globState; // buffers are reused if the layout didn't change
+        }
+        timer.Stop();
+        Log::console_msg_master(4, "State snapshot taken in {:.2f} ms\n", timer.ElapsedMs());
+
+        pendingJob = job;
+        hasJob = true;
+        jobCondition.notify_all();
+        return true;
+    }
+
+    /**
+    * \brief Blocks until no job is pending or running
+    */
+    void AsyncStateWriter::Wait() {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        jobCondition.wait(lock, [this] { return !busy && !hasJob; });
+    }
+
+    bool AsyncStateWriter::IsBusy() {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        return busy || hasJob;
+    }
+
+    void AsyncStateWriter::Run() {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        while (true) {
+            jobCondition.wait(lock, [this] { return quit || hasJob; });
+            if (!hasJob) // quit without pending work
+                break;
+
+            Job job = std::move(pendingJob);
+            pendingJob = nullptr;
+            hasJob = false;
+            busy = true;
+            lock.unlock();
+            try {
+                job(snapshot);
+            }
+            catch (const std::exception &e) {
+                Log::console_error("Error writing simulation state: {}\n", e.what());
+            }
+            lock.lock();
+            busy = false;
+            jobCondition.notify_all();
+        }
+    }
+}
@@ -0,0 +1,65 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_ASYNCSTATEWRITER_H
+#define MOLFLOW_PROJ_ASYNCSTATEWRITER_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "Simulation/MolflowSimGeom.h"
+
+namespace FlowIO {
+
+    /**
+    * \brief Background writer for simulation states
+    * The live state is only locked while it is copied into a snapshot buffer, serialization then runs on a
+    * separate thread so that simulation threads don't block in UpdateMCHits during autosaves.
+    * At most one job is pending or running at a time.
+     */
+    class AsyncStateWriter {
+    public:
+        using Job = std::function<void(GlobalSimuState &snapshot)>;
+
+        AsyncStateWriter();
+        ~AsyncStateWriter();
+        AsyncStateWriter(const AsyncStateWriter &) = delete;
+        AsyncStateWriter &operator=(const AsyncStateWriter &) = delete;
+
+        bool Submit(const Job &job, GlobalSimuState &globState, bool waitForPrevious);
+        void Wait();
+        [[nodiscard]] bool IsBusy();
+
+    private:
+        void Run();
+
+        GlobalSimuState snapshot; // only accessed by the writer thread while a job is pending or running
+        Job pendingJob;
+        bool hasJob{false};
+        bool busy{false};
+        bool quit{false};
+        std::mutex jobMutex;
+        std::condition_variable jobCondition;
+        std::thread writerThread;
+    };
+}
+
+#endif //MOLFLOW_PROJ_ASYNCSTATEWRITER_H
@@ -505,7 +505,7 @@ int LoaderXML::LoadSimulationState(const std::string &inputFileName, std::shared
                     size_t texWidth_file = textureNode.attribute("width").as_llong();
                     size_t texHeight_file = textureNode.attribute("height").as_llong();
 
-                    std::vector<TextureCell> &texture = globState->facetStates[facetId].momentResults[m].texture;
+                    TiledCells<TextureCell> &texture = globState->facetStates[facetId].momentResults[m].texture;
 
                     std::stringstream countText, sum1perText, sumvortText;
                     if (textureNode.child("countEquiv")) {
@@ -548,6 +548,7 @@ int LoaderXML::LoadSimulationState(const std::string &inputFileName, std::shared
                         }
 
                     }
+                    texture.Compact(); // keep only the tiles with hits
                 } //end texture
 
                 if (sFac->sh.countDirection) {
@@ -566,7 +567,7 @@ int LoaderXML::LoadSimulationState(const std::string &inputFileName, std::shared
                     /*DirectionCell *dirs = (DirectionCell *)(buffer + sFac->sh.hitOffset + facetHitsSize
                                                             + profSize + (1 + (int)model->tdParams.moments.size())*sFac->sh.texWidth*sFac->sh.texHeight * sizeof(TextureCell)
                                                             + m * sFac->sh.texWidth*sFac->sh.texHeight * sizeof(DirectionCell));*/
-                    std::vector<DirectionCell> &dirs = globState->facetStates[facetId].momentResults[m].direction;
+                    TiledCells<DirectionCell> &dirs = globState->facetStates[facetId].momentResults[m].direction;
 
                     std::stringstream dirText, dirCountText;
                     dirText << dirNode.child_value("vel.vectors");
@@ -583,6 +584,7 @@ int LoaderXML::LoadSimulationState(const std::string &inputFileName, std::shared
                             dirCountText >> dirs[iy * sFac->sh.texWidth + ix].count;
                         }
                     }
+                    dirs.Compact();
                 } //end directions
 
                 // Facet histogram
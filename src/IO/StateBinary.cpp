@@ -0,0 +1,356 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "StateBinary.h"
+#include "Simulation/MolflowSimGeom.h"
+#include "Simulation/MolflowSimFacet.h"
+#include <Helper/ConsoleLogger.h>
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <streambuf>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FlowIO {
+
+    namespace {
+        //! Read-only stream buffer over mapped memory, avoids copying a block before deserialization
+        class MemoryStreamBuf : public std::streambuf {
+        public:
+            MemoryStreamBuf(const char *begin, size_t size) {
+                char *p = const_cast<char *>(begin);
+                setg(p, p, p + size);
+            }
+        };
+
+        //! Same cell counts as GlobalSimuState::Resize allocates for the facet, checked like LoaderXML does
+        bool MatchesFacet(const FacetState &facetState, const SimulationFacet &facet, size_t nbMoments) {
+            const auto &sh = facet.sh;
+            const size_t nbTexCells = (size_t) sh.texWidth * (size_t) sh.texHeight;
+            if (facetState.momentResults.size() != 1 + nbMoments)
+                return false;
+            for (const auto &snapshot : facetState.momentResults) {
+                if (snapshot.texture.size() != (sh.isTextured ? nbTexCells : 0)
+                    || snapshot.profile.size() != (sh.isProfile ? (size_t) PROFILE_SIZE : 0)
+                    || snapshot.direction.size() != (sh.countDirection ? nbTexCells : 0))
+                    return false;
+            }
+            return facetState.recordedAngleMapPdf.size() == (sh.anglemapParams.record ? sh.anglemapParams.GetMapSize() : 0);
+        }
+    }
+
+    /**
+    * \brief Name of the binary state file belonging to an XML file
+    * \param xmlFileName e.g. geometry.xml
+    * \return e.g. geometry.xml.mfstate
+    */
+    std::string StateBinary::GetSidecarName(const std::string &xmlFileName) {
+        return xmlFileName + ".mfstate";
+    }
+
+    /**
+    * \brief Writes the complete simulation state, first to a temporary file that replaces the target when complete
+    * \param fileName output file, usually GetSidecarName() of the XML file
+    * \param model model the state belongs to, used for the consistency header
+    * \param globState state to write, locked during serialization
+    * \param snapshotId optional output, the id stored in the header
+    * \return true on success
+    */
+    bool StateBinary::Save(const std::string &fileName, const MolflowSimulationModel &model, GlobalSimuState &globState,
+                           uint64_t *snapshotId) {
+        const std::string tmpFileName = fileName + ".tmp";
+        std::lock_guard<std::timed_mutex> lock(globState.tMutex);
+
+        const uint64_t nbFacets = globState.facetStates.size();
+        std::vector<uint64_t> facetOffsets(nbFacets + 1, 0);
+
+        Header header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.headerSize = sizeof(Header);
+        header.nbFacets = nbFacets;
+        header.nbMoments = model.tdParams.moments.size();
+        {
+            std::random_device entropy;
+            header.snapshotId = (static_cast<uint64_t>(entropy()) << 32 | entropy())
+                                ^ static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        }
+
+        try {
+            std::ofstream out(tmpFileName, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                Log::console_error("[StateBinary] Could not open {} for writing\n", tmpFileName);
+                return false;
+            }
+
+            // Placeholders, rewritten once block sizes are known
+            out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+            out.write(reinterpret_cast<const char *>(facetOffsets.data()), sizeof(uint64_t) * facetOffsets.size());
+
+            header.globalOffset = static_cast<uint64_t>(out.tellp());
+            {
+                cereal::BinaryOutputArchive archive(out);
+                archive(globState.globalHits, globState.globalHistograms);
+            }
+            header.globalSize = static_cast<uint64_t>(out.tellp()) - header.globalOffset;
+
+            for (size_t i = 0; i < nbFacets; i++) {
+                facetOffsets[i] = static_cast<uint64_t>(out.tellp());
+                cereal::BinaryOutputArchive archive(out);
+                archive(globState.facetStates[i]);
+            }
+            facetOffsets[nbFacets] = static_cast<uint64_t>(out.tellp());
+
+            out.seekp(0);
+            out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+            out.write(reinterpret_cast<const char *>(facetOffsets.data()), sizeof(uint64_t) * facetOffsets.size());
+            out.close();
+            if (!out) {
+                Log::console_error("[StateBinary] Error writing {}\n", tmpFileName);
+                return false;
+            }
+
+            std::filesystem::rename(tmpFileName, fileName);
+        }
+        catch (const std::exception &e) {
+            Log::console_error("[StateBinary] Could not save {}: {}\n", fileName, e.what());
+            return false;
+        }
+        if (snapshotId)
+            *snapshotId = header.snapshotId;
+        return true;
+    }
+
+    StateBinaryReader::~StateBinaryReader() {
+        Close();
+    }
+
+    /**
+    * \brief Maps a binary state file into memory and validates its header
+    * \param fileName binary state file
+    * \return true if the file could be mapped and has a supported version
+    */
+    bool StateBinaryReader::Open(const std::string &fileName) {
+        Close();
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            CloseHandle(file);
+            return false;
+        }
+        void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!view) {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+        fileHandle = file;
+        mappingHandle = mapping;
+        fileSize = static_cast<size_t>(size.QuadPart);
+        data = static_cast<const char *>(view);
+#else
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void *view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        fileDescriptor = fd;
+        fileSize = static_cast<size_t>(st.st_size);
+        data = static_cast<const char *>(view);
+#endif
+
+        // Validate header and offset table
+        const auto *header = reinterpret_cast<const StateBinary::Header *>(data);
+        bool valid = fileSize >= sizeof(StateBinary::Header)
+                     && std::memcmp(header->magic, StateBinary::magic, sizeof(StateBinary::magic)) == 0
+                     && header->headerSize == sizeof(StateBinary::Header);
+        if (valid && header->version != StateBinary::version) {
+            Log::console_error("[StateBinary] Unsupported version {} in {}\n", header->version, fileName);
+            valid = false;
+        }
+        valid = valid && fileSize >= sizeof(StateBinary::Header) + sizeof(uint64_t) * (header->nbFacets + 1)
+                && header->globalOffset + header->globalSize <= fileSize
+                && FacetOffset(header->nbFacets) == fileSize;
+        if (!valid) {
+            Log::console_error("[StateBinary] Invalid or truncated state file {}\n", fileName);
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void StateBinaryReader::Close() {
+        if (!data)
+            return;
+#if defined(_WIN32)
+        UnmapViewOfFile(data);
+        CloseHandle(static_cast<HANDLE>(mappingHandle));
+        CloseHandle(static_cast<HANDLE>(fileHandle));
+        mappingHandle = nullptr;
+        fileHandle = nullptr;
+#else
+        munmap(const_cast<char *>(data), fileSize);
+        close(fileDescriptor);
+        fileDescriptor = -1;
+#endif
+        data = nullptr;
+        fileSize = 0;
+    }
+
+    size_t StateBinaryReader::GetNbFacets() const {
+        return data ? reinterpret_cast<const StateBinary::Header *>(data)->nbFacets : 0;
+    }
+
+    size_t StateBinaryReader::GetNbMoments() const {
+        return data ? reinterpret_cast<const StateBinary::Header *>(data)->nbMoments : 0;
+    }
+
+    uint64_t StateBinaryReader::GetSnapshotId() const {
+        return data ? reinterpret_cast<const StateBinary::Header *>(data)->snapshotId : 0;
+    }
+
+    uint64_t StateBinaryReader::FacetOffset(size_t facetId) const {
+        uint64_t offset;
+        std::memcpy(&offset, data + sizeof(StateBinary::Header) + sizeof(uint64_t) * facetId, sizeof(uint64_t));
+        return offset;
+    }
+
+    /**
+    * \brief Checks whether the stored state can be loaded into the given model
+    */
+    bool StateBinaryReader::IsCompatible(const MolflowSimulationModel &model) const {
+        return IsOpen() && GetNbFacets() == model.facets.size() && GetNbMoments() == model.tdParams.moments.size();
+    }
+
+    /**
+    * \brief Deserializes global counters and histograms
+    */
+    bool StateBinaryReader::LoadGlobal(GlobalSimuState &globState) const {
+        if (!IsOpen())
+            return false;
+        const auto *header = reinterpret_cast<const StateBinary::Header *>(data);
+        try {
+            MemoryStreamBuf buffer(data + header->globalOffset, header->globalSize);
+            std::istream in(&buffer);
+            cereal::BinaryInputArchive archive(in);
+            archive(globState.globalHits, globState.globalHistograms);
+        }
+        catch (const std::exception &e) {
+            Log::console_error("[StateBinary] Could not read global results: {}\n", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+    * \brief Deserializes the results of a single facet, only the pages of this facet's block are touched
+    */
+    bool StateBinaryReader::LoadFacet(size_t facetId, FacetState &facetState) const {
+        if (!IsOpen() || facetId >= GetNbFacets())
+            return false;
+        const uint64_t begin = FacetOffset(facetId);
+        const uint64_t end = FacetOffset(facetId + 1);
+        if (begin > end || end > fileSize)
+            return false;
+        try {
+            MemoryStreamBuf buffer(data + begin, end - begin);
+            std::istream in(&buffer);
+            cereal::BinaryInputArchive archive(in);
+            archive(facetState);
+        }
+        catch (const std::exception &e) {
+            Log::console_error("[StateBinary] Could not read results of facet {}: {}\n", facetId + 1, e.what());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+    * \brief Loads the complete state, equivalent to LoaderXML::LoadSimulationState
+    * The state is left untouched if the stored texture, profile, direction or angle map sizes don't match the facets
+    * \return 0 on success, 1 on error
+    */
+    int StateBinaryReader::LoadAll(const std::shared_ptr<MolflowSimulationModel> &model, GlobalSimuState &globState) const {
+        if (!IsCompatible(*model)) {
+            Log::console_error("[StateBinary] Stored state doesn't match the geometry ({} facets, {} moments)\n",
+                               GetNbFacets(), GetNbMoments());
+            return 1;
+        }
+
+        std::vector<FacetState> facetStates(GetNbFacets());
+        for (size_t i = 0; i < GetNbFacets(); i++) {
+            if (!LoadFacet(i, facetStates[i]))
+                return 1;
+            if (!MatchesFacet(facetStates[i], *model->facets[i], GetNbMoments())) {
+                Log::console_error("[StateBinary] Stored results of facet {} don't match its texture, profile, direction "
+                                   "or angle map size\n", i + 1);
+                return 1;
+            }
+        }
+
+        if (!globState.tMutex.try_lock()) {
+            return 1;
+        }
+        const bool ok = LoadGlobal(globState);
+        if (ok) {
+            globState.facetStates = std::move(facetStates);
+            // Angle maps are read back into the facets, like with the XML loader
+            for (size_t i = 0; i < globState.facetStates.size(); i++) {
+                auto facet = std::dynamic_pointer_cast<MolflowSimFacet>(model->facets[i]);
+                if (facet && facet->sh.anglemapParams.record)
+                    facet->angleMap.pdf = globState.facetStates[i].recordedAngleMapPdf;
+            }
+        }
+        globState.tMutex.unlock();
+        return ok ? 0 : 1;
+    }
+}
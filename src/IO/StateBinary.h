@@ -0,0 +1,101 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_STATEBINARY_H
+#define MOLFLOW_PROJ_STATEBINARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class GlobalSimuState;
+class FacetState;
+class MolflowSimulationModel;
+
+namespace FlowIO {
+
+    /**
+    * \brief Versioned binary container for simulation results, stored as a sidecar next to the XML file
+    * Layout: header | facet offset table | global block | one block per facet
+    * Each block is a cereal binary archive of the corresponding GlobalSimuState/FacetState members, blocks
+    * can be deserialized independently from a memory mapped file
+     */
+    class StateBinary {
+    public:
+        static constexpr char magic[8] = {'M', 'F', 'S', 'T', 'A', 'T', 'E', '\0'};
+        static constexpr uint32_t version = 2;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t headerSize; // sizeof(Header), guards against layout changes
+            uint64_t nbFacets;
+            uint64_t nbMoments; // without constant flow
+            uint64_t globalOffset; // absolute offset of the global block
+            uint64_t globalSize;
+            uint64_t snapshotId; // unique per written file, journals (StateJournal) are only replayed on their snapshot
+            // followed by nbFacets+1 absolute offsets of the facet blocks, last one is the file end
+        };
+
+        static std::string GetSidecarName(const std::string &xmlFileName);
+
+        static bool Save(const std::string &fileName, const MolflowSimulationModel &model, GlobalSimuState &globState,
+                         uint64_t *snapshotId = nullptr);
+    };
+
+    /**
+    * \brief Read access to a binary state file, facets are only deserialized on request
+     */
+    class StateBinaryReader {
+    public:
+        StateBinaryReader() = default;
+        ~StateBinaryReader();
+        StateBinaryReader(const StateBinaryReader &) = delete;
+        StateBinaryReader &operator=(const StateBinaryReader &) = delete;
+
+        bool Open(const std::string &fileName);
+        void Close();
+
+        [[nodiscard]] bool IsOpen() const { return data != nullptr; };
+        [[nodiscard]] bool IsCompatible(const MolflowSimulationModel &model) const;
+        [[nodiscard]] size_t GetNbFacets() const;
+        [[nodiscard]] size_t GetNbMoments() const;
+        [[nodiscard]] uint64_t GetSnapshotId() const;
+
+        bool LoadGlobal(GlobalSimuState &globState) const;
+        bool LoadFacet(size_t facetId, FacetState &facetState) const;
+        int LoadAll(const std::shared_ptr<MolflowSimulationModel> &model, GlobalSimuState &globState) const;
+
+    private:
+        [[nodiscard]] uint64_t FacetOffset(size_t facetId) const;
+
+        const char *data{nullptr};
+        size_t fileSize{0};
+#if defined(_WIN32)
+        void *fileHandle{nullptr};
+        void *mappingHandle{nullptr};
+#else
+        int fileDescriptor{-1};
+#endif
+    };
+}
+
+#endif //MOLFLOW_PROJ_STATEBINARY_H
@@ -0,0 +1,330 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "StateJournal.h"
+#include "StateBinary.h"
+#include "Simulation/MolflowSimGeom.h"
+#include "Simulation/MolflowSimFacet.h"
+#include <Helper/ConsoleLogger.h>
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace FlowIO {
+
+    namespace {
+        //! Start of the journal file, the records follow
+        struct JournalHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t headerSize; // sizeof(JournalHeader), guards against layout changes
+            uint64_t snapshotId; // StateBinary::Header::snapshotId of the snapshot the records apply to
+        };
+        constexpr char journalMagic[8] = {'M', 'F', 'J', 'O', 'U', 'R', 'N', '\0'};
+        constexpr uint32_t journalVersion = 1;
+
+        //! Results of one facet for one moment, replacing the previous values on replay
+        struct JournalMoment {
+            uint64_t facetId{0};
+            uint64_t moment{0};
+            FacetMomentSnapshot snapshot;
+
+            template<class Archive>
+            void serialize(Archive &archive) {
+                archive(facetId, moment, snapshot);
+            }
+        };
+
+        struct JournalAngleMap {
+            uint64_t facetId{0};
+            std::vector<size_t> pdf;
+
+            template<class Archive>
+            void serialize(Archive &archive) {
+                archive(facetId, pdf);
+            }
+        };
+
+        struct JournalRecord {
+            GlobalHitBuffer globalHits;
+            std::vector<FacetHistogramBuffer> globalHistograms;
+            std::vector<JournalMoment> moments;
+            std::vector<JournalAngleMap> angleMaps;
+
+            template<class Archive>
+            void serialize(Archive &archive) {
+                archive(globalHits, globalHistograms, moments, angleMaps);
+            }
+        };
+
+        size_t GetNbMomentResults(const GlobalSimuState &globState) {
+            return globState.facetStates.empty() ? 1 : globState.facetStates.front().momentResults.size();
+        }
+
+        bool SameSize(const FacetHistogramBuffer &lhs, const FacetHistogramBuffer &rhs) {
+            return lhs.distanceHistogram.size() == rhs.distanceHistogram.size()
+                   && lhs.nbHitsHistogram.size() == rhs.nbHitsHistogram.size()
+                   && lhs.timeHistogram.size() == rhs.timeHistogram.size();
+        }
+
+        //! Same layout as the state loaded from the snapshot, which StateBinaryReader::LoadAll checked against the geometry
+        bool MatchesState(const JournalRecord &record, const GlobalSimuState &globState) {
+            if (record.globalHistograms.size() != globState.globalHistograms.size())
+                return false;
+            for (size_t m = 0; m < record.globalHistograms.size(); m++) {
+                if (!SameSize(record.globalHistograms[m], globState.globalHistograms[m]))
+                    return false;
+            }
+            for (const auto &entry : record.moments) {
+                if (entry.facetId >= globState.facetStates.size()
+                    || entry.moment >= globState.facetStates[entry.facetId].momentResults.size())
+                    return false;
+                const auto &loaded = globState.facetStates[entry.facetId].momentResults[entry.moment];
+                if (entry.snapshot.texture.size() != loaded.texture.size()
+                    || entry.snapshot.profile.size() != loaded.profile.size()
+                    || entry.snapshot.direction.size() != loaded.direction.size()
+                    || !SameSize(entry.snapshot.histogram, loaded.histogram))
+                    return false;
+            }
+            for (const auto &entry : record.angleMaps) {
+                if (entry.facetId >= globState.facetStates.size()
+                    || entry.pdf.size() != globState.facetStates[entry.facetId].recordedAngleMapPdf.size())
+                    return false;
+            }
+            return true;
+        }
+
+        enum class RecordStatus {
+            Complete,
+            End, // no record left, or an incomplete last record from an interrupted checkpoint
+            Corrupt
+        };
+
+        //! Reads the next length prefixed record, the length is checked against the rest of the file before allocating
+        RecordStatus ReadRecord(std::ifstream &in, uint64_t fileSize, JournalRecord &record) {
+            uint64_t blobSize = 0;
+            if (!in.read(reinterpret_cast<char *>(&blobSize), sizeof(blobSize)))
+                return RecordStatus::End;
+            const auto position = static_cast<uint64_t>(in.tellg());
+            if (position > fileSize || blobSize > fileSize - position)
+                return RecordStatus::End;
+            std::string blob(blobSize, '\0');
+            if (!in.read(blob.data(), static_cast<std::streamsize>(blobSize)))
+                return RecordStatus::End;
+
+            record = JournalRecord();
+            try {
+                std::istringstream recordStream(blob, std::ios::binary);
+                cereal::BinaryInputArchive archive(recordStream);
+                archive(record);
+            }
+            catch (const std::exception &e) {
+                Log::console_error("[StateJournal] {}\n", e.what());
+                return RecordStatus::Corrupt;
+            }
+            return RecordStatus::Complete;
+        }
+    }
+
+    /**
+    * \param xmlFileName autosave file, snapshot and journal are stored next to it
+    * \param compactionInterval number of journal records after which a new snapshot is written
+    */
+    StateJournal::StateJournal(const std::string &xmlFileName, size_t compactionInterval)
+            : snapshotFileName(StateBinary::GetSidecarName(xmlFileName)),
+              journalFileName(GetJournalName(xmlFileName)),
+              compactionInterval(compactionInterval) {
+    }
+
+    std::string StateJournal::GetJournalName(const std::string &xmlFileName) {
+        return xmlFileName + ".mfjournal";
+    }
+
+    /**
+    * \brief Writes a full snapshot and starts a new, empty journal
+    * The journal is dropped first: an interruption leaves the previous snapshot without deltas, which is older but consistent
+    */
+    bool StateJournal::Compact(const MolflowSimulationModel &model, GlobalSimuState &globState) {
+        std::error_code ec;
+        std::filesystem::remove(journalFileName, ec);
+        nbRecords = 0;
+        hasSnapshot = false;
+        {
+            // Same as AsyncStateWriter: the live state is only locked for the copy, changes after it go to the journal
+            std::lock_guard<std::timed_mutex> lock(globState.tMutex);
+            snapshotBuffer = globState;
+            nbFacets = globState.facetStates.size();
+            nbMomentResults = GetNbMomentResults(globState);
+            if (globState.changedFacets.Fits(nbFacets, nbMomentResults - 1))
+                globState.changedFacets.clear();
+            else
+                globState.changedFacets.Resize(nbFacets, nbMomentResults - 1);
+            globState.trackChanges = true;
+            globState.fullSnapshotNeeded = false;
+        }
+        uint64_t snapshotId = 0;
+        if (!StateBinary::Save(snapshotFileName, model, snapshotBuffer, &snapshotId))
+            return false;
+
+        JournalHeader header{};
+        std::memcpy(header.magic, journalMagic, sizeof(journalMagic));
+        header.version = journalVersion;
+        header.headerSize = sizeof(JournalHeader);
+        header.snapshotId = snapshotId;
+        std::ofstream out(journalFileName, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(JournalHeader));
+        out.flush();
+        if (!out) {
+            Log::console_error("[StateJournal] Could not create {}\n", journalFileName);
+            return false;
+        }
+        hasSnapshot = true;
+        return true;
+    }
+
+    /**
+    * \brief Appends the changes since the last checkpoint, or writes a new snapshot when due
+    * \param globState live state, only locked while the changed entries are copied
+    * \return true on success
+    */
+    bool StateJournal::Checkpoint(const MolflowSimulationModel &model, GlobalSimuState &globState) {
+        JournalRecord record;
+        {
+            std::unique_lock<std::timed_mutex> lock(globState.tMutex);
+            const bool layoutChanged = globState.facetStates.size() != nbFacets
+                                       || GetNbMomentResults(globState) != nbMomentResults
+                                       || !globState.changedFacets.Fits(nbFacets, nbMomentResults - 1);
+            if (!hasSnapshot || layoutChanged || globState.fullSnapshotNeeded || !globState.trackChanges
+                || nbRecords >= compactionInterval) {
+                lock.unlock();
+                return Compact(model, globState);
+            }
+
+            record.globalHits = globState.globalHits;
+            record.globalHistograms = globState.globalHistograms;
+            const auto &entries = globState.changedFacets.GetEntries();
+            record.moments.reserve(entries.size());
+            for (const auto &[facetId, moment] : entries) {
+                const auto &facetState = globState.facetStates[facetId];
+                record.moments.push_back(JournalMoment{facetId, moment, facetState.momentResults[moment]});
+                if (moment == 0 && !facetState.recordedAngleMapPdf.empty())
+                    record.angleMaps.push_back(JournalAngleMap{facetId, facetState.recordedAngleMapPdf});
+            }
+            globState.changedFacets.clear();
+        }
+
+        std::ostringstream recordStream(std::ios::binary);
+        {
+            cereal::BinaryOutputArchive archive(recordStream);
+            archive(record);
+        }
+
+        // Length prefixed record, a partially written record at the end is ignored on replay
+        const std::string blob = recordStream.str();
+        const uint64_t blobSize = blob.size();
+        std::ofstream out(journalFileName, std::ios::binary | std::ios::app);
+        out.write(reinterpret_cast<const char *>(&blobSize), sizeof(blobSize));
+        out.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+        out.flush();
+        if (!out) {
+            Log::console_error("[StateJournal] Could not append to {}\n", journalFileName);
+            hasSnapshot = false; // next checkpoint writes a full snapshot
+            return false;
+        }
+        nbRecords++;
+        Log::console_msg_master(4, "[StateJournal] Appended {} changed facet moments ({} bytes)\n", record.moments.size(), blob.size());
+        return true;
+    }
+
+    /**
+    * \brief Applies all complete journal records to a state loaded from the snapshot
+    * All records are read and checked against the loaded state first, on error nothing is applied
+    * \param journalFileName journal file, see GetJournalName
+    * \param snapshotId id of the loaded snapshot (StateBinaryReader::GetSnapshotId), journals of other snapshots are ignored
+    * \param model model the state belongs to, recording facets get the replayed angle maps like with StateBinaryReader::LoadAll
+    * \param globState state loaded from the matching snapshot
+    * \return 0 on success or if there is no journal, 1 on error, globState is then unchanged
+    */
+    int StateJournal::Replay(const std::string &journalFileName, uint64_t snapshotId, MolflowSimulationModel &model,
+                             GlobalSimuState &globState) {
+        std::ifstream in(journalFileName, std::ios::binary);
+        if (!in)
+            return 0;
+
+        // A journal left over from an older snapshot would roll the loaded state back
+        JournalHeader header{};
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(JournalHeader))
+            || std::memcmp(header.magic, journalMagic, sizeof(journalMagic)) != 0 || header.version != journalVersion
+            || header.headerSize != sizeof(JournalHeader) || header.snapshotId != snapshotId) {
+            Log::console_msg_master(2, " Ignoring autosave journal {}, it doesn't belong to the loaded snapshot\n", journalFileName);
+            return 0;
+        }
+
+        std::error_code ec;
+        const uint64_t fileSize = std::filesystem::file_size(journalFileName, ec);
+        if (ec)
+            return 1;
+
+        std::lock_guard<std::timed_mutex> lock(globState.tMutex);
+        // Every record is checked before the first one is applied, so that on error the state stays the snapshot
+        const auto recordsBegin = in.tellg();
+        size_t nbRecords = 0;
+        JournalRecord record;
+        RecordStatus status;
+        while ((status = ReadRecord(in, fileSize, record)) == RecordStatus::Complete) {
+            if (!MatchesState(record, globState)) {
+                Log::console_error("[StateJournal] Record {} in {} doesn't match the geometry\n", nbRecords + 1, journalFileName);
+                return 1;
+            }
+            nbRecords++;
+        }
+        if (status == RecordStatus::Corrupt) {
+            Log::console_error("[StateJournal] Corrupt record {} in {}\n", nbRecords + 1, journalFileName);
+            return 1;
+        }
+
+        in.clear();
+        in.seekg(recordsBegin);
+        size_t nbReplayed = 0;
+        for (; nbReplayed < nbRecords; nbReplayed++) {
+            if (ReadRecord(in, fileSize, record) != RecordStatus::Complete)
+                return 1; // changed since the first pass
+            globState.globalHits = record.globalHits;
+            globState.globalHistograms = std::move(record.globalHistograms);
+            for (auto &entry : record.moments)
+                globState.facetStates[entry.facetId].momentResults[entry.moment] = std::move(entry.snapshot);
+            for (auto &entry : record.angleMaps) {
+                auto facet = entry.facetId < model.facets.size()
+                             ? std::dynamic_pointer_cast<MolflowSimFacet>(model.facets[entry.facetId]) : nullptr;
+                if (facet && facet->sh.anglemapParams.record)
+                    facet->angleMap.pdf = entry.pdf;
+                globState.facetStates[entry.facetId].recordedAngleMapPdf = std::move(entry.pdf);
+            }
+        }
+        Log::console_msg_master(2, " Replayed {} autosave journal records\n", nbReplayed);
+        return 0;
+    }
+}
@@ -0,0 +1,68 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_STATEJOURNAL_H
+#define MOLFLOW_PROJ_STATEJOURNAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Simulation/MolflowSimGeom.h"
+
+namespace FlowIO {
+
+    /**
+    * \brief Incremental autosave: a binary snapshot (StateBinary) plus a journal of the facet moments changed since
+    * Every checkpoint appends one record containing the global counters and all (facet, moment) results merged
+    * since the previous checkpoint (GlobalSimuState::changedFacets). Records overwrite, so replaying them in order on
+    * top of the snapshot restores the latest state. Every compactionInterval records, a new snapshot replaces the
+    * journal, as does any change not tracked per entry (GlobalSimuState::fullSnapshotNeeded, e.g. after a Reset).
+    * Only the global state attached by the first snapshot tracks changes (GlobalSimuState::trackChanges).
+    * The journal header holds the id of its snapshot, so that a journal is never replayed on another snapshot.
+    * The live state is only locked while the changed entries, or for a snapshot the whole state, are copied.
+     */
+    class StateJournal {
+    public:
+        StateJournal(const std::string &xmlFileName, size_t compactionInterval);
+
+        static std::string GetJournalName(const std::string &xmlFileName);
+
+        bool Checkpoint(const MolflowSimulationModel &model, GlobalSimuState &globState);
+        bool Compact(const MolflowSimulationModel &model, GlobalSimuState &globState);
+
+        static int Replay(const std::string &journalFileName, uint64_t snapshotId, MolflowSimulationModel &model,
+                          GlobalSimuState &globState);
+
+        [[nodiscard]] size_t GetNbRecords() const { return nbRecords; };
+
+    private:
+        std::string snapshotFileName;
+        std::string journalFileName;
+        size_t compactionInterval;
+        size_t nbRecords{0}; // records in the journal since the last snapshot
+        bool hasSnapshot{false};
+
+        size_t nbFacets{0}; // layout at the last snapshot
+        size_t nbMomentResults{0}; // 1+nbMoments
+        GlobalSimuState snapshotBuffer; // copy of the state written by Compact, buffers are reused
+    };
+}
+
+#endif //MOLFLOW_PROJ_STATEJOURNAL_H
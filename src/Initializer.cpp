@@ -20,6 +20,8 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 
 #include "Initializer.h"
 #include "IO/LoaderXML.h"
+#include "IO/StateBinary.h"
+#include "IO/StateJournal.h"
 #include "ParameterParser.h"
 
 #include <CLI11/CLI11.hpp>
@@ -37,6 +39,18 @@ namespace Settings {
     bool resetOnStart = false;
     std::string paramFile;
     std::vector<std::string> paramSweep;
+    bool sparseResults = false;
+    bool wideBVH = false;
+    bool compactBVH = false;
+    size_t wavefrontSize = 0;
+    double syncMaxLatency = 5.0;
+    size_t velocityTableSize = 4096;
+    size_t accelBuildThreads = 0;
+    std::string accelCacheFile;
+    double accelReoptimizeTime = 0.0;
+    bool binaryState = false;
+    bool deltaAutosave = false;
+    size_t autosaveCompaction = 10;
 }
 
 void initDefaultSettings() {
@@ -49,6 +63,18 @@ void initDefaultSettings() {
     Settings::resetOnStart = false;
     Settings::paramFile.clear();
     Settings::paramSweep.clear();
+    Settings::sparseResults = false;
+    Settings::wideBVH = false;
+    Settings::compactBVH = false;
+    Settings::wavefrontSize = 0;
+    Settings::syncMaxLatency = 5.0;
+    Settings::velocityTableSize = 4096;
+    Settings::accelBuildThreads = 0;
+    Settings::accelCacheFile.clear();
+    Settings::accelReoptimizeTime = 0.0;
+    Settings::binaryState = false;
+    Settings::deltaAutosave = false;
+    Settings::autosaveCompaction = 10;
 
     SettingsIO::outputFacetDetails = false;
     SettingsIO::outputFacetQuantities = false;
@@ -118,6 +144,30 @@ int Initializer::parseCommands(int argc, char **argv) {
 
     app.add_flag("--loadAutosave", Settings::loadAutosave, "Whether autosave_ file should be used if exists");
     app.add_flag("-r,--reset", Settings::resetOnStart, "Resets simulation status loaded from file");
+    app.add_flag("--sparseResults", Settings::sparseResults,
+                 "Threads only buffer touched texture/profile/direction cells, for large textured or time-dependent models");
+    app.add_flag("--wideBVH", Settings::wideBVH,
+                 "Trace with a 4-wide BVH using SIMD box tests instead of the binary BVH");
+    app.add_flag("--compactBVH", Settings::compactBVH,
+                 "Store the --wideBVH nodes with 16-bit quantized bounds, less memory traffic for large geometries");
+    app.add_option("--accelBuildThreads", Settings::accelBuildThreads,
+                   "Threads building the acceleration structures (0: all hardware threads)");
+    app.add_option("--accelCache", Settings::accelCacheFile,
+                   "Cache file for the --wideBVH trees, reused while the geometry is unchanged (e.g. for parameter sweeps)");
+    app.add_option("--accelReoptimize", Settings::accelReoptimizeTime,
+                   "Seconds of tracing after which the BVH is rebuilt in the background with the hit statistics (ProbSplit) and swapped in (0: off)");
+    app.add_option("--wavefront", Settings::wavefrontSize,
+                   "Wavefront engine: number of particles each thread keeps in flight and traces in stages (0: off)");
+    app.add_option("--velocityTable", Settings::velocityTableSize,
+                   "Resolution of the tabulated inverse Maxwell-Boltzmann speed distribution (0: exact inverse, for validation)");
+    app.add_option("--syncLatency", Settings::syncMaxLatency,
+                   "Longest time in seconds a thread simulates before merging its results, interval adapts to merge cost below (0: fixed steps)");
+    app.add_flag("--binaryState", Settings::binaryState,
+                 "Write autosaves and results additionally as binary state file (<file>.xml.mfstate) for fast restarts");
+    app.add_flag("--deltaAutosave", Settings::deltaAutosave,
+                 "Autosave only appends changed facet results to a journal (<file>.xml.mfjournal) next to a binary snapshot");
+    app.add_option("--autosaveCompaction", Settings::autosaveCompaction,
+                   "Number of delta autosaves after which a new full snapshot is written");
     app.add_flag("--verbose", verbose, "Verbose console output (all levels)");
     CLI::Option *optOverwrite = app.add_flag("--overwrite", SettingsIO::overwrite,
                                              "Overwrite input file with new results")->excludes(optOfile, optOpath);
@@ -216,6 +266,8 @@ int Initializer::initFromFile(SimulationManager *simManager, const std::shared_p
         if(ParameterParser::ChangeFacetParams(model->facets)){
             return 1;
         }
+        // Outgassing or temperature might have changed, update source selection
+        model->CalcTotalOutgassing();
     }
 
     // Set desorption limit if used
@@ -223,6 +275,14 @@ int Initializer::initFromFile(SimulationManager *simManager, const std::shared_p
         return 1;
     }
 
+    model->sparseThreadResults = Settings::sparseResults;
+    model->wideAccel = Settings::wideBVH;
+    model->compactAccel = Settings::compactBVH;
+    model->wavefrontSize = Settings::wavefrontSize;
+    model->syncMaxLatency = Settings::syncMaxLatency;
+    model->accelBuildThreads = Settings::accelBuildThreads;
+    model->accelCacheFile = Settings::accelCacheFile;
+    model->accelReoptimizeTime = Settings::accelReoptimizeTime;
     simManager->simulationChanged = true;
     Log::console_msg_master(2, "Forwarding model to simulation units!\n");
     try {
@@ -256,6 +316,14 @@ int Initializer::initAutoGenerated(SimulationManager *simManager, const std::sha
         return 1;
     }
 
+    model->sparseThreadResults = Settings::sparseResults;
+    model->wideAccel = Settings::wideBVH;
+    model->compactAccel = Settings::compactBVH;
+    model->wavefrontSize = Settings::wavefrontSize;
+    model->syncMaxLatency = Settings::syncMaxLatency;
+    model->accelBuildThreads = Settings::accelBuildThreads;
+    model->accelCacheFile = Settings::accelCacheFile;
+    model->accelReoptimizeTime = Settings::accelReoptimizeTime;
     simManager->simulationChanged = true;
     Log::console_msg_master(2, "Forwarding model to simulation units!\n");
     try {
@@ -328,6 +396,31 @@ Initializer::loadFromGeneration(const std::shared_ptr<MolflowSimulationModel> &m
     return 0;
 }
 
+/**
+* \brief Loads previous results, from the binary state file if it is up to date or from the XML file otherwise
+ * \return 0> error code, 0 when ok
+ */
+int Initializer::loadSimulationState(const std::string &fileName, const std::shared_ptr<MolflowSimulationModel> &model,
+                                     GlobalSimuState *globState) {
+    std::string binaryFileName = FlowIO::StateBinary::GetSidecarName(fileName);
+    std::error_code ec;
+    if (std::filesystem::exists(binaryFileName, ec)
+        && std::filesystem::last_write_time(binaryFileName, ec) >= std::filesystem::last_write_time(fileName, ec) && !ec) {
+        FlowIO::StateBinaryReader reader;
+        if (reader.Open(binaryFileName) && !reader.LoadAll(model, *globState)) {
+            Log::console_msg_master(2, " Loaded simulation state from {}\n", binaryFileName);
+            // Changes from delta autosaves after the snapshot, a bad journal leaves the snapshot state untouched
+            if (FlowIO::StateJournal::Replay(FlowIO::StateJournal::GetJournalName(fileName), reader.GetSnapshotId(),
+                                             *model, *globState))
+                Log::console_msg_master(2, " Autosave journal not usable, continuing from the snapshot\n");
+            return 0;
+        }
+        Log::console_msg_master(2, " Binary state {} not usable, falling back to XML\n", binaryFileName);
+        globState->Reset();
+    }
+    return FlowIO::LoaderXML::LoadSimulationState(fileName, model, globState, nullptr);
+}
+
 /**
 * \brief Wrapper for XML loading with LoaderXML
  * \return 0> error code, 0 when ok
@@ -386,10 +479,15 @@ int Initializer::loadFromXML(const std::string &fileName, bool loadState, const
                 autosaveFileName = autoSavePrefix + autosaveFileName;
                 if (std::filesystem::exists(autosaveFileName)) {
                     Log::console_msg_master(2, " Found autosave file! Loading simulation state...\n");
-                    FlowIO::LoaderXML::LoadSimulationState(autosaveFileName, model, globState, nullptr);
+                    if (loadSimulationState(autosaveFileName, model, globState)) {
+                        Log::console_msg_master(2, " No previous results loaded from {}\n", autosaveFileName);
+                        globState->Reset();
+                    }
                 }
-            } else {
-                FlowIO::LoaderXML::LoadSimulationState(SettingsIO::workFile, model, globState, nullptr);
+            } else if (loadSimulationState(SettingsIO::workFile, model, globState)) {
+                // e.g. no results saved with the file, a partially loaded state is not kept
+                Log::console_msg_master(2, " No previous results loaded from {}\n", SettingsIO::workFile);
+                globState->Reset();
             }
 
             // Update Angle map status
@@ -516,6 +614,9 @@ int Initializer::initSimModel(std::shared_ptr<MolflowSimulationModel> model) {
         return 1;
     }
 
+    // Used by PrepareToRun to build the velocity tables, so set before instead of with the other settings
+    model->velocityTableSize = Settings::velocityTableSize;
+
     std::vector<Moment> momentIntervals;
     momentIntervals.reserve(model->tdParams.moments.size());
     for (auto &moment : model->tdParams.moments) {
@@ -36,6 +36,18 @@ namespace Settings {
     extern bool resetOnStart;
     extern std::string paramFile;
     extern std::vector<std::string> paramSweep;
+    extern bool sparseResults;
+    extern bool wideBVH;
+    extern bool compactBVH;
+    extern size_t wavefrontSize;
+    extern double syncMaxLatency;
+    extern size_t velocityTableSize;
+    extern size_t accelBuildThreads;
+    extern std::string accelCacheFile;
+    extern double accelReoptimizeTime;
+    extern bool binaryState;
+    extern bool deltaAutosave;
+    extern size_t autosaveCompaction;
 }
 
 class Initializer {
@@ -44,6 +56,8 @@ private:
     static int loadFromXML(const std::string &fileName, bool loadState, const std::shared_ptr<MolflowSimulationModel>& model,
                            GlobalSimuState *globState);
     static int initSimModel(std::shared_ptr<MolflowSimulationModel> model);
+    static int loadSimulationState(const std::string &fileName, const std::shared_ptr<MolflowSimulationModel> &model,
+                                   GlobalSimuState *globState);
 public:
     static std::string getAutosaveFile();
     static int initFromFile(SimulationManager *simManager, const std::shared_ptr<MolflowSimulationModel>& model, GlobalSimuState *globState);
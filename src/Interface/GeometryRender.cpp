@@ -129,7 +129,7 @@ void MolflowGeometry::BuildFacetTextures(GlobalSimuState &globState, bool render
 
 			// Retrieve texture from shared memory (every seconds)
 			//TextureCell *hits_local = (TextureCell *)((BYTE *)shGHit + (f->sh.hitOffset + facetHitsSize + profSize*(1 + nbMoments) + tSize*mApp->worker.displayedMoment));
-			f->BuildTexture(globState.facetStates[i].momentResults[mApp->worker.displayedMoment].texture, textureMode, min, max, texColormap,
+			f->BuildTexture(globState.facetStates[i].momentResults[mApp->worker.displayedMoment].texture.ToVector(), textureMode, min, max, texColormap,
 				dCoef_custom[0] * timeCorrection, dCoef_custom[1] * timeCorrection, dCoef_custom[2] * timeCorrection, texLogScale, mApp->worker.displayedMoment);
 		}
 
@@ -144,7 +144,7 @@ void MolflowGeometry::BuildFacetTextures(GlobalSimuState &globState, bool render
 			*/
 
 
-			const std::vector<DirectionCell>& dirs = globState.facetStates[i].momentResults[mApp->worker.displayedMoment].direction;
+			const TiledCells<DirectionCell>& dirs = globState.facetStates[i].momentResults[mApp->worker.displayedMoment].direction;
 			for (size_t j = 0; j < nbElem; j++) {
 				double denominator = (dirs[j].count > 0) ? 1.0 / dirs[j].count : 1.0;
 				f->dirCache[j].dir = dirs[j].dir * denominator;
@@ -175,16 +175,15 @@ void MomentsEditor::ProcessMessage(GLComponent *src, int message) {
 					parsedMoments.emplace_back(ParseMoment(userMoments[u].first, userMoments[u].second));
 				}
 
-				auto overlapPair = TimeMoments::CheckIntervalOverlap(parsedMoments);
-				if(overlapPair.first != 0 || overlapPair.second != 0){
-                    char tmp[128];
-                    if(overlapPair.second < 0)
-                        sprintf(tmp, "Interval length and time window would create overlap! Check line %d.", overlapPair.first+1);
-                    else
-                        sprintf(tmp, "Overlapping time window detected! Check lines %d and %d.", overlapPair.first+1,overlapPair.second+1);
-                    GLMessageBox::Display(tmp, "Error", GLDLG_OK, GLDLG_ICONERROR);
-                    return;
-                }
+				// Overlapping time windows are allowed, hits are recorded in every matching moment
+				for (size_t u = 0; u != parsedMoments.size(); u++) {
+					if (parsedMoments[u].empty()) {
+						char tmp[128];
+						sprintf(tmp, "Invalid time moment expression! Check line %zd.", u + 1);
+						GLMessageBox::Display(tmp, "Error", GLDLG_OK, GLDLG_ICONERROR);
+						return;
+					}
+				}
 
                 moments.clear();
                 for(auto& newMoment : parsedMoments)
@@ -360,13 +359,10 @@ std::vector<Moment> MomentsEditor::ParseMoment(const std::string& userInput, dou
 		parsedResult.emplace_back(begin,timeWindow);
 		//} else if (nb==3 && (begin>0.0) && (end>begin) && (interval<(end-begin)) && ((end-begin)/interval<300.0)) {
 	}
-	else if (nb == 3 && (begin >= 0.0) && (end > begin) && (interval < (end - begin))) {
-		//Range
-		// First check for potential overlap due to interval<timeWindow
-		if(!(interval<timeWindow)){
-            for (double time = begin; time <= end; time += interval)
-                parsedResult.emplace_back(time, timeWindow);
-        }
+	else if (nb == 3 && (begin >= 0.0) && (end > begin) && (interval > 0.0) && (interval < (end - begin))) {
+		//Range, windows larger than the interval give overlapping moments
+		for (double time = begin; time <= end; time += interval)
+			parsedResult.emplace_back(time, timeWindow);
 	}
 	return parsedResult;
 }
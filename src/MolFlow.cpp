@@ -57,6 +57,7 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 
 #include "AppUpdater.h"
 #include "Worker.h"
+#include "Simulation/MolflowSimGeom.h"
 #include "Interface/ImportDesorption.h"
 #include "Interface/TimeSettings.h"
 #include "Interface/Movement.h"
@@ -724,10 +725,14 @@ void MolFlow::ApplyFacetParams() {
 	
 	changedSinceSave = true;
 
+	// Sticking, opacity and outgassing values can be applied without reloading the simulation
+	bool physicsOnly = !(facetAdvParams && facetAdvParams->IsVisible());
+
 	// Update facets (local)
 	for (int i = 0; i < nbFacet; i++) {
 		InterfaceFacet *f = geom->GetFacet(i);
 		if (f->selected) {
+			const auto before = f->sh;
 			if (doSticking) {
 				if (!stickingNotNumber) {
 					f->sh.sticking = sticking;
@@ -773,11 +778,16 @@ void MolFlow::ApplyFacetParams() {
 
 			f->sh.maxSpeed = 4.0 * sqrt(2.0*8.31*f->sh.temperature / 0.001 / worker.model->wp.gasMass);
 			f->UpdateFlags();
+
+			physicsOnly = physicsOnly && f->sh.temperature == before.temperature && f->sh.desorbType == before.desorbType
+				&& f->sh.desorbTypeN == before.desorbTypeN && f->sh.profileType == before.profileType
+				&& f->sh.is2sided == before.is2sided;
 		}
 	}
 
 	// Mark "needsReload" to sync changes with workers on next simulation start
-	worker.Reload();
+	if (!physicsOnly || !ApplyFacetPhysics())
+		worker.Reload();
 
 	worker.CalcTotalOutgassing();
 	UpdateFacetParams(false);
@@ -787,6 +797,36 @@ void MolFlow::ApplyFacetParams() {
 	//if (facetAdvParams) facetAdvParams->Refresh();
 }
 
+/**
+* \brief Copies sticking, opacity and outgassing of all facets to the simulation model in place
+* The acceleration structures and result buffers are kept, the model only re-binds surfaces and source tables.
+* \return false if the simulation model is out of sync with the geometry or one of these values is time-dependent
+*/
+bool MolFlow::ApplyFacetPhysics() {
+	auto mfModel = std::dynamic_pointer_cast<MolflowSimulationModel>(worker.model);
+	Geometry *geom = worker.GetGeometry();
+	if (!mfModel || worker.needsReload || worker.IsRunning() || !mfModel->initialized
+		|| mfModel->facets.size() != geom->GetNbFacet())
+		return false;
+
+	for (size_t i = 0; i < geom->GetNbFacet(); i++) {
+		const InterfaceFacet *f = geom->GetFacet(i);
+		const auto &sFac = mfModel->facets[i];
+		// Parameter names are resolved to ids and tables by Worker::PrepareToRun
+		if (!f->userSticking.empty() || !f->userOpacity.empty() || !f->userOutgassing.empty()
+			|| sFac->sh.sticking_paramId != -1 || sFac->sh.opacity_paramId != -1 || sFac->sh.outgassing_paramId != -1)
+			return false;
+	}
+	for (size_t i = 0; i < geom->GetNbFacet(); i++) {
+		const InterfaceFacet *f = geom->GetFacet(i);
+		auto &sFac = mfModel->facets[i];
+		sFac->sh.sticking = f->sh.sticking;
+		sFac->sh.opacity = f->sh.opacity;
+		sFac->sh.outgassing = f->sh.outgassing;
+	}
+	return mfModel->RefreshSurfaces() == 0;
+}
+
 // Name: UpdateFacetParams()
 // Desc: Update selected facet parameters.
 
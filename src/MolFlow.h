@@ -62,6 +62,7 @@ public:
     void ClearFacetParams() override;
 	
     void ApplyFacetParams();
+	bool ApplyFacetPhysics();
 	void UpdateFacetParams(bool updateSelection) override;
     void StartStopSimulation();
     void SaveConfig() override;
@@ -1434,7 +1434,7 @@ bool MolflowGeometry::LoadTexturesGEO(FileReader *file, GLProgress *prg, GlobalS
 						size_t h = f->sh.texHeight;
 						size_t w = f->sh.texWidth;
 
-						std::vector<TextureCell>& texture = globState.facetStates[i].momentResults[m].texture;
+						TiledCells<TextureCell>& texture = globState.facetStates[i].momentResults[m].texture;
 
 						size_t texWidth_file, texHeight_file;
 						//In case of rounding errors, the file might contain different texture dimensions than expected.
@@ -1471,6 +1471,7 @@ bool MolflowGeometry::LoadTexturesGEO(FileReader *file, GLProgress *prg, GlobalS
 								file->ReadDouble();
 							}
 						}
+						texture.Compact(); // keep only the tiles with hits
 						file->ReadKeyword("}");
 					}
 				}
@@ -1738,7 +1739,7 @@ void MolflowGeometry::SaveGEO(FileWriter *file, GLProgress *prg, GlobalSimuState
 					size_t h = f->sh.texHeight;
 					size_t w = f->sh.texWidth;
 					size_t profSize = (f->sh.isProfile) ? (PROFILE_SIZE * sizeof(ProfileSlice) * (1 + (int)mApp->worker.moments.size())) : 0;
-					const std::vector<TextureCell>& texture = globState.facetStates[i].momentResults[m].texture;
+					const TiledCells<TextureCell>& texture = globState.facetStates[i].momentResults[m].texture;
 
 					//char tmp[256];
 					sprintf(tmp, "texture_facet %d {\n", k); //Starts from 1, not 0, first element is k=1
@@ -1875,8 +1876,8 @@ MolflowGeometry::ExportTextures(FILE *file, int grouping, int mode, GlobalSimuSt
 					size_t dSize = w * h * sizeof(DirectionCell);
 
                     const auto& facetSnapshot = globState.facetStates[fInd].momentResults[m];
-                    const std::vector<TextureCell>& texture = globState.facetStates[fInd].momentResults[m].texture;
-					const std::vector<DirectionCell>& dirs = globState.facetStates[fInd].momentResults[m].direction;
+                    const TiledCells<TextureCell>& texture = globState.facetStates[fInd].momentResults[m].texture;
+					const TiledCells<DirectionCell>& dirs = globState.facetStates[fInd].momentResults[m].direction;
 
 					for (size_t r = 0; r < h; r++) {
 						for (size_t c = 0; c < w; c++) {
@@ -2876,7 +2877,7 @@ bool MolflowGeometry::SaveXML_simustate(xml_node saveDoc, Worker *work, GlobalSi
 				textureNode.append_attribute("width") = f->sh.texWidth;
 				textureNode.append_attribute("height") = f->sh.texHeight;
 
-				const std::vector<TextureCell>& texture = globState.facetStates[i].momentResults[m].texture;
+				const TiledCells<TextureCell>& texture = globState.facetStates[i].momentResults[m].texture;
 				std::stringstream countText, sum1perText, sumvortText;
 				countText << '\n'; //better readability in file
 				sum1perText << std::setprecision(8) << '\n';
@@ -2905,7 +2906,7 @@ bool MolflowGeometry::SaveXML_simustate(xml_node saveDoc, Worker *work, GlobalSi
 				dirNode.append_attribute("width") = f->sh.texWidth;
 				dirNode.append_attribute("height") = f->sh.texHeight;
 
-				const std::vector<DirectionCell>& dirs = globState.facetStates[i].momentResults[m].direction;
+				const TiledCells<DirectionCell>& dirs = globState.facetStates[i].momentResults[m].direction;
 
 				std::stringstream dirText, dirCountText;
 				dirText << std::setprecision(8) << '\n'; //better readability in file
@@ -3780,7 +3781,7 @@ bool MolflowGeometry::LoadXML_simustate(pugi::xml_node loadXML, GlobalSimuState
 					throw Error(msg.str().c_str());
 					}*/ //We'll treat texture size mismatch, see below
 
-				std::vector<TextureCell>& texture = globState.facetStates[facetId].momentResults[m].texture;
+				TiledCells<TextureCell>& texture = globState.facetStates[facetId].momentResults[m].texture;
 				std::stringstream countText, sum1perText, sumvortText;
 				if (textureNode.child("countEquiv")) {
 					countText << textureNode.child_value("countEquiv");
@@ -3819,6 +3820,7 @@ bool MolflowGeometry::LoadXML_simustate(pugi::xml_node loadXML, GlobalSimuState
 					}
 
 				}
+				texture.Compact(); // keep only the tiles with hits
 			} //end texture
 
 			if (f->sh.countDirection && f->dirCache) {
@@ -3831,7 +3833,7 @@ bool MolflowGeometry::LoadXML_simustate(pugi::xml_node loadXML, GlobalSimuState
 					throw Error(msg.str().c_str());
 
 				}
-				std::vector<DirectionCell>& dirs = globState.facetStates[facetId].momentResults[m].direction;
+				TiledCells<DirectionCell>& dirs = globState.facetStates[facetId].momentResults[m].direction;
 
 				std::stringstream dirText, dirCountText;
 				dirText << dirNode.child_value("vel.vectors");
@@ -3848,6 +3850,7 @@ bool MolflowGeometry::LoadXML_simustate(pugi::xml_node loadXML, GlobalSimuState
 						dirCountText >> dirs[iy * f->sh.texWidth + ix].count;
 					}
 				}
+				dirs.Compact();
 			} //end directions
 
 			bool hasHistogram = f->sh.facetHistogramParams.recordBounce || f->sh.facetHistogramParams.recordDistance;
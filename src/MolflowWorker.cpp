@@ -759,7 +759,7 @@ void Worker::LoadGeometry(const std::string &fileName, bool insert, bool newStr)
 
                 // Add moments only after user Moments are completely initialized
                 if (TimeMoments::ParseAndCheckUserMoments(&moments, &userMoments, nullptr)) {
-                    GLMessageBox::Display("Overlap in time moments detected! Check in Moments Editor!", "Warning",
+                    GLMessageBox::Display("Invalid time moments detected! Check in Moments Editor!", "Warning",
                                           GLDLG_OK, GLDLG_ICONWARNING);
                     return;
                 }
@@ -935,7 +935,7 @@ void Worker::LoadGeometry(const std::string &fileName, bool insert, bool newStr)
                     } while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
                     progressDlg->SetProgress(0.0);
                     if (future.get()) {
-                        GLMessageBox::Display("Overlap in time moments detected! Check in Moments Editor!", "Warning",
+                        GLMessageBox::Display("Invalid time moments detected! Check in Moments Editor!", "Warning",
                                               GLDLG_OK, GLDLG_ICONWARNING);
                         progressDlg->SetVisible(false);
                         SAFE_DELETE(progressDlg);
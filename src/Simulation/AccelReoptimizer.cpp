@@ -0,0 +1,156 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "AccelReoptimizer.h"
+#include <Helper/Chronometer.h>
+#include <Helper/ConsoleLogger.h>
+#include <RayTracing/BVH.h>
+#include <algorithm>
+#include <mutex>
+
+// Leaf size of the rebuilt trees, the same as for the initial build in Simulation::RebuildAccelStructure
+static constexpr int maxPrimsInNode = 2;
+
+namespace MFSim {
+
+    /**
+    * \brief Starts a new run on freshly built trees
+    * \param model model of the run, re-optimization is enabled with accelReoptimizeTime > 0
+    * \param nbThreads number of threads tracing, to turn their summed busy time into wall time
+    */
+    void AccelReoptimizer::Reset(const MolflowSimulationModel &model, size_t nbThreads) {
+        window = model.accelReoptimizeTime;
+        this->nbThreads = std::max<size_t>(1, nbThreads);
+        nbSteps = 0;
+        busyNs = 0;
+        hitRateBefore = 0.0;
+        hitRateAfter = 0.0;
+        buildMs = 0.0;
+
+        bool enable = window > 0.0 && model.sh.nbSuper > 0;
+        if (enable && model.wideAccel) {
+            Log::console_msg_master(2, "  ProbSplit re-optimization is not available for the wide BVH, disabled\n");
+            enable = false;
+        }
+        phase.store(enable ? WarmUp : Disabled, std::memory_order_release);
+    }
+
+    /**
+    * \brief Called by a thread before tracing, waits for a running rebuild
+    * \return lock to hold while tracing, empty when the trees can no longer change
+    */
+    std::shared_lock<std::shared_mutex> AccelReoptimizer::BeginStep(MolflowSimulationModel &model) {
+        const int current = phase.load(std::memory_order_acquire);
+        if (current == Disabled || current >= Measuring)
+            return {};
+        std::shared_lock<std::shared_mutex> lock(accelMutex);
+        // The trees were swapped while this thread waited for the build
+        if (phase.load(std::memory_order_acquire) >= Measuring)
+            return {};
+        return lock;
+    }
+
+    /**
+    * \brief Adds the steps of a thread to the current window, reports the hit rates once the window after the swap is full
+    * \param nbSteps steps (hits) performed
+    * \param seconds time spent tracing them
+    */
+    void AccelReoptimizer::RecordSteps(size_t nbSteps, double seconds) {
+        const int current = phase.load(std::memory_order_acquire);
+        if (current != WarmUp && current != Measuring)
+            return;
+        this->nbSteps += nbSteps;
+        const uint64_t totalNs = busyNs += static_cast<uint64_t>(seconds * 1.0e9);
+
+        int expected = Measuring;
+        if (current == Measuring && (double) totalNs * 1.0e-9 >= window * (double) nbThreads
+            && phase.compare_exchange_strong(expected, Done, std::memory_order_acq_rel)) {
+            hitRateAfter = GetWindowRate();
+            const double before = hitRateBefore.load();
+            const double after = hitRateAfter.load();
+            Log::console_msg_master(2, "  ProbSplit re-optimization: {:.4g} hits/s before, {:.4g} hits/s after the swap ({:+.1f}%)\n",
+                                    before, after, before > 0.0 ? (after / before - 1.0) * 100.0 : 0.0);
+        }
+    }
+
+    /**
+    * \brief Called by a thread outside of a step after merging into the global state, rebuilds and swaps the trees once
+    * the warm-up is over
+    * \param model model of the run, its facets are shared with the rebuilt trees
+    * \param globState global state with the hit statistics, not locked by the caller
+    */
+    void AccelReoptimizer::OnMerge(MolflowSimulationModel &model, GlobalSimuState &globState) {
+        if (phase.load(std::memory_order_acquire) != WarmUp
+            || (double) busyNs.load() * 1.0e-9 < window * (double) nbThreads)
+            return;
+
+        std::vector<double> probabilities;
+        {
+            std::lock_guard<std::timed_mutex> lock(globState.tMutex);
+            const double nbHitEquiv = globState.globalHits.globalHits.nbHitEquiv;
+            if (nbHitEquiv <= 0.0 || globState.facetStates.size() != model.facets.size())
+                return; // no statistics yet
+            probabilities.reserve(globState.facetStates.size());
+            for (auto &state : globState.facetStates)
+                probabilities.emplace_back(state.momentResults[0].hits.nbHitEquiv / nbHitEquiv);
+        }
+
+        int expected = WarmUp;
+        if (!phase.compare_exchange_strong(expected, Building, std::memory_order_acq_rel))
+            return; // started by another thread
+        hitRateBefore = GetWindowRate();
+
+        // Same assignment of facets to structures as BuildAccelStructure
+        std::vector<std::vector<std::shared_ptr<Primitive>>> primPointers(model.sh.nbSuper);
+        for (auto &sFac : model.facets) {
+            if (sFac->sh.superIdx == -1) { //Facet in all structures
+                for (auto &fp_vec : primPointers)
+                    fp_vec.push_back(sFac);
+            }
+            else {
+                primPointers[sFac->sh.superIdx].push_back(sFac);
+            }
+        }
+
+        Log::console_msg_master(3, "  Rebuilding acceleration structures with hit statistics ({:.4g} hits/s so far)\n",
+                                hitRateBefore.load());
+        // Waits for the running steps, the other threads wait in BeginStep until the new trees are in place
+        std::unique_lock<std::shared_mutex> lock(accelMutex);
+        Chronometer timer;
+        timer.Start();
+        AccelVector accel(primPointers.size());
+        for (size_t s = 0; s < primPointers.size(); ++s)
+            accel[s] = std::make_shared<BVHAccel>(primPointers[s], maxPrimsInNode, BVHAccel::SplitMethod::ProbSplit,
+                                                  probabilities);
+        timer.Stop();
+        buildMs = timer.ElapsedMs();
+        model.accel = std::move(accel);
+        nbSteps = 0;
+        busyNs = 0;
+        phase.store(Measuring, std::memory_order_release);
+        Log::console_msg_master(3, "  ProbSplit acceleration structures built in {:.2f} ms and swapped in\n",
+                                buildMs.load());
+    }
+
+    double AccelReoptimizer::GetWindowRate() const {
+        const double seconds = (double) busyNs.load() * 1.0e-9 / (double) nbThreads;
+        return seconds > 0.0 ? (double) nbSteps.load() / seconds : 0.0;
+    }
+}
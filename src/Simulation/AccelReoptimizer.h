@@ -0,0 +1,82 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_ACCELREOPTIMIZER_H
+#define MOLFLOW_PROJ_ACCELREOPTIMIZER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include "MolflowSimGeom.h"
+
+namespace MFSim {
+
+    /**
+    * \brief Rebuilds the acceleration structures once per run with the measured facet hit probabilities (ProbSplit)
+    * The simulation starts on the SAH trees. After a warm-up of model->accelReoptimizeTime seconds of tracing, the hit
+    * statistics of the global state are copied and the first thread merging afterwards builds the ProbSplit trees.
+    * BVHAccel builds over the shared facets, so, like the serial build in BuildAccelStructure, no other thread may trace
+    * meanwhile: steps hold a shared lock on the trees until the swap, the build and swap of model->accel take it
+    * exclusively. The hit rate of the warm-up and of a window of the same length after the swap are logged.
+     */
+    class AccelReoptimizer {
+    public:
+        using AccelVector = decltype(MolflowSimulationModel::accel);
+
+        enum Phase : int {
+            Disabled, // no re-optimization for this run
+            WarmUp, // tracing on the initial trees, gathering statistics
+            Building, // ProbSplit trees are built while the other threads wait
+            Measuring, // tracing on the new trees
+            Done // hit rates reported
+        };
+
+        AccelReoptimizer() = default;
+        AccelReoptimizer(const AccelReoptimizer &) = delete;
+        AccelReoptimizer &operator=(const AccelReoptimizer &) = delete;
+
+        void Reset(const MolflowSimulationModel &model, size_t nbThreads);
+        std::shared_lock<std::shared_mutex> BeginStep(MolflowSimulationModel &model);
+        void RecordSteps(size_t nbSteps, double seconds);
+        void OnMerge(MolflowSimulationModel &model, GlobalSimuState &globState);
+
+        [[nodiscard]] Phase GetPhase() const { return static_cast<Phase>(phase.load(std::memory_order_acquire)); };
+        [[nodiscard]] double GetHitRateBefore() const { return hitRateBefore.load(); }; // hits/s on the initial trees
+        [[nodiscard]] double GetHitRateAfter() const { return hitRateAfter.load(); }; // hits/s on the ProbSplit trees
+
+    private:
+        [[nodiscard]] double GetWindowRate() const;
+
+        std::shared_mutex accelMutex; // shared during a step, exclusive for the build and swap
+        std::atomic<int> phase{Disabled};
+        double window{0.0}; // seconds of tracing before the rebuild and after the swap
+        size_t nbThreads{1};
+
+        // Steps of the current window, over all threads
+        std::atomic<uint64_t> nbSteps{0};
+        std::atomic<uint64_t> busyNs{0};
+        std::atomic<double> hitRateBefore{0.0};
+        std::atomic<double> hitRateAfter{0.0};
+        std::atomic<double> buildMs{0.0};
+    };
+}
+
+#endif //MOLFLOW_PROJ_ACCELREOPTIMIZER_H
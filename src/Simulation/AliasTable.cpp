@@ -0,0 +1,137 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "AliasTable.h"
+
+AliasTable::AliasTable(const std::vector<double> &weights) {
+    Build(weights);
+}
+
+/**
+* \brief Construct the alias table with Vose's method
+* \param weights non-negative, not necessarily normalized weights
+*/
+void AliasTable::Build(const std::vector<double> &weights) {
+    clear();
+
+    const size_t n = weights.size();
+    double sum = 0.0;
+    for (const auto &w : weights) {
+        if (w > 0.0) sum += w;
+    }
+    if (n == 0 || sum <= 0.0)
+        return;
+
+    prob.assign(n, 0.0);
+    alias.assign(n, 0);
+    totalWeight = sum;
+
+    // Scaled probabilities, average is 1.0
+    std::vector<double> scaled(n);
+    std::vector<size_t> small, large;
+    size_t fallback = 0; // any bin with positive weight
+    small.reserve(n);
+    large.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        scaled[i] = (weights[i] > 0.0 ? weights[i] : 0.0) * (double) n / sum;
+        if (weights[i] > 0.0) fallback = i;
+        if (scaled[i] < 1.0) small.push_back(i);
+        else large.push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        size_t s = small.back();
+        small.pop_back();
+        size_t l = large.back();
+        large.pop_back();
+
+        prob[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) small.push_back(l);
+        else large.push_back(l);
+    }
+
+    // Leftovers are (up to rounding errors) exactly 1.0
+    for (auto l : large) {
+        prob[l] = 1.0;
+        alias[l] = l;
+    }
+    for (auto s : small) {
+        // A zero-weight bin must never be kept, only possible through accumulated rounding errors
+        if (weights[s] > 0.0) {
+            prob[s] = 1.0;
+            alias[s] = s;
+        }
+        else {
+            prob[s] = 0.0;
+            alias[s] = fallback;
+        }
+    }
+}
+
+void AliasTable::clear() {
+    prob.clear();
+    alias.clear();
+    totalWeight = 0.0;
+}
+
+/**
+* \brief Draw a bin index according to the weights given on construction
+* \param rndVal uniform random number in [0,1[, the integer part selects the column, the fractional part the bin or its alias
+* \return index of the sampled bin
+*/
+size_t AliasTable::Sample(double rndVal) const {
+    const size_t n = prob.size();
+    const double x = rndVal * (double) n;
+    size_t i = (size_t) x;
+    if (i >= n) i = n - 1;
+    const double frac = x - (double) i;
+    return (frac < prob[i]) ? i : alias[i];
+}
+
+/**
+* \brief Draw a bin index and recycle the unused part of the random number
+* \param rndVal uniform random number in [0,1[
+* \param remainder uniform random number in [0,1[, independent of the returned bin
+* \return index of the sampled bin
+*/
+size_t AliasTable::Sample(double rndVal, double &remainder) const {
+    const size_t n = prob.size();
+    const double x = rndVal * (double) n;
+    size_t i = (size_t) x;
+    if (i >= n) i = n - 1;
+    const double frac = x - (double) i;
+    if (frac < prob[i]) {
+        remainder = frac / prob[i];
+        return i;
+    }
+    remainder = (frac - prob[i]) / (1.0 - prob[i]);
+    if (remainder >= 1.0) remainder = 0.0; // rounding with prob[i] close to 1
+    return alias[i];
+}
+
+size_t AliasTable::GetMemSize() const {
+    size_t sum = 0;
+    sum += sizeof(AliasTable);
+    sum += sizeof(double) * prob.capacity();
+    sum += sizeof(size_t) * alias.capacity();
+    return sum;
+}
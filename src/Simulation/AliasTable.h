@@ -0,0 +1,53 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_ALIASTABLE_H
+#define MOLFLOW_PROJ_ALIASTABLE_H
+
+#include <vector>
+#include <cstddef>
+
+/**
+* \brief Walker/Vose alias table for O(1) sampling from a discrete distribution
+* Entries with zero weight are never returned. Build once, sample with a single uniform random number.
+ */
+class AliasTable {
+public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<double> &weights);
+
+    void Build(const std::vector<double> &weights);
+    void clear();
+
+    [[nodiscard]] size_t Sample(double rndVal) const;
+    [[nodiscard]] size_t Sample(double rndVal, double &remainder) const;
+
+    [[nodiscard]] bool empty() const { return prob.empty(); };
+    [[nodiscard]] size_t size() const { return prob.size(); };
+    [[nodiscard]] double GetTotalWeight() const { return totalWeight; };
+    [[nodiscard]] size_t GetMemSize() const;
+
+private:
+    std::vector<double> prob; // probability to keep bin i instead of jumping to its alias
+    std::vector<size_t> alias; // bin to jump to
+    double totalWeight{0.0};
+};
+
+#endif //MOLFLOW_PROJ_ALIASTABLE_H
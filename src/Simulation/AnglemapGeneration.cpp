@@ -269,6 +269,75 @@ namespace AnglemapGeneration {
 		return phi;
 	}
 
+	/**
+	* \brief Builds the alias tables for sampling both angles in constant time, see GenerateAnglesFromAliases
+	* \param anglemapParams parameters of the angle map
+	* \param anglemap angle map with recorded pdf
+	*/
+	void BuildAliasTables(const AnglemapParams& anglemapParams, Anglemap& anglemap) {
+		const size_t nbLines = anglemapParams.thetaLowerRes + anglemapParams.thetaHigherRes;
+		std::vector<double> weights(nbLines);
+		anglemap.phiBinAliases.resize(nbLines);
+		for (size_t line = 0; line < nbLines; line++) {
+			std::vector<double> phiWeights(anglemapParams.phiWidth);
+			double lineSum = 0.0;
+			for (size_t phiIndex = 0; phiIndex < anglemapParams.phiWidth; phiIndex++) {
+				phiWeights[phiIndex] = (double)anglemap.pdf[line * anglemapParams.phiWidth + phiIndex];
+				lineSum += phiWeights[phiIndex];
+			}
+			weights[line] = lineSum;
+			anglemap.phiBinAliases[line].Build(phiWeights); //empty for a line without hits, which is never drawn
+		}
+		anglemap.thetaLineAlias.Build(weights);
+	}
+
+	/**
+	* \brief Distance of a point drawn on one side of a bin midpoint, in units of the distance to the next midpoint
+	* \param rndVal uniform random number in [0,1[
+	* \param halfBin true if the side ends at the edge of the map (half bin with constant pdf), false if it ends at the next midpoint (pdf decreasing linearly to 0)
+	*/
+	static double GetSideOffset(double rndVal, bool halfBin) {
+		return halfBin ? 0.5 * rndVal : 1.0 - std::sqrt(1.0 - rndVal);
+	}
+
+	/**
+	* \brief Generates theta and phi from the angle map with the alias tables built by BuildAliasTables
+	* The pdf interpolated linearly between bin midpoints (as in GenerateThetaFromAngleMap and GeneratePhiFromAngleMap) is
+	* the sum of one "tent" per bin: its hits spread half to each side, decreasing linearly to 0 at the neighbouring
+	* midpoints, or constant over the half bin at the map edges and at the theta limit. A bin is therefore drawn by its
+	* hits and the side with 1/2 each, then the offset from the midpoint is drawn from the side's shape, first for the
+	* theta line, then for the phi bin of that line. Phi is periodic, so it has no edges.
+	* \param anglemapParams parameters of the angle map
+	* \param anglemap angle map with alias tables
+	* \param rndTheta uniform random number in [0,1[ for theta
+	* \param rndPhi uniform random number in [0,1[ for phi
+	* \return theta (incident angle, 0..PI/2) and phi (-PI..PI)
+	*/
+	std::pair<double, double>
+		GenerateAnglesFromAliases(const AnglemapParams& anglemapParams, const Anglemap& anglemap, double rndTheta, double rndPhi) {
+		double remainder;
+		const size_t line = anglemap.thetaLineAlias.Sample(rndTheta, remainder);
+		const bool upperSide = remainder >= 0.5;
+		remainder = upperSide ? 2.0 * remainder - 1.0 : 2.0 * remainder;
+
+		//A side is a half bin if it reaches the theta limit or the map edges, where the bin width changes
+		const bool inLowerPart = line < anglemapParams.thetaLowerRes;
+		const size_t partBegin = inLowerPart ? 0 : anglemapParams.thetaLowerRes;
+		const size_t partEnd = inLowerPart ? anglemapParams.thetaLowerRes : anglemapParams.thetaLowerRes + anglemapParams.thetaHigherRes;
+		const bool halfBin = upperSide ? (line + 1 == partEnd) : (line == partBegin);
+		const double thetaOffset = GetSideOffset(remainder, halfBin);
+		const double theta = GetTheta((double)line + 0.5 + (upperSide ? thetaOffset : -thetaOffset), anglemapParams);
+
+		if (anglemapParams.phiWidth == 1) return { theta, -PI + 2.0 * PI * rndPhi }; //uniform phi distribution
+		const size_t phiIndex = anglemap.phiBinAliases[line].Sample(rndPhi, remainder);
+		const bool upperPhiSide = remainder >= 0.5;
+		remainder = upperPhiSide ? 2.0 * remainder - 1.0 : 2.0 * remainder;
+		const double phiOffset = GetSideOffset(remainder, false);
+		double phiIndexWithOffset = (double)phiIndex + 0.5 + (upperPhiSide ? phiOffset : -phiOffset);
+		if (phiIndexWithOffset < 0.0) phiIndexWithOffset += (double)anglemapParams.phiWidth; //periodic, GetPhi wraps the upper end
+		return { theta, GetPhi(phiIndexWithOffset, anglemapParams) };
+	}
+
 	/**
 	* \brief Maps anglemap theta index to theta value
 	* \param thetaIndex theta index from 0 to map theta size (lowerRes+higherRes), can be non-integer
@@ -46,6 +46,12 @@ namespace AnglemapGeneration {
     double GeneratePhiFromAngleMap(const int &thetaLowerIndex, const double &thetaOvershoot,
                                    const AnglemapParams &anglemapParams,
                                    Anglemap &anglemap, double lookupValue);
+
+    void BuildAliasTables(const AnglemapParams &anglemapParams, Anglemap &anglemap);
+
+    std::pair<double, double>
+    GenerateAnglesFromAliases(const AnglemapParams &anglemapParams, const Anglemap &anglemap, double rndTheta,
+                              double rndPhi);
 };
 
 
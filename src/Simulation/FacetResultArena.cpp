@@ -0,0 +1,132 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "FacetResultArena.h"
+#include <algorithm>
+
+/**
+* \brief Lays out and zero-inits the cells for the facets and moments of a model, same sizes as GlobalSimuState::Resize
+*/
+void FacetResultArena::Resize(const MolflowSimulationModel &model) {
+    const size_t nbF = model.sh.nbFacet;
+    const size_t nbSlots = 1 + model.tdParams.moments.size();
+    textureLayout.resize(nbF);
+    profileLayout.resize(nbF);
+    directionLayout.resize(nbF);
+
+    size_t nbTexture = 0, nbProfile = 0, nbDirection = 0;
+    for (size_t i = 0; i < nbF; i++) {
+        const auto &sh = model.facets[i]->sh;
+        const size_t nbTexCells = (size_t) sh.texWidth * (size_t) sh.texHeight;
+        textureLayout[i] = {nbTexture, sh.isTextured ? nbTexCells : (size_t) 0};
+        profileLayout[i] = {nbProfile, sh.isProfile ? (size_t) PROFILE_SIZE : (size_t) 0};
+        directionLayout[i] = {nbDirection, sh.countDirection ? nbTexCells : (size_t) 0};
+        nbTexture += nbSlots * textureLayout[i].size;
+        nbProfile += nbSlots * profileLayout[i].size;
+        nbDirection += nbSlots * directionLayout[i].size;
+    }
+
+    texture.assign(nbTexture, TextureCell());
+    profile.assign(nbProfile, ProfileSlice());
+    direction.assign(nbDirection, DirectionCell());
+}
+
+/**
+* \brief Releases all cells
+*/
+void FacetResultArena::clear() {
+    std::vector<TextureCell>().swap(texture);
+    std::vector<ProfileSlice>().swap(profile);
+    std::vector<DirectionCell>().swap(direction);
+    textureLayout.clear();
+    profileLayout.clear();
+    directionLayout.clear();
+}
+
+/**
+* \brief Adds the cells of one facet for one moment to a snapshot with the same dimensions, e.g. of the global state
+* Tiles of the snapshot that stay untouched are not allocated
+*/
+void FacetResultArena::MergeFacetMoment(FacetMomentSnapshot &snapshot, size_t facetId, size_t moment) const {
+    const Range &tex = textureLayout[facetId];
+    if (tex.size > 0 && snapshot.texture.size() == tex.size) {
+        snapshot.texture.AddRange(&texture[tex.offset + moment * tex.size]);
+    }
+    const Range &prof = profileLayout[facetId];
+    if (prof.size > 0 && snapshot.profile.size() == prof.size) {
+        const ProfileSlice *src = &profile[prof.offset + moment * prof.size];
+        ProfileSlice *dst = snapshot.profile.data();
+        for (size_t i = 0; i < prof.size; i++)
+            dst[i] += src[i];
+    }
+    const Range &dir = directionLayout[facetId];
+    if (dir.size > 0 && snapshot.direction.size() == dir.size) {
+        snapshot.direction.AddRange(&direction[dir.offset + moment * dir.size]);
+    }
+}
+
+/**
+* \brief zero-init for the cells of one facet for one moment
+*/
+void FacetResultArena::ResetFacetMoment(size_t facetId, size_t moment) {
+    const Range &tex = textureLayout[facetId];
+    std::fill_n(texture.begin() + (std::ptrdiff_t) (tex.offset + moment * tex.size), tex.size, TextureCell());
+    const Range &prof = profileLayout[facetId];
+    std::fill_n(profile.begin() + (std::ptrdiff_t) (prof.offset + moment * prof.size), prof.size, ProfileSlice());
+    const Range &dir = directionLayout[facetId];
+    std::fill_n(direction.begin() + (std::ptrdiff_t) (dir.offset + moment * dir.size), dir.size, DirectionCell());
+}
+
+/**
+* \brief zero-init for all cells
+*/
+void FacetResultArena::Reset() {
+    std::fill(texture.begin(), texture.end(), TextureCell());
+    std::fill(profile.begin(), profile.end(), ProfileSlice());
+    std::fill(direction.begin(), direction.end(), DirectionCell());
+}
+
+/**
+* \brief Bytes of the cells that Resize allocates for a model, without allocating them
+*/
+size_t FacetResultArena::GetDenseSize(const MolflowSimulationModel &model) {
+    const size_t nbSlots = 1 + model.tdParams.moments.size();
+    size_t sum = 0;
+    for (size_t i = 0; i < model.sh.nbFacet; i++) {
+        const auto &sh = model.facets[i]->sh;
+        const size_t nbTexCells = (size_t) sh.texWidth * (size_t) sh.texHeight;
+        if (sh.isTextured)
+            sum += nbTexCells * sizeof(TextureCell);
+        if (sh.isProfile)
+            sum += PROFILE_SIZE * sizeof(ProfileSlice);
+        if (sh.countDirection)
+            sum += nbTexCells * sizeof(DirectionCell);
+    }
+    return sum * nbSlots;
+}
+
+size_t FacetResultArena::GetMemSize() const {
+    size_t sum = sizeof(FacetResultArena);
+    sum += texture.capacity() * sizeof(TextureCell);
+    sum += profile.capacity() * sizeof(ProfileSlice);
+    sum += direction.capacity() * sizeof(DirectionCell);
+    sum += (textureLayout.capacity() + profileLayout.capacity() + directionLayout.capacity()) * sizeof(Range);
+    return sum;
+}
@@ -0,0 +1,73 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_FACETRESULTARENA_H
+#define MOLFLOW_PROJ_FACETRESULTARENA_H
+
+#include <vector>
+#include <cstddef>
+#include "MolflowSimGeom.h"
+
+/**
+* \brief Per-thread texture, profile and direction cells of all facets and moments in one contiguous slab per quantity
+* Replaces the cell vectors of the thread local GlobalSimuState (one heap block per facet, moment and quantity).
+* The cells of a facet are stored moment after moment from an offset, so that recording, merging and resetting
+* a (facet, moment) runs over one contiguous range, and a full reset is one fill per quantity.
+ */
+class FacetResultArena {
+public:
+    void Resize(const MolflowSimulationModel &model);
+    void clear();
+
+    TextureCell &Texture(size_t facetId, size_t moment, size_t cell) {
+        return texture[textureLayout[facetId].offset + moment * textureLayout[facetId].size + cell];
+    };
+    ProfileSlice &Profile(size_t facetId, size_t moment, size_t cell) {
+        return profile[profileLayout[facetId].offset + moment * profileLayout[facetId].size + cell];
+    };
+    DirectionCell &Direction(size_t facetId, size_t moment, size_t cell) {
+        return direction[directionLayout[facetId].offset + moment * directionLayout[facetId].size + cell];
+    };
+
+    void MergeFacetMoment(FacetMomentSnapshot &snapshot, size_t facetId, size_t moment) const;
+    void ResetFacetMoment(size_t facetId, size_t moment);
+    void Reset();
+
+    [[nodiscard]] bool empty() const { return texture.empty() && profile.empty() && direction.empty(); };
+    [[nodiscard]] size_t GetNbCells() const { return texture.size() + profile.size() + direction.size(); };
+    [[nodiscard]] size_t GetMemSize() const;
+    [[nodiscard]] static size_t GetDenseSize(const MolflowSimulationModel &model);
+
+private:
+    //! Location of a facet's cells in a slab
+    struct Range {
+        size_t offset; // first cell of moment 0
+        size_t size; // cells per moment
+    };
+
+    std::vector<TextureCell> texture;
+    std::vector<ProfileSlice> profile;
+    std::vector<DirectionCell> direction;
+    std::vector<Range> textureLayout; // nbFacet
+    std::vector<Range> profileLayout;
+    std::vector<Range> directionLayout;
+};
+
+#endif //MOLFLOW_PROJ_FACETRESULTARENA_H
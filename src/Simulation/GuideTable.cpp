@@ -0,0 +1,79 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "GuideTable.h"
+
+/**
+* \brief Builds the table from (x, cumulative) pairs
+* \param cumulative points sorted by x with non-decreasing cumulative values, starting at 0
+* \param nbCells number of equal-probability cells, 0 for one per point
+*/
+void GuideTable::Build(const std::vector<std::pair<double, double>> &cumulative, size_t nbCells) {
+    clear();
+    if (cumulative.size() < 2 || cumulative.back().second <= 0.0)
+        return;
+
+    x.reserve(cumulative.size());
+    y.reserve(cumulative.size());
+    for (const auto &point : cumulative) {
+        x.push_back(point.first);
+        y.push_back(point.second);
+    }
+
+    if (nbCells == 0)
+        nbCells = cumulative.size();
+    guide.resize(nbCells);
+    const double total = y.back();
+    size_t segment = 0;
+    for (size_t cell = 0; cell < nbCells; cell++) {
+        const double cellStart = total * (double) cell / (double) nbCells;
+        while (segment + 2 < y.size() && y[segment + 1] < cellStart)
+            segment++;
+        guide[cell] = segment;
+    }
+}
+
+void GuideTable::clear() {
+    x.clear();
+    y.clear();
+    guide.clear();
+}
+
+/**
+* \brief Inverse of the cumulative function
+* \param rndVal uniform random number in [0,1[, scaled to the total
+* \return x value where the cumulative function reaches rndVal * total
+*/
+double GuideTable::Sample(double rndVal) const {
+    const size_t nbCells = guide.size();
+    size_t cell = (size_t) (rndVal * (double) nbCells);
+    if (cell >= nbCells) cell = nbCells - 1;
+
+    // First segment whose end reaches the target, flat segments are skipped
+    const double target = rndVal * y.back();
+    size_t segment = guide[cell];
+    while (segment + 2 < y.size() && y[segment + 1] < target)
+        segment++;
+
+    const double dy = y[segment + 1] - y[segment];
+    if (dy <= 0.0)
+        return x[segment];
+    return x[segment] + (target - y[segment]) / dy * (x[segment + 1] - x[segment]);
+}
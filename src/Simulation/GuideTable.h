@@ -0,0 +1,55 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_GUIDETABLE_H
+#define MOLFLOW_PROJ_GUIDETABLE_H
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/**
+* \brief Guide table (Chen & Asau) inverting a piecewise linear cumulative function, e.g. an integrated desorption
+* The cumulative range is split into equal-probability cells, each storing the first segment reaching into it. A
+* lookup starts at that segment and on average advances by less than one, independently of the number of points.
+* The result is the same linear interpolation as InterpolateX on the (x, cumulative) pairs.
+ */
+class GuideTable {
+public:
+    void Build(const std::vector<std::pair<double, double>> &cumulative, size_t nbCells = 0);
+    void clear();
+
+    [[nodiscard]] double Sample(double rndVal) const;
+
+    [[nodiscard]] bool empty() const { return x.empty(); };
+    [[nodiscard]] size_t size() const { return x.size(); };
+    [[nodiscard]] size_t GetNbCells() const { return guide.size(); };
+    [[nodiscard]] double GetTotal() const { return y.empty() ? 0.0 : y.back(); };
+    [[nodiscard]] size_t GetMemSize() const {
+        return sizeof(GuideTable) + sizeof(double) * (x.capacity() + y.capacity()) + sizeof(size_t) * guide.capacity();
+    };
+
+private:
+    std::vector<double> x; // abscissa of the points
+    std::vector<double> y; // cumulative values, non-decreasing
+    std::vector<size_t> guide; // per cell: first segment whose end reaches the cell start
+};
+
+#endif //MOLFLOW_PROJ_GUIDETABLE_H
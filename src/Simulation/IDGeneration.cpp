@@ -21,6 +21,11 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 #include <Helper/MathTools.h>
 #include "IDGeneration.h"
 #include <cmath>
+#include <algorithm>
+
+// Largest relative change of the outgassing rate within one subsection of the integrated desorption
+static constexpr double maxSubsectionRateChange = 0.05;
+static constexpr int maxSubsections = 100;
 
 namespace IDGeneration {
 
@@ -56,6 +61,29 @@ std::pair<int, std::vector<ID_p>> GenerateNewID(std::set<size_t>& desorptionPara
     return std::make_pair((int) i, id_v);
 }
 
+/**
+* \brief Number of subsections for a section of the outgassing between two user-defined values
+* Time sampling interpolates the ID linearly within a subsection, i.e. assumes a constant rate there. Sections are
+* split until the rate changes by at most maxSubsectionRateChange between subsections: nearly constant sections stay
+* whole, steep ones (e.g. decays over decades) are split finely.
+* \param y0 outgassing at the section start
+* \param y1 outgassing at the section end
+* \param logY true if the outgassing is interpolated logarithmically, subsections then have equal ratios
+* \return number of subsections between 1 and maxSubsections
+*/
+int GetNbSubsections(double y0, double y1, bool logY) {
+    const double yMin = std::min(std::abs(y0), std::abs(y1));
+    const double yMax = std::max(std::abs(y0), std::abs(y1));
+    if (yMin <= 0.0)
+        return maxSubsections; // rate vanishes at one end, unbounded relative change
+    double nbSteps;
+    if (logY)
+        nbSteps = std::log(yMax / yMin) / std::log1p(maxSubsectionRateChange);
+    else // equal increments, the first one relative to the smaller end is the largest relative change
+        nbSteps = (yMax - yMin) / (yMin * maxSubsectionRateChange);
+    return (int) std::clamp(std::ceil(nbSteps), 1.0, (double) maxSubsections);
+}
+
 /**
 * \brief Generate integrated desorption (ID) function
 * \param paramId parameter identifier
@@ -124,9 +152,9 @@ std::vector<std::pair<double, double>> Generate_ID(int paramId, MolflowSimulatio
                             ID.back().second +
                             (myOutgassing[i].first - myOutgassing[i - 1].first) *
                             myOutgassing[i].second * MBARLS_TO_PAM3S); //integral = y1*(x1-x0)
-        } else { //we need to split the user-defined section to 10 subsections, and integrate each
+        } else { //we need to split the user-defined section to subsections, and integrate each
             //(terminology: section is between two consecutive user-defined time-value pairs)
-            const int nbSteps = 10; //change here
+            const int nbSteps = GetNbSubsections(myOutgassing[i - 1].second, myOutgassing[i].second, par.logYinterp);
             double sectionStartTime = myOutgassing[i - 1].first;
             double sectionEndTime = myOutgassing[i].first;
             double sectionTimeInterval = sectionEndTime - sectionStartTime;
@@ -30,6 +30,7 @@ namespace IDGeneration {
     int GetIDId(const std::set<size_t>& desorptionParameterIDs, int paramId);
     std::pair<int, std::vector<ID_p>> GenerateNewID(std::set<size_t>& desorptionParameterIDs, int paramId, MolflowSimulationModel* model);
     std::vector<std::pair<double, double>> Generate_ID(int paramId, MolflowSimulationModel *model);
+    int GetNbSubsections(double y0, double y1, bool logY);
 };
 
 
@@ -19,7 +19,9 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 */
 
 #include "MolflowSimFacet.h"
+#include "AnglemapGeneration.h"
 #include <fmt/core.h>
+#include <cmath>
 
 MolflowSimFacet::MolflowSimFacet(const MolflowSimFacet& cpy)  : SimulationFacet(cpy) {
     *this = cpy;
@@ -33,6 +35,7 @@ MolflowSimFacet& MolflowSimFacet::operator=(const MolflowSimFacet& cpy){
     SimulationFacet::operator=(cpy);
     this->angleMap = cpy.angleMap;
     this->ogMap = cpy.ogMap;
+    this->triangulation = cpy.triangulation;
 
     return *this;
 }
@@ -41,6 +44,7 @@ MolflowSimFacet& MolflowSimFacet::operator=(MolflowSimFacet&& cpy) noexcept {
     SimulationFacet::operator=(cpy);
     this->angleMap = cpy.angleMap;
     this->ogMap = cpy.ogMap;
+    this->triangulation = cpy.triangulation;
 
     return *this;
 }
@@ -55,6 +59,7 @@ bool MolflowSimFacet::InitializeOnLoad(const size_t &id, const size_t &nbMoments
     globalId = id;
     if (!InitializeLinkAndVolatile(id)) return false;
     InitializeOutgassingMap();
+    InitializeTriangulation();
 
     if(InitializeAngleMap() < 0)
         return false;
@@ -193,10 +198,20 @@ int MolflowSimFacet::InitializeAngleMap()
                 }
             }
         }
+
+        //Alias tables for constant time sampling with the same interpolated pdf
+        try {
+            AnglemapGeneration::BuildAliasTables(sh.anglemapParams, angleMap);
+        }
+        catch (...) {
+            throw std::runtime_error("Not enough memory to load incident angle map (alias tables)");
+        }
     }
     else {
         //Record mode, create pdf vector
         angleMap.pdf.resize(sh.anglemapParams.GetMapSize());
+        angleMap.thetaLineAlias.clear();
+        angleMap.phiBinAliases.clear();
     }
 
     if(sh.anglemapParams.record)
@@ -221,6 +236,147 @@ void MolflowSimFacet::InitializeOutgassingMap()
     }
 }
 
+/**
+* \brief Triangulate source facets once, so that starting points can be sampled exactly in constant time
+* Facets using an outgassing map keep sampling inside the chosen map cell
+*/
+void MolflowSimFacet::InitializeTriangulation() {
+    triangulation.clear();
+    if (sh.desorbType == DES_NONE || sh.useOutgassingFile)
+        return;
+    if (!triangulation.Build(vertices2)) {
+        // Fall back to rejection sampling, e.g. for self-overlapping polygons
+        triangulation.clear();
+    }
+}
+
+/**
+* \brief Ear clipping triangulation of a simple polygon given in (u,v) coordinates
+* \param polygon facet vertices in (u,v) space
+* \return true when the triangles cover the polygon area
+*/
+bool FacetTriangulation::Build(const std::vector<Vector2d> &polygon) {
+    clear();
+    const size_t nbVert = polygon.size();
+    if (nbVert < 3)
+        return false;
+
+    auto cross = [](const Vector2d &a, const Vector2d &b, const Vector2d &c) {
+        return (b.u - a.u) * (c.v - a.v) - (b.v - a.v) * (c.u - a.u);
+    };
+
+    double polyArea = 0.0; // signed, shoelace formula
+    for (size_t i = 0; i < nbVert; i++) {
+        const auto &p1 = polygon[i];
+        const auto &p2 = polygon[(i + 1) % nbVert];
+        polyArea += p1.u * p2.v - p2.u * p1.v;
+    }
+    polyArea *= 0.5;
+    if (polyArea == 0.0)
+        return false;
+
+    // Work on counter-clockwise index list
+    std::vector<size_t> idx(nbVert);
+    for (size_t i = 0; i < nbVert; i++)
+        idx[i] = (polyArea > 0.0) ? i : nbVert - 1 - i;
+
+    const double eps = 1E-12 * std::abs(polyArea);
+    std::vector<double> areas;
+    vertices.reserve(3 * (nbVert - 2));
+    areas.reserve(nbVert - 2);
+
+    while (idx.size() > 3) {
+        bool earFound = false;
+        const size_t n = idx.size();
+        for (size_t i = 0; i < n && !earFound; i++) {
+            const auto &a = polygon[idx[(i + n - 1) % n]];
+            const auto &b = polygon[idx[i]];
+            const auto &c = polygon[idx[(i + 1) % n]];
+            const double area2 = cross(a, b, c);
+            if (area2 <= eps) continue; // reflex or degenerate corner
+
+            // An ear can't contain any other remaining vertex
+            bool isEar = true;
+            for (size_t j = 0; j < n && isEar; j++) {
+                if (j == i || j == (i + n - 1) % n || j == (i + 1) % n) continue;
+                const auto &p = polygon[idx[j]];
+                if ((p.u == a.u && p.v == a.v) || (p.u == b.u && p.v == b.v) || (p.u == c.u && p.v == c.v))
+                    continue; // coinciding vertex, e.g. bridge to an inner hole
+                if (cross(a, b, p) >= 0.0 && cross(b, c, p) >= 0.0 && cross(c, a, p) >= 0.0)
+                    isEar = false;
+            }
+            if (!isEar) continue;
+
+            vertices.push_back(a);
+            vertices.push_back(b);
+            vertices.push_back(c);
+            areas.push_back(0.5 * area2);
+            idx.erase(idx.begin() + (long) i);
+            earFound = true;
+        }
+        if (!earFound) {
+            // Only degenerate corners left, remove one collinear vertex or give up
+            bool removed = false;
+            for (size_t i = 0; i < n && !removed; i++) {
+                const auto &a = polygon[idx[(i + n - 1) % n]];
+                const auto &b = polygon[idx[i]];
+                const auto &c = polygon[idx[(i + 1) % n]];
+                if (std::abs(cross(a, b, c)) <= eps) {
+                    idx.erase(idx.begin() + (long) i);
+                    removed = true;
+                }
+            }
+            if (!removed) {
+                clear();
+                return false;
+            }
+        }
+    }
+    {
+        const auto &a = polygon[idx[0]];
+        const auto &b = polygon[idx[1]];
+        const auto &c = polygon[idx[2]];
+        const double area2 = cross(a, b, c);
+        if (area2 > eps) {
+            vertices.push_back(a);
+            vertices.push_back(b);
+            vertices.push_back(c);
+            areas.push_back(0.5 * area2);
+        }
+    }
+
+    double sumArea = 0.0;
+    for (auto area : areas) sumArea += area;
+    if (areas.empty() || std::abs(sumArea - std::abs(polyArea)) > 1E-6 * std::abs(polyArea)) {
+        clear();
+        return false;
+    }
+
+    areaAlias.Build(areas);
+    return true;
+}
+
+/**
+* \brief Uniformly distributed point on the triangulated polygon
+* \param rndTriangle random number to select a triangle weighted by its area
+* \param rnd1 random number for the position in the triangle
+* \param rnd2 random number for the position in the triangle
+* \return (u,v) coordinates of the point
+*/
+Vector2d FacetTriangulation::SamplePoint(double rndTriangle, double rnd1, double rnd2) const {
+    const size_t tri = areaAlias.Sample(rndTriangle);
+    const auto &a = vertices[3 * tri];
+    const auto &b = vertices[3 * tri + 1];
+    const auto &c = vertices[3 * tri + 2];
+
+    const double sqrtR1 = std::sqrt(rnd1);
+    const double wA = 1.0 - sqrtR1;
+    const double wB = sqrtR1 * (1.0 - rnd2);
+    const double wC = sqrtR1 * rnd2;
+    return Vector2d(wA * a.u + wB * b.u + wC * c.u,
+                    wA * a.v + wB * b.v + wC * c.v);
+}
+
 size_t MolflowSimFacet::InitializeHistogram(const size_t &nbMoments) const
 {
     //FacetHistogramBuffer hist;
@@ -264,5 +420,6 @@ size_t MolflowSimFacet::GetMemSize() const {
 
     mem_size += sizeof (double) * ogMap.outgassingMap.capacity();
     mem_size += angleMap.GetMemSize();
+    mem_size += triangulation.GetMemSize();
     return mem_size;
 }
\ No newline at end of file
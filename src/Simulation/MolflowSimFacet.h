@@ -23,6 +23,7 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 
 #include "SimulationFacet.h"
 #include "MolflowTypes.h"
+#include "AliasTable.h"
 
 struct Anglemap {
 public:
@@ -41,6 +42,8 @@ public:
     size_t theta_CDFsum_lower;  // since theta CDF only sums till the midpoint of the last segment, the total map sum is here
     size_t theta_CDFsum_higher; // theta_CDFsum_higher>=theta_CDFsum_lower as it includes lower part. Also total number of hits in raw pdf
     double thetaLowerRatio; // ratio of angle map below theta limit, to decide which side to look up in
+    AliasTable thetaLineAlias; // theta line (lower and higher part) weighted by its line sum, see AnglemapGeneration::BuildAliasTables
+    std::vector<AliasTable> phiBinAliases; // per theta line: phi bin weighted by its hits
 
     [[nodiscard]] size_t GetMemSize() const {
         size_t sum = 0;
@@ -54,10 +57,34 @@ public:
         sum += sizeof(size_t) * phi_pdfsums_higherTheta.capacity();
         sum += sizeof(double) * theta_CDF_lower.capacity();
         sum += sizeof(double) * theta_CDF_higher.capacity();
+        sum += thetaLineAlias.GetMemSize();
+        for (const auto &phiBinAlias : phiBinAliases)
+            sum += phiBinAlias.GetMemSize();
         return sum;
     }
 };
 
+/**
+* \brief Triangulation of a facet polygon in (u,v) space, used to sample uniformly distributed starting points without rejection
+ */
+struct FacetTriangulation {
+    std::vector<Vector2d> vertices; // (u,v) coordinates, 3 consecutive entries per triangle
+    AliasTable areaAlias; // area weighted triangle selection
+
+    [[nodiscard]] bool empty() const { return areaAlias.empty(); };
+    void clear() {
+        vertices.clear();
+        areaAlias.clear();
+    };
+
+    bool Build(const std::vector<Vector2d> &polygon);
+    [[nodiscard]] Vector2d SamplePoint(double rndTriangle, double rnd1, double rnd2) const;
+
+    [[nodiscard]] size_t GetMemSize() const {
+        return sizeof(Vector2d) * vertices.capacity() + areaAlias.GetMemSize();
+    }
+};
+
 struct MolflowSimFacet : public SimulationFacet {
     MolflowSimFacet() : SimulationFacet() {};
     explicit MolflowSimFacet(size_t nbIndex) : SimulationFacet(nbIndex) {};
@@ -68,6 +95,7 @@ struct MolflowSimFacet : public SimulationFacet {
 
     OutgassingMap ogMap;
     Anglemap angleMap;
+    FacetTriangulation triangulation; // only for desorbing facets
 
     bool InitializeOnLoad(const size_t &id, const size_t &nbMoments);
 
@@ -91,6 +119,8 @@ struct MolflowSimFacet : public SimulationFacet {
 
     void InitializeOutgassingMap();
 
+    void InitializeTriangulation();
+
     [[nodiscard]] size_t GetHitsSize(size_t nbMoments) const override;
     size_t GetMemSize() const override;
 };
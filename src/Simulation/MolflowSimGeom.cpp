@@ -25,6 +25,9 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 #include <cmath>
 #include <set>
 #include <sstream>
+#include <atomic>
+#include <future>
+#include <thread>
 
 #include "Helper/MathTools.h"
 #include "CDFGeneration.h"
@@ -34,6 +37,8 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 #include "Polygon.h"
 #include "MolflowSimGeom.h"
 #include "MolflowSimFacet.h"
+#include "WideBVH.h"
+#include "IO/AccelCache.h"
 #include "IntersectAABB_shared.h" // include needed for recursive delete of AABBNODE
 
 /**
@@ -165,10 +170,49 @@ void  MolflowSimulationModel::BuildPrisma(double L, double R, double angle, doub
     }
 }
 
+/**
+* \brief Assigns each facet the surface matching its (constant or time-dependent) opacity
+*/
+void MolflowSimulationModel::BindSurfaces() {
+    for(auto& sFac : this->facets){
+        if (sFac->sh.opacity_paramId == -1){ //constant sticking
+            sFac->sh.opacity = std::clamp(sFac->sh.opacity, 0.0, 1.0);
+            //sFac->surf = simModel->GetSurface(sFac.get());
+        }
+        /*else {
+            auto* par = &simModel->tdParams.parameters[sFac->sh.opacity_paramId];
+            sFac->surf = simModel->GetParameterSurface(sFac->sh.opacity_paramId, par);
+        }*/
+        sFac->surf = GetSurface(sFac.get());
+    }
+}
+
+/**
+* \brief Applies edited sticking, opacity or outgassing values of the facets without rebuilding the ADS
+* Trees only depend on the geometry, so a paused simulation continues with the new surfaces and source table.
+* Changes of geometry, temperatures or time-dependent parameters still need a full reload.
+* \return 0 when ok, 1 if the model is in use
+*/
+int MolflowSimulationModel::RefreshSurfaces() {
+    if (!m.try_lock()) {
+        return 1;
+    }
+    Chronometer timer;
+    timer.Start();
+
+    BindSurfaces();
+    CalcTotalOutgassing();
+
+    timer.Stop();
+    m.unlock();
+    Log::console_msg_master(4, "  Surfaces refreshed in {:.2f} ms\n", timer.ElapsedMs());
+    return 0;
+}
+
 /**
 * \brief Builds ADS given certain parameters
 * \param globState global simulation state for splitting techniques requiring statistical data
-* \param accel_type BVH or KD tree
+* \param accel_type BVH or KD tree, BVHs are built as WideBVHAccel with wideAccel
 * \param split splitting technique corresponding to the selected AccelType
 * \param bvh_width for BVH, the amount of leaves per end node
  * \return 0> for error codes, 0 when no problems
@@ -224,40 +268,93 @@ int MolflowSimulationModel::BuildAccelStructure(GlobalSimuState *globState, Acce
         }
     }
 
-    for(auto& sFac : this->facets){
-        if (sFac->sh.opacity_paramId == -1){ //constant sticking
-            sFac->sh.opacity = std::clamp(sFac->sh.opacity, 0.0, 1.0);
-            //sFac->surf = simModel->GetSurface(sFac.get());
-        }
-        /*else {
-            auto* par = &simModel->tdParams.parameters[sFac->sh.opacity_paramId];
-            sFac->surf = simModel->GetParameterSurface(sFac->sh.opacity_paramId, par);
-        }*/
-        sFac->surf = GetSurface(sFac.get());
-    }
+    BindSurfaces();
 
-    this->accel.clear();
-    if(BVHAccel::SplitMethod::ProbSplit == split && globState && globState->initialized && globState->globalHits.globalHits.nbDesorbed > 0){
-        if(globState->facetStates.size() != this->facets.size())
+    const bool buildWide = wideAccel && accel_type != 1;
+    std::vector<double> probabilities;
+    if(!buildWide && BVHAccel::SplitMethod::ProbSplit == split && globState && globState->initialized && globState->globalHits.globalHits.nbDesorbed > 0){
+        if(globState->facetStates.size() != this->facets.size()) {
+            m.unlock();
             return 1;
-        std::vector<double> probabilities;
+        }
         probabilities.reserve(globState->facetStates.size());
         for(auto& state : globState->facetStates) {
             probabilities.emplace_back(state.momentResults[0].hits.nbHitEquiv / globState->globalHits.globalHits.nbHitEquiv);
         }
-        for (size_t s = 0; s < this->sh.nbSuper; ++s) {
+    }
+
+    std::vector<std::vector<SimulationFacet*>> facetPointers;
+    if(buildWide){
+        facetPointers.resize(this->sh.nbSuper);
+        for(auto& sFac : this->facets){
+            if (sFac->sh.superIdx == -1) { //Facet in all structures
+                for (auto& fp_vec : facetPointers) {
+                    fp_vec.push_back(sFac.get());
+                }
+            }
+            else {
+                facetPointers[sFac->sh.superIdx].push_back(sFac.get());
+            }
+        }
+    }
+
+    auto buildStructure = [&](size_t s, size_t nbTreeThreads) {
+        if(buildWide){
+            this->accel[s] = std::make_shared<WideBVHAccel>(facetPointers[s], bvh_width, nbTreeThreads);
+        }
+        else if(!probabilities.empty()){
             if(accel_type == 1)
-                this->accel.emplace_back(std::make_shared<KdTreeAccel>(primPointers[s], probabilities));
+                this->accel[s] = std::make_shared<KdTreeAccel>(primPointers[s], probabilities);
             else
-                this->accel.emplace_back(std::make_shared<BVHAccel>(primPointers[s], bvh_width, BVHAccel::SplitMethod::ProbSplit, probabilities));
+                this->accel[s] = std::make_shared<BVHAccel>(primPointers[s], bvh_width, BVHAccel::SplitMethod::ProbSplit, probabilities);
         }
-    }
-    else {
-        for (size_t s = 0; s < this->sh.nbSuper; ++s) {
+        else {
             if(accel_type == 1)
-                this->accel.emplace_back(std::make_shared<KdTreeAccel>(primPointers[s]));
+                this->accel[s] = std::make_shared<KdTreeAccel>(primPointers[s]);
             else
-                this->accel.emplace_back(std::make_shared<BVHAccel>(primPointers[s], bvh_width, split));
+                this->accel[s] = std::make_shared<BVHAccel>(primPointers[s], bvh_width, split);
+        }
+    };
+
+    // Structures are independent and built in parallel, the wide BVH also splits its own build over the remaining
+    // threads. Facets in all structures (superIdx -1) are shared by several trees, in that case only the wide BVH,
+    // which reads the facets without modifying them, is built concurrently
+    bool sharedFacets = false;
+    for(auto& sFac : this->facets)
+        sharedFacets |= sFac->sh.superIdx == -1;
+    const size_t nbBuildThreads = accelBuildThreads ? accelBuildThreads : std::max(1u, std::thread::hardware_concurrency());
+    const size_t nbWorkers = (buildWide || !sharedFacets) ? std::max<size_t>(1, std::min<size_t>(nbBuildThreads, this->sh.nbSuper)) : 1;
+    const size_t nbTreeThreads = buildWide ? std::max<size_t>(1, nbBuildThreads / nbWorkers) : 1;
+
+    // Wide BVHs only depend on the geometry, a cached build of the same geometry is loaded instead of rebuilt
+    const bool useCache = buildWide && !accelCacheFile.empty();
+    const uint64_t cacheKey = useCache ? FlowIO::AccelCache::ComputeKey(*this, static_cast<int>(split), bvh_width) : 0;
+    const bool fromCache = useCache && FlowIO::AccelCache::Load(accelCacheFile, cacheKey, *this);
+
+    if(!fromCache) {
+        this->accel.clear();
+        this->accel.resize(this->sh.nbSuper);
+        std::atomic<size_t> nextStructure{0};
+        auto buildNextStructures = [&]() {
+            for(size_t s = nextStructure++; s < this->sh.nbSuper; s = nextStructure++)
+                buildStructure(s, nbTreeThreads);
+        };
+        std::vector<std::future<void>> workers;
+        for(size_t w = 1; w < nbWorkers; ++w)
+            workers.emplace_back(std::async(std::launch::async, buildNextStructures));
+        buildNextStructures();
+        for(auto& worker : workers)
+            worker.get();
+        if(useCache)
+            FlowIO::AccelCache::Save(accelCacheFile, cacheKey, *this);
+    }
+
+    // Compaction is cheap next to the build, the cache keeps the double precision layout
+    if(buildWide && compactAccel) {
+        for(auto& structure : this->accel) {
+            auto wide = std::dynamic_pointer_cast<WideBVHAccel>(structure);
+            if(wide && !wide->Compact())
+                Log::console_msg_master(2, "  Geometry exceeds the single precision range, keeping the double precision BVH\n");
         }
     }
 #endif // old_bvb
@@ -265,6 +362,22 @@ int MolflowSimulationModel::BuildAccelStructure(GlobalSimuState *globState, Acce
     timer.Stop();
     m.unlock();
 
+#if !defined(USE_OLD_BVH)
+    if (fromCache)
+        Log::console_msg_master(3, "  Acceleration structures: {} loaded from {} in {:.2f} ms\n", this->accel.size(),
+                                accelCacheFile, timer.ElapsedMs());
+    else
+        Log::console_msg_master(3, "  Acceleration structures: {} built in {:.2f} ms ({} build threads)\n", this->accel.size(),
+                                timer.ElapsedMs(), nbWorkers * nbTreeThreads);
+    for (size_t s = 0; s < this->accel.size(); ++s) {
+        if (auto wide = std::dynamic_pointer_cast<WideBVHAccel>(this->accel[s]))
+            Log::console_msg_master(4, "    Structure {}: {} facets, {} {}nodes, depth {}, {} bytes\n", s, wide->GetNbPrimitives(),
+                                    wide->GetNbNodes(), wide->IsCompact() ? "compact " : "", wide->GetMaxDepth(), wide->GetMemSize());
+        else
+            Log::console_msg_master(4, "    Structure {}: {} facets\n", s, primPointers[s].size());
+    }
+#endif
+
     initialized = true;
 
     return 0;
@@ -292,9 +405,12 @@ int MolflowSimulationModel::PrepareToRun() {
     if(!tdParams.moments.empty())
         wp.latestMoment = (tdParams.moments.end()-1)->second;
         //wp.latestMoment = (tdParams.moments.end()-1)->first + (tdParams.moments.end()-1)->second / 2.0;
+    tdParams.momentIndex.Build(tdParams.moments);
 
     std::set<size_t> desorptionParameterIDs;
     std::vector<double> temperatureList;
+    tdParams.velocityTables.clear();
+    tdParams.desorptionTimeTables.clear();
 
     //Check and calculate various facet properties for time dependent simulations (CDF, ID )
     for (size_t i = 0; i < sh.nbFacet; i++) {
@@ -323,6 +439,8 @@ int MolflowSimulationModel::PrepareToRun() {
             else {
                 auto[id_new, id_vec] = IDGeneration::GenerateNewID(desorptionParameterIDs, facet->sh.outgassing_paramId, this);
                 facet->sh.IDid = id_new;
+                tdParams.desorptionTimeTables.resize(id_new + 1);
+                tdParams.desorptionTimeTables[id_new].Build(id_vec);
                 tdParams.IDs.emplace_back(std::move(id_vec));
             }
         }
@@ -335,6 +453,8 @@ int MolflowSimulationModel::PrepareToRun() {
             auto[cdf_id, cdf_vec] = CDFGeneration::GenerateNewCDF(temperatureList, facet->sh.temperature, wp.gasMass);
             facet->sh.CDFid = cdf_id;
             tdParams.CDFs.emplace_back(cdf_vec);
+            tdParams.velocityTables.resize(cdf_id + 1);
+            tdParams.velocityTables[cdf_id].Build(facet->sh.temperature, wp.gasMass, velocityTableSize);
         }
         //Angle map
         if (facet->sh.desorbType == DES_ANGLEMAP) {
@@ -410,6 +530,39 @@ void MolflowSimulationModel::CalcTotalOutgassing() {
     wp.totalDesorbedMolecules = totalDesorbedMolecules;
     wp.finalOutgassingRate_Pa_m3_sec = finalOutgassingRate_Pa_m3_sec;
     wp.finalOutgassingRate = finalOutgassingRate;
+
+    BuildSourceTable();
+}
+
+/**
+* \brief Precompute an alias table over all source facets weighted by their number of desorbed molecules
+* Has to be rebuilt whenever outgassing, temperature or time-dependent parameters of a facet change
+*/
+void MolflowSimulationModel::BuildSourceTable() {
+    sourceFacetIds.clear();
+    std::vector<double> weights;
+
+    const double latestMoment = wp.latestMoment;
+    for (size_t i = 0; i < facets.size(); i++) {
+        auto facet = std::dynamic_pointer_cast<MolflowSimFacet>(facets[i]);
+        if (facet->sh.desorbType == DES_NONE) continue;
+
+        double facetOutgassing = 0.0;
+        if (facet->sh.useOutgassingFile) { //outgassing file
+            if (facet->sh.totalOutgassing > 0.0)
+                facetOutgassing = latestMoment * facet->sh.totalOutgassing / (1.38E-23 * facet->sh.temperature);
+        } else { //constant or time-dependent outgassing
+            facetOutgassing = ((facet->sh.outgassing_paramId >= 0)
+                               ? tdParams.IDs[facet->sh.IDid].back().second
+                               : latestMoment * facet->sh.outgassing) / (1.38E-23 * facet->sh.temperature);
+        }
+        if (facetOutgassing > 0.0) {
+            sourceFacetIds.push_back(i);
+            weights.push_back(facetOutgassing);
+        }
+    }
+
+    sourceAlias.Build(weights);
 }
 
 MolflowSimulationModel::MolflowSimulationModel(MolflowSimulationModel &&o) noexcept {
@@ -430,6 +583,7 @@ size_t MolflowSimulationModel::size() {
     size_t modelSize = 0;
     modelSize += SimulationModel::size();
     modelSize += tdParams.GetMemSize();
+    modelSize += sourceAlias.GetMemSize() + sizeof(size_t) * sourceFacetIds.capacity();
     return modelSize;
 }
 
@@ -475,8 +629,9 @@ void GlobalSimuState::clear() {
 /**
 * \brief Constructs the 'Global Hit counter structure' structure to hold all results, zero-init
 * \param model Contains all related parameters
+* \param allocateCells false to skip texture, profile and direction cells, e.g. for thread states recording them sparsely
 */
-void GlobalSimuState::Resize(const std::shared_ptr<SimulationModel> &model) {
+void GlobalSimuState::Resize(const std::shared_ptr<SimulationModel> &model, bool allocateCells) {
 
     tMutex.lock();
     auto mf_model = std::dynamic_pointer_cast<MolflowSimulationModel>(model);
@@ -495,9 +650,11 @@ void GlobalSimuState::Resize(const std::shared_ptr<SimulationModel> &model) {
 
             FacetMomentSnapshot facetMomentTemplate{};
             facetMomentTemplate.histogram.Resize(sFac->sh.facetHistogramParams);
-            facetMomentTemplate.direction.assign((sFac->sh.countDirection ? sFac->sh.texWidth*sFac->sh.texHeight : 0), DirectionCell());
-            facetMomentTemplate.profile.assign((sFac->sh.isProfile ? PROFILE_SIZE : 0), ProfileSlice());
-            facetMomentTemplate.texture.assign((sFac->sh.isTextured ? sFac->sh.texWidth*sFac->sh.texHeight : 0), TextureCell());
+            if (allocateCells) {
+                facetMomentTemplate.direction.assign((sFac->sh.countDirection ? sFac->sh.texWidth*sFac->sh.texHeight : 0), DirectionCell());
+                facetMomentTemplate.profile.assign((sFac->sh.isProfile ? PROFILE_SIZE : 0), ProfileSlice());
+                facetMomentTemplate.texture.assign((sFac->sh.isTextured ? sFac->sh.texWidth*sFac->sh.texHeight : 0), TextureCell());
+            }
 
             //No init for hits
             facetStates[i].momentResults.assign(1 + nbMoments, facetMomentTemplate);
@@ -511,6 +668,7 @@ void GlobalSimuState::Resize(const std::shared_ptr<SimulationModel> &model) {
     FacetHistogramBuffer globalHistTemplate{};
     globalHistTemplate.Resize(model->wp.globalHistogramParams);
     globalHistograms.assign(1 + nbMoments, globalHistTemplate);
+    fullSnapshotNeeded = true;
     initialized = true;
     tMutex.unlock();
 }
@@ -533,16 +691,95 @@ void GlobalSimuState::Reset() {
             ZEROVECTOR(m.histogram.distanceHistogram);
             ZEROVECTOR(m.histogram.nbHitsHistogram);
             ZEROVECTOR(m.histogram.timeHistogram);
-            std::fill(m.direction.begin(), m.direction.end(), DirectionCell());
-            std::fill(m.texture.begin(), m.texture.end(), TextureCell());
+            m.direction.Reset();
+            m.texture.Reset();
             std::fill(m.profile.begin(), m.profile.end(), ProfileSlice());
             memset(&(m.hits), 0, sizeof(m.hits));
         }
     }
+    // Every entry changed, the next delta autosave writes a snapshot instead
+    fullSnapshotNeeded = true;
     tMutex.unlock();
     //ReleaseMutex(mutex);
 }
 
+/**
+* \brief Adds only the facet results marked as dirty, global counters are not touched
+* \param src state containing the results, e.g. a thread local state
+* \param dirty (facet, moment) entries recorded in src
+* \param withCells false when src has no texture, profile and direction cells (sparse thread results)
+*/
+void GlobalSimuState::MergeDirtyFacets(const GlobalSimuState &src, const DirtyFacetTracker &dirty, bool withCells) {
+    for (const auto &[facetId, moment] : dirty.GetEntries())
+        MergeFacetMoment(src, facetId, moment, withCells);
+}
+
+/**
+* \brief Remembers the (facet, moment) entries merged from a thread state, for delta autosaves (StateJournal)
+* Has to be called with the state locked, not from parallel facet slices. Does nothing unless a StateJournal is attached
+* \param dirty entries merged from the thread state
+*/
+void GlobalSimuState::MarkChanged(const DirtyFacetTracker &dirty) {
+    if (!trackChanges)
+        return;
+    const size_t nbMomentResults = facetStates.empty() ? 1 : facetStates.front().momentResults.size();
+    if (!changedFacets.Fits(facetStates.size(), nbMomentResults - 1)) {
+        fullSnapshotNeeded = true;
+        return;
+    }
+    for (const auto &[facetId, moment] : dirty.GetEntries())
+        changedFacets.Mark(facetId, moment);
+}
+
+/**
+* \brief Adds the results of one facet for one moment, the angle map is added with moment 0
+* \param withCells false when src has no texture, profile and direction cells (sparse thread results)
+*/
+void GlobalSimuState::MergeFacetMoment(const GlobalSimuState &src, size_t facetId, size_t moment, bool withCells) {
+    auto &facetState = facetStates[facetId];
+    const auto &srcFacetState = src.facetStates[facetId];
+    if (moment == 0 && facetState.recordedAngleMapPdf.size() == srcFacetState.recordedAngleMapPdf.size())
+        facetState.recordedAngleMapPdf += srcFacetState.recordedAngleMapPdf;
+
+    auto &snapshot = facetState.momentResults[moment];
+    const auto &srcSnapshot = srcFacetState.momentResults[moment];
+    if (withCells) {
+        snapshot += srcSnapshot;
+    }
+    else {
+        snapshot.hits += srcSnapshot.hits;
+        snapshot.histogram += srcSnapshot.histogram;
+    }
+}
+
+/**
+* \brief zero-init for global counters and the facet results marked as dirty
+* \param dirty (facet, moment) entries that have been written to since the last reset
+*/
+void GlobalSimuState::ResetDirty(const DirtyFacetTracker &dirty) {
+    tMutex.lock();
+    for (auto& h : globalHistograms) {
+        ZEROVECTOR(h.distanceHistogram);
+        ZEROVECTOR(h.nbHitsHistogram);
+        ZEROVECTOR(h.timeHistogram);
+    }
+    memset(&globalHits, 0, sizeof(globalHits)); //Plain old data
+    for (const auto &[facetId, moment] : dirty.GetEntries()) {
+        auto& state = facetStates[facetId];
+        if (moment == 0)
+            ZEROVECTOR(state.recordedAngleMapPdf);
+        auto& m = state.momentResults[moment];
+        ZEROVECTOR(m.histogram.distanceHistogram);
+        ZEROVECTOR(m.histogram.nbHitsHistogram);
+        ZEROVECTOR(m.histogram.timeHistogram);
+        m.direction.Reset();
+        m.texture.Reset();
+        std::fill(m.profile.begin(), m.profile.end(), ProfileSlice());
+        memset(&(m.hits), 0, sizeof(m.hits));
+    }
+    tMutex.unlock();
+}
+
 /**
  * @brief Compare function for two simulation states
  * @param lhsGlobHit first simulation state
@@ -35,7 +35,13 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 #include <cereal/cereal.hpp>
 #include <cereal/types/vector.hpp>
 #include "RayTracing/KDTree.h"
+#include "AliasTable.h"
+#include "MomentIndex.h"
+#include "VelocityTable.h"
+#include "GuideTable.h"
+#include "TiledCells.h"
 #include <map>
+#include <string>
 
 
 struct SimulationFacet;
@@ -57,8 +63,11 @@ struct TimeDependentParamters {
     std::vector<Distribution2D> parameters;
 
     std::vector<std::vector<CDF_p>> CDFs; //cumulative distribution function for each temperature
+    std::vector<VelocityTable> velocityTables; //inverse speed distribution for each temperature (CDFid), rebuilt in PrepareToRun
     std::vector<std::vector<ID_p>> IDs; //integrated distribution function for each time-dependent desorption type
+    std::vector<GuideTable> desorptionTimeTables; //inverse of each ID (IDid), rebuilt in PrepareToRun
     std::vector<Moment> moments;             //moments when a time-dependent simulation state is recorded
+    MomentIndex momentIndex;                 //time to moment lookup, rebuilt in PrepareToRun
     /*std::vector<UserMoment> userMoments;    //user-defined text values for defining time moments (can be time or time series)
     std::vector<double> temperatures; //keeping track of all temperatures that have a CDF already generated
     std::vector<size_t> desorptionParameterIDs; //time-dependent parameters which are used as desorptions, therefore need to be integrated
@@ -73,13 +82,18 @@ struct TimeDependentParamters {
             sum += sizeof(std::vector<CDF_p>);
             sum += sizeof(std::pair<double, double>) * vec.capacity();
         }
+        for (auto &velocityTable : velocityTables)
+            sum += velocityTable.GetMemSize();
         sum += sizeof(std::vector<std::vector<ID_p>>);
         for (auto &vec : IDs) {
             sum += sizeof(std::vector<ID_p>);
             sum += sizeof(std::pair<double, double>) * vec.capacity();
         }
+        for (auto &desorptionTimeTable : desorptionTimeTables)
+            sum += desorptionTimeTable.GetMemSize();
         sum += sizeof(std::vector<Moment>);
         sum += sizeof(Moment) * moments.capacity();
+        sum += momentIndex.GetMemSize();
 
         return sum;
     }
@@ -109,6 +123,18 @@ public:
         tdParams = o.tdParams;
         wp = o.wp;
         sh = o.sh;
+        sourceFacetIds = o.sourceFacetIds;
+        sourceAlias = o.sourceAlias;
+        sparseThreadResults = o.sparseThreadResults;
+        denseThreadResultsBudget = o.denseThreadResultsBudget;
+        wideAccel = o.wideAccel;
+        compactAccel = o.compactAccel;
+        wavefrontSize = o.wavefrontSize;
+        syncMaxLatency = o.syncMaxLatency;
+        velocityTableSize = o.velocityTableSize;
+        accelBuildThreads = o.accelBuildThreads;
+        accelCacheFile = o.accelCacheFile;
+        accelReoptimizeTime = o.accelReoptimizeTime;
         initialized = o.initialized;
 
         return *this;
@@ -124,6 +150,18 @@ public:
         otfParams = o.otfParams;
         wp = o.wp;
         sh = o.sh;
+        sourceFacetIds = std::move(o.sourceFacetIds);
+        sourceAlias = std::move(o.sourceAlias);
+        sparseThreadResults = o.sparseThreadResults;
+        denseThreadResultsBudget = o.denseThreadResultsBudget;
+        wideAccel = o.wideAccel;
+        compactAccel = o.compactAccel;
+        wavefrontSize = o.wavefrontSize;
+        syncMaxLatency = o.syncMaxLatency;
+        velocityTableSize = o.velocityTableSize;
+        accelBuildThreads = o.accelBuildThreads;
+        accelCacheFile = o.accelCacheFile;
+        accelReoptimizeTime = o.accelReoptimizeTime;
         initialized = o.initialized;
 
         return *this;
@@ -138,8 +176,15 @@ public:
 
     //int InitialiseFacets();
 
+    //! Re-binds facet surfaces and recomputes the outgassing after sticking/opacity/outgassing edits, keeps the ADS
+    int RefreshSurfaces();
+
     void CalcTotalOutgassing();
 
+    void BuildSourceTable();
+
+    void BindSurfaces();
+
     /**
     * \brief Returns an existing or a new surface corresponding to a facet's properties
     * \param facet facet for which a Surface should be found or created
@@ -190,6 +235,19 @@ public:
 
     TimeDependentParamters tdParams;
 
+    std::vector<size_t> sourceFacetIds; //facets with a positive outgassing, in the order of sourceAlias
+    AliasTable sourceAlias; //outgassing weighted selection of a source facet
+    bool sparseThreadResults{false}; //threads only buffer touched texture/profile/direction cells instead of a dense copy
+    size_t denseThreadResultsBudget{(size_t) 1 << 30}; //bytes of dense thread cells (all threads) above which sparse ones are used, 0 for no limit
+    bool wideAccel{false}; //trace with the 4-wide packet BVH (WideBVHAccel) instead of BVHAccel
+    bool compactAccel{false}; //store the wide BVH nodes with quantized 16-bit bounds (WideBVHAccel::Compact)
+    size_t wavefrontSize{0}; //in-flight particles per thread for the wavefront engine, 0 for one particle at a time
+    size_t velocityTableSize{4096}; //probability bins of the inverse speed distribution tables, 0 to sample the exact inverse
+    size_t accelBuildThreads{0}; //threads building the acceleration structures, 0 for all hardware threads
+    std::string accelCacheFile; //file caching the built wide BVHs of the geometry, empty to always rebuild
+    double accelReoptimizeTime{0.0}; //tracing time (s) after which the trees are rebuilt with hit statistics (ProbSplit), 0 to keep them
+    double syncMaxLatency{1.0}; //longest time (s) a thread simulates between two result merges, 0 to follow the caller's step count
+
     void BuildPrisma(double L, double R, double angle, double s, int step);
 };
 
@@ -205,8 +263,8 @@ public:
 
     FacetHitBuffer hits;
     std::vector<ProfileSlice> profile;
-    std::vector<TextureCell> texture;
-    std::vector<DirectionCell> direction;
+    TiledCells<TextureCell> texture;
+    TiledCells<DirectionCell> direction;
     FacetHistogramBuffer histogram;
 
     template<class Archive>
@@ -239,6 +297,42 @@ public:
     }
 };
 
+/*!
+ * @brief Keeps track of the (facet, moment) results touched since the last merge
+ * Moment 0 of a facet also stands for its (not time-dependent) recorded angle map
+ */
+class DirtyFacetTracker {
+public:
+    void Resize(size_t nbFacets, size_t nbMoments) {
+        stride = 1 + nbMoments;
+        flags.assign(nbFacets * stride, false);
+        entries.clear();
+    };
+
+    void Mark(size_t facetId, size_t moment) {
+        const size_t index = facetId * stride + moment;
+        if (!flags[index]) {
+            flags[index] = true;
+            entries.emplace_back(facetId, moment);
+        }
+    };
+
+    void clear() {
+        for (const auto &[facetId, moment] : entries)
+            flags[facetId * stride + moment] = false;
+        entries.clear();
+    };
+
+    [[nodiscard]] bool empty() const { return entries.empty(); };
+    [[nodiscard]] bool Fits(size_t nbFacets, size_t nbMoments) const { return flags.size() == nbFacets * (1 + nbMoments); };
+    [[nodiscard]] const std::vector<std::pair<size_t, size_t>> &GetEntries() const { return entries; };
+
+private:
+    size_t stride{1};
+    std::vector<bool> flags; //nbFacet*(1+nbMoment)
+    std::vector<std::pair<size_t, size_t>> entries; //(facetId, moment) in order of first touch
+};
+
 /*!
  * @brief Object containing all simulation results, global and per facet
  */
@@ -278,10 +372,16 @@ public:
 
     void clear();
 
-    void Resize(const std::shared_ptr<SimulationModel> &model);
+    void Resize(const std::shared_ptr<SimulationModel> &model, bool allocateCells = true);
 
     void Reset();
 
+    void MergeDirtyFacets(const GlobalSimuState &src, const DirtyFacetTracker &dirty, bool withCells);
+    void MergeFacetMoment(const GlobalSimuState &src, size_t facetId, size_t moment, bool withCells);
+
+    void ResetDirty(const DirtyFacetTracker &dirty);
+    void MarkChanged(const DirtyFacetTracker &dirty);
+
     static std::tuple<int, int, int>
     Compare(const GlobalSimuState &lhsGlobHit, const GlobalSimuState &rhsGlobHit, double globThreshold,
             double locThreshold);
@@ -302,6 +402,9 @@ public:
     }
 
     mutable std::timed_mutex tMutex;
+    DirtyFacetTracker changedFacets; // entries merged into since the last delta autosave (StateJournal), not copied
+    bool trackChanges{false}; // changedFacets is only filled while a StateJournal is attached (set by Compact), not copied
+    bool fullSnapshotNeeded{false}; // set when changes are not in changedFacets (Reset, Resize), not copied
 };
 
 /*!
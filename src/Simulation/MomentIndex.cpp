@@ -0,0 +1,209 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+
+#include "MomentIndex.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    inline double MomentStart(const Moment &moment) {
+        return moment.first - 0.5 * moment.second;
+    }
+
+    inline double MomentEnd(const Moment &moment) {
+        return moment.first + 0.5 * moment.second;
+    }
+
+    inline bool Contains(const Moment &moment, double time) {
+        return MomentStart(moment) <= time && time < MomentEnd(moment);
+    }
+}
+
+void MomentIndex::SetGrid(GridType type, size_t nbBuckets) {
+    gridType = type;
+    double gridEnd;
+    if (gridType == GridType::Logarithmic) {
+        gridBegin = std::log(timeBegin);
+        gridEnd = std::log(timeEnd);
+    }
+    else {
+        gridBegin = timeBegin;
+        gridEnd = timeEnd;
+    }
+    invBucketWidth = (double) nbBuckets / (gridEnd - gridBegin);
+    bucketOffsets.assign(nbBuckets + 1, 0);
+}
+
+/**
+* \brief Bucket of a given time, monotonic in time so that a moment [start,end[ only spans the buckets of start to end
+*/
+size_t MomentIndex::GetBucket(double time) const {
+    const double coord = (gridType == GridType::Logarithmic) ? std::log(time) : time;
+    const double pos = (coord - gridBegin) * invBucketWidth;
+    const size_t nbBuckets = bucketOffsets.size() - 1;
+    if (!(pos > 0.0))
+        return 0;
+    if (pos >= (double) nbBuckets)
+        return nbBuckets - 1;
+    return static_cast<size_t>(pos);
+}
+
+/**
+* \brief Counts the moments intersecting each bucket of the current grid
+* \return total number of bucket entries
+*/
+size_t MomentIndex::CountBucketLoads(const std::vector<Moment> &moments, std::vector<size_t> &loads) const {
+    const size_t nbBuckets = bucketOffsets.size() - 1;
+    std::vector<long long> delta(nbBuckets + 1, 0);
+    size_t nbEntries = 0;
+    for (const auto &moment : moments) {
+        const size_t first = GetBucket(MomentStart(moment));
+        const size_t last = GetBucket(MomentEnd(moment));
+        delta[first]++;
+        delta[last + 1]--;
+        nbEntries += last - first + 1;
+    }
+    loads.resize(nbBuckets);
+    long long load = 0;
+    for (size_t b = 0; b < nbBuckets; b++) {
+        load += delta[b];
+        loads[b] = static_cast<size_t>(load);
+    }
+    return nbEntries;
+}
+
+/**
+* \brief Builds the index, to be called whenever the moments change (PrepareToRun)
+* \param moments moments sorted by mid-time, overlaps allowed
+*/
+void MomentIndex::Build(const std::vector<Moment> &moments) {
+    clear();
+    nbMoments = moments.size();
+    if (moments.empty())
+        return;
+
+    timeBegin = MomentStart(moments.front());
+    timeEnd = MomentEnd(moments.front());
+    for (const auto &moment : moments) {
+        timeBegin = std::min(timeBegin, MomentStart(moment));
+        timeEnd = std::max(timeEnd, MomentEnd(moment));
+    }
+    if (!(timeEnd > timeBegin))
+        return; // degenerate, lookup falls back to a linear scan
+
+    size_t nbBuckets = std::clamp<size_t>(2 * moments.size(), 1, size_t(1) << 22);
+    std::vector<size_t> loads;
+
+    // Uniform grid, replaced by a logarithmic one for positive times if it spreads the moments better
+    SetGrid(GridType::Uniform, nbBuckets);
+    CountBucketLoads(moments, loads);
+    size_t uniformLoad = *std::max_element(loads.begin(), loads.end());
+    if (timeBegin > 0.0) {
+        SetGrid(GridType::Logarithmic, nbBuckets);
+        CountBucketLoads(moments, loads);
+        if (*std::max_element(loads.begin(), loads.end()) >= uniformLoad)
+            SetGrid(GridType::Uniform, nbBuckets);
+    }
+
+    // Long overlapping moments are listed in every bucket they span, coarsen the grid to bound the memory
+    size_t nbEntries = CountBucketLoads(moments, loads);
+    while (nbEntries > 8 * moments.size() + nbBuckets && nbBuckets > 1) {
+        nbBuckets /= 2;
+        SetGrid(gridType, nbBuckets);
+        nbEntries = CountBucketLoads(moments, loads);
+    }
+
+    maxBucketLoad = *std::max_element(loads.begin(), loads.end());
+    for (size_t b = 0; b < nbBuckets; b++)
+        bucketOffsets[b + 1] = bucketOffsets[b] + loads[b];
+    bucketMoments.resize(nbEntries);
+    std::vector<size_t> fill(bucketOffsets.begin(), bucketOffsets.end() - 1);
+    for (size_t i = 0; i < moments.size(); i++) {
+        const size_t last = GetBucket(MomentEnd(moments[i]));
+        for (size_t b = GetBucket(MomentStart(moments[i])); b <= last; b++)
+            bucketMoments[fill[b]++] = i;
+    }
+}
+
+void MomentIndex::clear() {
+    bucketOffsets.clear();
+    bucketMoments.clear();
+    nbMoments = 0;
+    maxBucketLoad = 0;
+    gridType = GridType::Uniform;
+    timeBegin = timeEnd = gridBegin = invBucketWidth = 0.0;
+}
+
+/**
+* \brief Get the first moment containing a given time
+* \param time time to look up
+* \param moments moments the index was built for
+* \return moment index starting at 1 (0 is the constant flow), or -1 if the time isn't in any moment
+*/
+int MomentIndex::Lookup(double time, const std::vector<Moment> &moments) const {
+    if (bucketMoments.empty() || nbMoments != moments.size()) {
+        for (size_t i = 0; i < moments.size(); i++) {
+            if (Contains(moments[i], time))
+                return static_cast<int>(i + 1);
+        }
+        return -1;
+    }
+    if (time < timeBegin || !(time < timeEnd))
+        return -1;
+
+    const size_t bucket = GetBucket(time);
+    for (size_t e = bucketOffsets[bucket]; e < bucketOffsets[bucket + 1]; e++) {
+        if (Contains(moments[bucketMoments[e]], time))
+            return static_cast<int>(bucketMoments[e] + 1);
+    }
+    return -1;
+}
+
+/**
+* \brief Get all moments containing a given time, for overlapping moments
+* \param time time to look up
+* \param moments moments the index was built for
+* \param found moment indices starting at 1 are appended in ascending order
+* \return number of moments found
+*/
+size_t MomentIndex::LookupAll(double time, const std::vector<Moment> &moments, std::vector<int> &found) const {
+    size_t nbFound = 0;
+    if (bucketMoments.empty() || nbMoments != moments.size()) {
+        for (size_t i = 0; i < moments.size(); i++) {
+            if (Contains(moments[i], time)) {
+                found.push_back(static_cast<int>(i + 1));
+                nbFound++;
+            }
+        }
+        return nbFound;
+    }
+    if (time < timeBegin || !(time < timeEnd))
+        return 0;
+
+    const size_t bucket = GetBucket(time);
+    for (size_t e = bucketOffsets[bucket]; e < bucketOffsets[bucket + 1]; e++) {
+        if (Contains(moments[bucketMoments[e]], time)) {
+            found.push_back(static_cast<int>(bucketMoments[e] + 1));
+            nbFound++;
+        }
+    }
+    return nbFound;
+}
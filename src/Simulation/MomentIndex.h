@@ -0,0 +1,71 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+
+#ifndef MOLFLOW_PROJ_MOMENTINDEX_H
+#define MOLFLOW_PROJ_MOMENTINDEX_H
+
+#include <vector>
+#include <cstddef>
+#include "../MolflowTypes.h"
+
+/**
+* \brief Bucketed time index mapping a time directly to the moments containing it
+* Buckets are either uniform or logarithmic in time, depending on which one spreads the moments more evenly.
+* Moments are the sorted intervals [mid - window/2, mid + window/2[ from TimeMoments and may overlap.
+ */
+class MomentIndex {
+public:
+    enum class GridType {
+        Uniform,
+        Logarithmic
+    };
+
+    void Build(const std::vector<Moment> &moments);
+    void clear();
+
+    [[nodiscard]] int Lookup(double time, const std::vector<Moment> &moments) const;
+    size_t LookupAll(double time, const std::vector<Moment> &moments, std::vector<int> &found) const;
+
+    [[nodiscard]] bool empty() const { return bucketMoments.empty(); };
+    [[nodiscard]] GridType GetGridType() const { return gridType; };
+    [[nodiscard]] size_t GetNbBuckets() const { return bucketOffsets.empty() ? 0 : bucketOffsets.size() - 1; };
+    [[nodiscard]] size_t GetMaxBucketLoad() const { return maxBucketLoad; };
+    [[nodiscard]] size_t GetMemSize() const {
+        return sizeof(MomentIndex) + sizeof(size_t) * (bucketOffsets.capacity() + bucketMoments.capacity());
+    };
+
+private:
+    [[nodiscard]] size_t GetBucket(double time) const;
+    void SetGrid(GridType type, size_t nbBuckets);
+    size_t CountBucketLoads(const std::vector<Moment> &moments, std::vector<size_t> &loads) const;
+
+    GridType gridType{GridType::Uniform};
+    double timeBegin{0.0}; // earliest moment start
+    double timeEnd{0.0}; // latest moment end
+    double gridBegin{0.0}; // transformed timeBegin
+    double invBucketWidth{0.0};
+    size_t nbMoments{0}; // moments the index was built for, falls back to a linear scan on mismatch
+    size_t maxBucketLoad{0}; // largest number of moments intersecting one bucket
+    std::vector<size_t> bucketOffsets; // nbBuckets+1 offsets into bucketMoments
+    std::vector<size_t> bucketMoments; // per bucket: ascending ids of the moments intersecting it
+};
+
+#endif //MOLFLOW_PROJ_MOMENTINDEX_H
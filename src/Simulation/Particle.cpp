@@ -25,83 +25,76 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 #include "Physics.h"
 #include "RayTracing/RTHelper.h"
 #include "MolflowSimFacet.h"
+#include "AccelReoptimizer.h"
 
 #include <Helper/Chronometer.h>
 #include <Helper/MathTools.h>
 
 #include <sstream>
 #include <cmath>
-#include <set>
+#include <algorithm>
 
 using namespace MFSim;
 
 bool Particle::UpdateMCHits(GlobalSimuState &globSimuState, size_t nbMoments, DWORD timeout) {
-    int i, j, x, y;
-
     Chronometer timer;
     timer.Start();
 
-    if (!globSimuState.tMutex.try_lock_for(std::chrono::milliseconds(timeout))) {
-        return false;
+    const size_t dirtyBytes = dirtyFacets.GetEntries().size() * sizeof(FacetHitBuffer) + tmpSparseCells.GetMemSize();
+    const auto waitStart = std::chrono::steady_clock::now();
+    if (merger && particleId < merger->GetNbThreads()) {
+        // Merged together with other waiting threads, in parallel over facet slices
+        PrepareMerge();
+#if defined(USE_PROFILING_COUNTERS)
+        const uint64_t mergeTicks = profileCounters.ticks[static_cast<size_t>(ProfileEvent::ResultMerge)];
+        const uint64_t startTicks = ReadProfileTicks();
+#endif
+        const bool merged = merger->Merge(*this, globSimuState, std::chrono::milliseconds(timeout));
+#if defined(USE_PROFILING_COUNTERS)
+        // Slices merged meanwhile, also those of other threads, are already counted as ResultMerge
+        const uint64_t workTicks = profileCounters.ticks[static_cast<size_t>(ProfileEvent::ResultMerge)] - mergeTicks;
+        profileCounters.Add(ProfileEvent::UpdateLockWait, ReadProfileTicks() - startTicks - workTicks);
+#endif
+        if (!merged)
+            return false;
+        syncScheduler.RecordMerge(0.0, std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count(),
+                                  dirtyBytes);
     }
+    else {
+        {
+            MF_PROFILE_SCOPE(profileCounters, ProfileEvent::UpdateLockWait);
+            if (!globSimuState.tMutex.try_lock_for(std::chrono::milliseconds(timeout))) {
+                return false;
+            }
+        }
+        const auto lockedAt = std::chrono::steady_clock::now();
+        MF_PROFILE_SCOPE(profileCounters, ProfileEvent::ResultMerge);
 
-    //SetState(PROCESS_STARTING, "Waiting for 'hits' dataport access...", false, true);
-
-    //SetState(PROCESS_STARTING, "Updating MC hits...", false, true);
+        MergeGlobalCounters(globSimuState);
 
-    // Global hits and leaks: adding local hits to shared memory
-    {
-        globSimuState.globalHits.globalHits += tmpState.globalHits.globalHits;
-        globSimuState.globalHits.distTraveled_total += tmpState.globalHits.distTraveled_total;
-        globSimuState.globalHits.distTraveledTotal_fullHitsOnly += tmpState.globalHits.distTraveledTotal_fullHitsOnly;
-
-        // Update too late
-        //totalDesorbed += tmpState.globalHits.globalHits.hit.nbDesorbed;
-        totalDesorbed += tmpState.globalHits.globalHits.nbDesorbed;
-        //tmpState.globalHits.globalHits.hit.nbDesorbed = 0;
-
-        /*gHits->globalHits.hit.nbMCHit += tmpGlobalResult.globalHits.hit.nbMCHit;
-        gHits->globalHits.hit.nbHitEquiv += tmpGlobalResult.globalHits.hit.nbHitEquiv;
-        gHits->globalHits.hit.nbAbsEquiv += tmpGlobalResult.globalHits.hit.nbAbsEquiv;
-        gHits->globalHits.hit.nbDesorbed += tmpGlobalResult.globalHits.hit.nbDesorbed;*/
-
-        //model->wp.sMode = MC_MODE;
-        //for(i=0;i<BOUNCEMAX;i++) globState.globalHits.wallHits[i] += wallHits[i];
-
-        // Leak
-        for (size_t leakIndex = 0; leakIndex < tmpState.globalHits.leakCacheSize; leakIndex++)
-            globSimuState.globalHits.leakCache[(leakIndex + globSimuState.globalHits.lastLeakIndex) %
-                                               LEAKCACHESIZE] = tmpState.globalHits.leakCache[leakIndex];
-        globSimuState.globalHits.nbLeakTotal += tmpState.globalHits.nbLeakTotal;
-        globSimuState.globalHits.lastLeakIndex =
-                (globSimuState.globalHits.lastLeakIndex + tmpState.globalHits.leakCacheSize) % LEAKCACHESIZE;
-        globSimuState.globalHits.leakCacheSize = Min(LEAKCACHESIZE, globSimuState.globalHits.leakCacheSize +
-                                                                    tmpState.globalHits.leakCacheSize);
-
-        // HHit (Only prIdx 0)
-        if (particleId == 0) {
-            for (size_t hitIndex = 0; hitIndex < tmpState.globalHits.hitCacheSize; hitIndex++)
-                globSimuState.globalHits.hitCache[(hitIndex + globSimuState.globalHits.lastHitIndex) %
-                                                  HITCACHESIZE] = tmpState.globalHits.hitCache[hitIndex];
-
-            if (tmpState.globalHits.hitCacheSize > 0) {
-                globSimuState.globalHits.lastHitIndex =
-                        (globSimuState.globalHits.lastHitIndex + tmpState.globalHits.hitCacheSize) % HITCACHESIZE;
-                globSimuState.globalHits.hitCache[globSimuState.globalHits.lastHitIndex].type = HIT_LAST; //Penup (border between blocks of consecutive hits in the hit cache)
-                globSimuState.globalHits.hitCacheSize = Min(HITCACHESIZE, globSimuState.globalHits.hitCacheSize +
-                                                                          tmpState.globalHits.hitCacheSize);
-            }
+        // Facets, only those hit since the last update, the thread state only holds counters
+        globSimuState.MergeDirtyFacets(tmpState, dirtyFacets, false);
+        if (model->sparseThreadResults) {
+            tmpSparseCells.MergeInto(globSimuState.facetStates);
+        }
+        else {
+            for (const auto &[facetId, moment] : dirtyFacets.GetEntries())
+                tmpCells.MergeFacetMoment(globSimuState.facetStates[facetId].momentResults[moment], facetId, moment);
         }
 
-        //Global histograms
-        globSimuState.globalHistograms += tmpState.globalHistograms;
+        globSimuState.stateChanged = true;
+        globSimuState.tMutex.unlock();
 
-        // Facets
-        globSimuState.facetStates += tmpState.facetStates;
+        syncScheduler.RecordMerge(std::chrono::duration<double>(lockedAt - waitStart).count(),
+                                  std::chrono::duration<double>(std::chrono::steady_clock::now() - lockedAt).count(),
+                                  dirtyBytes);
     }
 
-    globSimuState.stateChanged = true;
-    globSimuState.tMutex.unlock();
+    if (reoptimizer)
+        reoptimizer->OnMerge(*model, globSimuState);
+
+    if (Profiling::enabled)
+        Profiling::Collect(particleId, profileCounters);
 
     //extern char *GetSimuStatus();
     //SetState(PROCESS_STARTING, GetSimuStatus(), false, true);
@@ -115,6 +108,88 @@ bool Particle::UpdateMCHits(GlobalSimuState &globSimuState, size_t nbMoments, DW
     return true;
 }
 
+/**
+* \brief Adds the global counters, leak and hit caches and global histograms of the thread results, marks its facet
+* moments as changed (GlobalSimuState::MarkChanged)
+* \param globSimuState global state, has to be locked by the caller
+*/
+void Particle::MergeGlobalCounters(GlobalSimuState &globSimuState) {
+    globSimuState.globalHits.globalHits += tmpState.globalHits.globalHits;
+    globSimuState.globalHits.distTraveled_total += tmpState.globalHits.distTraveled_total;
+    globSimuState.globalHits.distTraveledTotal_fullHitsOnly += tmpState.globalHits.distTraveledTotal_fullHitsOnly;
+
+    // Update too late
+    //totalDesorbed += tmpState.globalHits.globalHits.hit.nbDesorbed;
+    totalDesorbed += tmpState.globalHits.globalHits.nbDesorbed;
+    //tmpState.globalHits.globalHits.hit.nbDesorbed = 0;
+
+    /*gHits->globalHits.hit.nbMCHit += tmpGlobalResult.globalHits.hit.nbMCHit;
+    gHits->globalHits.hit.nbHitEquiv += tmpGlobalResult.globalHits.hit.nbHitEquiv;
+    gHits->globalHits.hit.nbAbsEquiv += tmpGlobalResult.globalHits.hit.nbAbsEquiv;
+    gHits->globalHits.hit.nbDesorbed += tmpGlobalResult.globalHits.hit.nbDesorbed;*/
+
+    //model->wp.sMode = MC_MODE;
+    //for(i=0;i<BOUNCEMAX;i++) globState.globalHits.wallHits[i] += wallHits[i];
+
+    // Leak
+    for (size_t leakIndex = 0; leakIndex < tmpState.globalHits.leakCacheSize; leakIndex++)
+        globSimuState.globalHits.leakCache[(leakIndex + globSimuState.globalHits.lastLeakIndex) %
+                                           LEAKCACHESIZE] = tmpState.globalHits.leakCache[leakIndex];
+    globSimuState.globalHits.nbLeakTotal += tmpState.globalHits.nbLeakTotal;
+    globSimuState.globalHits.lastLeakIndex =
+            (globSimuState.globalHits.lastLeakIndex + tmpState.globalHits.leakCacheSize) % LEAKCACHESIZE;
+    globSimuState.globalHits.leakCacheSize = Min(LEAKCACHESIZE, globSimuState.globalHits.leakCacheSize +
+                                                                tmpState.globalHits.leakCacheSize);
+
+    // HHit (Only prIdx 0)
+    if (particleId == 0) {
+        for (size_t hitIndex = 0; hitIndex < tmpState.globalHits.hitCacheSize; hitIndex++)
+            globSimuState.globalHits.hitCache[(hitIndex + globSimuState.globalHits.lastHitIndex) %
+                                              HITCACHESIZE] = tmpState.globalHits.hitCache[hitIndex];
+
+        if (tmpState.globalHits.hitCacheSize > 0) {
+            globSimuState.globalHits.lastHitIndex =
+                    (globSimuState.globalHits.lastHitIndex + tmpState.globalHits.hitCacheSize) % HITCACHESIZE;
+            globSimuState.globalHits.hitCache[globSimuState.globalHits.lastHitIndex].type = HIT_LAST; //Penup (border between blocks of consecutive hits in the hit cache)
+            globSimuState.globalHits.hitCacheSize = Min(HITCACHESIZE, globSimuState.globalHits.hitCacheSize +
+                                                                      tmpState.globalHits.hitCacheSize);
+        }
+    }
+
+    //Global histograms
+    globSimuState.globalHistograms += tmpState.globalHistograms;
+
+    // Facet moments merged together with these counters
+    globSimuState.MarkChanged(dirtyFacets);
+}
+
+/**
+* \brief Sorts the dirty facet moments and sparse cells by facet, so that facet ranges can be merged separately
+*/
+void Particle::PrepareMerge() {
+    const auto &entries = dirtyFacets.GetEntries();
+    mergeOrder.assign(entries.begin(), entries.end());
+    std::sort(mergeOrder.begin(), mergeOrder.end());
+    if (model->sparseThreadResults)
+        tmpSparseCells.PrepareMerge();
+}
+
+/**
+* \brief Adds the facet results of facets in [facetBegin, facetEnd[, see PrepareMerge
+* \param globSimuState global state, the facet range has to be exclusive to the caller
+*/
+void Particle::MergeFacetRange(GlobalSimuState &globSimuState, size_t facetBegin, size_t facetEnd) const {
+    auto entry = std::lower_bound(mergeOrder.begin(), mergeOrder.end(), std::make_pair(facetBegin, size_t(0)));
+    for (; entry != mergeOrder.end() && entry->first < facetEnd; ++entry) {
+        globSimuState.MergeFacetMoment(tmpState, entry->first, entry->second, false);
+        if (!model->sparseThreadResults)
+            tmpCells.MergeFacetMoment(globSimuState.facetStates[entry->first].momentResults[entry->second],
+                                      entry->first, entry->second);
+    }
+    if (model->sparseThreadResults)
+        tmpSparseCells.MergeInto(globSimuState.facetStates, facetBegin, facetEnd);
+}
+
 // Compute particle teleport
 void Particle::PerformTeleport(SimulationFacet *iFacet) {
 
@@ -159,17 +234,14 @@ void Particle::PerformTeleport(SimulationFacet *iFacet) {
         return; //LEAK
     }
 
-    int momentIndex = -1;
-    if ((momentIndex = LookupMomentIndex(particle.time, model->tdParams.moments, lastMomentIndex)) > 0) {
-        lastMomentIndex = momentIndex - 1;
-    }
+    const std::vector<int> &momentSlots = LookupMomentSlots(particle.time);
     // Count this hit as a transparent pass
     if (particleId == 0) RecordHit(HIT_TELEPORTSOURCE);
     if (/*iFacet->texture && */iFacet->sh.countTrans)
-        RecordHitOnTexture(iFacet, momentIndex, true, 2.0, 2.0);
+        RecordHitOnTexture(iFacet, momentSlots, true, 2.0, 2.0);
     if (/*iFacet->direction && */iFacet->sh.countDirection)
-        RecordDirectionVector(iFacet, momentIndex);
-    ProfileFacet(iFacet, momentIndex, true, 2.0, 2.0);
+        RecordDirectionVector(iFacet, momentSlots);
+    ProfileFacet(iFacet, momentSlots, true, 2.0, 2.0);
     LogHit(iFacet);
     if (iFacet->sh.anglemapParams.record) RecordAngleMap(iFacet);
 
@@ -211,7 +283,7 @@ void Particle::PerformTeleport(SimulationFacet *iFacet) {
     /*iFacet->sh.tmpCounter.hit.nbMCHit++;
     iFacet->sh.tmpCounter.hit.sum_1_per_ort_velocity += 2.0 / ortVelocity;
     iFacet->sh.tmpCounter.hit.sum_v_ort += 2.0*(model->wp.useMaxwellDistribution ? 1.0 : 1.1781)*ortVelocity;*/
-    IncreaseFacetCounter(iFacet, momentIndex, 1, 0, 0, 2.0 / ortVelocity,
+    IncreaseFacetCounter(iFacet, momentSlots, 1, 0, 0, 2.0 / ortVelocity,
                          2.0 * (model->wp.useMaxwellDistribution ? 1.0 : 1.1781) * ortVelocity);
     tmpFacetVars[iFacet->globalId].isHit = true;
     /*destination->sh.tmpCounter.hit.sum_1_per_ort_velocity += 2.0 / velocity;
@@ -241,6 +313,23 @@ void DeleteChain (HitChain** head_ref){
 
 // Perform nbStep simulation steps (a step is a bounce) or remainingDes desorptions
 bool Particle::SimulationMCStep(size_t nbStep, size_t threadNum, size_t remainingDes) {
+    // Simulate until the next merge into the global state is due
+    nbStep = syncScheduler.GetStepCount(nbStep);
+    // The trees are only swapped between steps
+    const auto accelLock = reoptimizer ? reoptimizer->BeginStep(*model) : std::shared_lock<std::shared_mutex>();
+    const auto stepStart = std::chrono::steady_clock::now();
+#if !defined(USE_OLD_BVH)
+    if (model->wavefrontSize > 0) {
+        particleId = threadNum;
+        size_t nbDone = 0;
+        const bool wavefrontOK = wavefront.Step(*this, nbStep, remainingDes, nbDone);
+        const double stepTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+        syncScheduler.RecordSteps(nbDone, stepTime);
+        if (reoptimizer)
+            reoptimizer->RecordSteps(nbDone, stepTime);
+        return wavefrontOK;
+    }
+#endif
 
     // Perform simulation steps
     int returnVal = true;
@@ -292,184 +381,213 @@ bool Particle::SimulationMCStep(size_t nbStep, size_t threadNum, size_t remainin
                                                       particle.direction, model->structures[particle.structure].aabbTree.get());
             //printf("%lf ms time spend in old BVH\n", tmpTime.ElapsedMs());
 #else
-            transparentHitBuffer.clear();
             bool found;
-            SimulationFacet* collidedFacet;
-            double d;
+            SimulationFacet* collidedFacet = nullptr;
+            double d = 0.0;
+            particle.tMax = 1.0e99;
             {
-                //particle = Ray(position, particle.direction, nullptr, 1.0e99, this->particle.time);
-                //particle.hits = &hits;
-                //particle.rng = &randomGenerator;
-                particle.tMax = 1.0e99;
-                /*if(lastHitFacet)
-                    particle.lastIntersected = lastHitFacet->globalId;
-                else
-                    particle.lastIntersected = -1;*/
-
+                MF_PROFILE_SCOPE(profileCounters, ProfileEvent::Intersect);
                 found = model->accel.at(particle.structure)->Intersect(particle);
-                if(found){
-
-                    // first pass
-                    std::set<size_t> alreadyHit; // account for duplicate hits on kdtree
-
-                    for(auto& hit : particle.hits){
-                        if(particle.tMax <= hit.hit.colDistTranspPass) {
-                            continue;
-                        }
-
-                        if(!hit.hit.isHit) { // not hard hit
-                            //transparentHitBuffer.push_back(model->facets[hit.hitId].get());
-
-                            // Second pass for transparent hits
-                            auto tpFacet = model->facets[hit.hitId].get();
-                            if(model->wp.accel_type==1) { // account for duplicate hits on kdtree
-                                if (alreadyHit.find(tpFacet->globalId) == alreadyHit.end()) {
-                                    tmpFacetVars[hit.hitId] = hit.hit;
-                                    RegisterTransparentPass(tpFacet);
-                                    alreadyHit.insert(tpFacet->globalId);
-                                }
-                            }
-                            else {
-                                tmpFacetVars[hit.hitId] = hit.hit;
-                                RegisterTransparentPass(tpFacet);
-                            }
-                        }
-                    }
-                }
+            }
+            ResolveIntersection(found, collidedFacet, d);
+#endif //use old bvh
 
-                particle.hits.clear();
+            insertNewParticle = ProcessIntersection(found, collidedFacet, d);
+        }
+        const double stepTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+        syncScheduler.RecordSteps(i, stepTime);
+        if (reoptimizer)
+            reoptimizer->RecordSteps(i, stepTime);
+
+/*#pragma omp critical
+            ++allQuit;*/
+    } // omp parallel
+
+    return returnVal;
+}
+
+/**
+* \brief Registers the transparent passes of the last intersection test and returns its hard hit
+* \param found whether the intersection test found a hard hit
+* \param collidedFacet hard hit facet, only set if found
+* \param d distance to the hard hit, only set if found
+*/
+void Particle::ResolveIntersection(bool found, SimulationFacet *&collidedFacet, double &d) {
+    transparentHitBuffer.clear();
+    const size_t bufferCapacity = std::max(particle.hits.capacity(), transparentHitBuffer.capacity());
+    if(bufferCapacity > hitBufferCapacity) {
+        hitBufferCapacity = bufferCapacity;
+        ++nbHitBufferGrowths;
+    }
+    if(found){
+
+        // first pass
+        // account for duplicate hits on kdtree: a facet is registered once per intersection test
+        if(++intersectionStamp == 0) { // wrapped around, forget all stamps
+            std::fill(transparentPassStamp.begin(), transparentPassStamp.end(), 0);
+            intersectionStamp = 1;
+        }
+
+        for(auto& hit : particle.hits){
+            if(particle.tMax <= hit.hit.colDistTranspPass) {
+                continue;
             }
 
-            // hard hit
-            if(found){
-                auto& hit = particle.hardHit;
-                collidedFacet = model->facets[hit.hitId].get();
-                tmpFacetVars[hit.hitId] = hit.hit;
-                d = hit.hit.colDistTranspPass;
+            if(!hit.hit.isHit) { // not hard hit
+                //transparentHitBuffer.push_back(model->facets[hit.hitId].get());
+
+                // Second pass for transparent hits
+                auto tpFacet = model->facets[hit.hitId].get();
+                if(model->wp.accel_type==1) { // account for duplicate hits on kdtree
+                    if (transparentPassStamp[tpFacet->globalId] != intersectionStamp) {
+                        tmpFacetVars[hit.hitId] = hit.hit;
+                        RegisterTransparentPass(tpFacet);
+                        transparentPassStamp[tpFacet->globalId] = intersectionStamp;
+                    }
+                }
+                else {
+                    tmpFacetVars[hit.hitId] = hit.hit;
+                    RegisterTransparentPass(tpFacet);
+                }
             }
-            /*{
-                Ray tmpRay(position, particle.direction, nullptr, 1.0e99, this->particle.time);
-                if(lastHitFacet)
-                    tmpRay.lastIntersected = lastHitFacet->globalId;
-                else
-                    tmpRay.lastIntersected = -1;
-                tmpRay.rng = &randomGenerator;
-
-                HitChain* hitChain = new HitChain();
-                tmpRay.hitChain = hitChain;
+        }
+    }
+    particle.hits.clear();
+
+    // hard hit
+    if(found){
+        auto& hit = particle.hardHit;
+        collidedFacet = model->facets[hit.hitId].get();
+        tmpFacetVars[hit.hitId] = hit.hit;
+        d = hit.hit.colDistTranspPass;
+    }
+    /*{
+        Ray tmpRay(position, particle.direction, nullptr, 1.0e99, this->particle.time);
+        if(lastHitFacet)
+            tmpRay.lastIntersected = lastHitFacet->globalId;
+        else
+            tmpRay.lastIntersected = -1;
+        tmpRay.rng = &randomGenerator;
+
+        HitChain* hitChain = new HitChain();
+        tmpRay.hitChain = hitChain;
 #if defined(USE_KDTREE)
-                found = model->kdtree[particle.structure].Intersect(tmpRay);
+        found = model->kdtree[particle.structure].Intersect(tmpRay);
 #else
-                found = model->bvhs[particle.structure].Intersect(tmpRay);
+        found = model->bvhs[particle.structure].Intersect(tmpRay);
 #endif
-                if(found){
-                    HitChain* currHit = hitChain;
-                    while(currHit){
-                        if(!currHit->hit->isHit) {
-                            transparentHitBuffer.push_back(model->facets[currHit->hitId].get());
-                        }
-                        else {
-                            collidedFacet = model->facets[currHit->hitId].get();
-                            d = currHit->hit->colDistTranspPass;
-                        }
-                        tmpFacetVars[currHit->hitId] = *currHit->hit;
-                        currHit = currHit->next;
-                    }
+        if(found){
+            HitChain* currHit = hitChain;
+            while(currHit){
+                if(!currHit->hit->isHit) {
+                    transparentHitBuffer.push_back(model->facets[currHit->hitId].get());
+                }
+                else {
+                    collidedFacet = model->facets[currHit->hitId].get();
+                    d = currHit->hit->colDistTranspPass;
                 }
+                tmpFacetVars[currHit->hitId] = *currHit->hit;
+                currHit = currHit->next;
+            }
+        }
 
-                DeleteChain(&hitChain);
-            }*/
-#endif //use old bvh
+        DeleteChain(&hitChain);
+    }*/
+}
 
-            if (found) {
-
-                // Move particle to intersection point
-                particle.origin =
-                        particle.origin + d * particle.direction;
-                //distanceTraveled += d;
-
-                const double lastParticleTime = particle.time; //memorize for partial hits
-                particle.time +=
-                        d / 100.0 / velocity; //conversion from cm to m
-
-                if ((!model->wp.calcConstantFlow && (particle.time > model->wp.latestMoment))
-                    || (model->wp.enableDecay &&
-                        (expectedDecayMoment < particle.time))) {
-                    //hit time over the measured period - we create a new particle
-                    //OR particle has decayed
-                    const double remainderFlightPath = velocity * 100.0 *
-                                                       Min(model->wp.latestMoment - lastParticleTime,
-                                                           expectedDecayMoment -
-                                                                   lastParticleTime); //distance until the point in space where the particle decayed
-                    tmpState.globalHits.distTraveled_total += remainderFlightPath * oriRatio;
-                    if (particleId == 0)RecordHit(HIT_LAST);
-                    //distTraveledSinceUpdate += distanceTraveled;
-                    insertNewParticle = true;
-                    lastHitFacet=nullptr;
-                    particle.lastIntersected = -1;
-                } else { //hit within measured time, particle still alive
-                    if (collidedFacet->sh.teleportDest != 0) { //Teleport
-                        IncreaseDistanceCounters(d * oriRatio);
-                        PerformTeleport(collidedFacet);
+/**
+* \brief Moves the particle to its hard hit and handles it (teleport, absorption, bounce) or the leak
+* \param found whether the intersection test found a hard hit
+* \param collidedFacet hard hit facet
+* \param d distance to the hard hit
+* \return true if the particle ended and a new one has to be desorbed
+*/
+bool Particle::ProcessIntersection(bool found, SimulationFacet *collidedFacet, double d) {
+    bool insertNewParticle = false;
+    if (found) {
+
+        // Move particle to intersection point
+        particle.origin =
+                particle.origin + d * particle.direction;
+        //distanceTraveled += d;
+
+        const double lastParticleTime = particle.time; //memorize for partial hits
+        particle.time +=
+                d / 100.0 / velocity; //conversion from cm to m
+
+        if ((!model->wp.calcConstantFlow && (particle.time > model->wp.latestMoment))
+            || (model->wp.enableDecay &&
+                (expectedDecayMoment < particle.time))) {
+            //hit time over the measured period - we create a new particle
+            //OR particle has decayed
+            const double remainderFlightPath = velocity * 100.0 *
+                                               Min(model->wp.latestMoment - lastParticleTime,
+                                                   expectedDecayMoment -
+                                                           lastParticleTime); //distance until the point in space where the particle decayed
+            tmpState.globalHits.distTraveled_total += remainderFlightPath * oriRatio;
+            if (particleId == 0)RecordHit(HIT_LAST);
+            //distTraveledSinceUpdate += distanceTraveled;
+            insertNewParticle = true;
+            lastHitFacet=nullptr;
+            particle.lastIntersected = -1;
+        } else { //hit within measured time, particle still alive
+            if (collidedFacet->sh.teleportDest != 0) { //Teleport
+                IncreaseDistanceCounters(d * oriRatio);
+                PerformTeleport(collidedFacet);
+            }
+                /*else if ((GetOpacityAt(collidedFacet, particle.time) < 1.0) && (randomGenerator.rnd() > GetOpacityAt(collidedFacet, particle.time))) {
+                    //Transparent pass
+                    tmpState.globalHits.distTraveled_total += d;
+                    PerformTransparentPass(collidedFacet);
+                }*/
+            else { //Not teleport
+                IncreaseDistanceCounters(d * oriRatio);
+                const double stickingProbability = model->GetStickingAt(collidedFacet, particle.time);
+                if (!model->otfParams.lowFluxMode) { //Regular stick or bounce
+                    if (stickingProbability == 1.0 ||
+                        ((stickingProbability > 0.0) && (randomGenerator.rnd() < (stickingProbability)))) {
+                        //Absorbed
+                        RecordAbsorb(collidedFacet);
+                        //currentParticle.lastHitFacet = nullptr; // null facet in case we reached des limit and want to go on, prevents leak
+                        //distTraveledSinceUpdate += distanceTraveled;
+                        insertNewParticle = true;
+                        lastHitFacet=nullptr;
+                        particle.lastIntersected = -1;
+                    } else {
+                        //Reflected
+                        PerformBounce(collidedFacet);
                     }
-                        /*else if ((GetOpacityAt(collidedFacet, particle.time) < 1.0) && (randomGenerator.rnd() > GetOpacityAt(collidedFacet, particle.time))) {
-                            //Transparent pass
-                            tmpState.globalHits.distTraveled_total += d;
-                            PerformTransparentPass(collidedFacet);
-                        }*/
-                    else { //Not teleport
-                        IncreaseDistanceCounters(d * oriRatio);
-                        const double stickingProbability = model->GetStickingAt(collidedFacet, particle.time);
-                        if (!model->otfParams.lowFluxMode) { //Regular stick or bounce
-                            if (stickingProbability == 1.0 ||
-                                ((stickingProbability > 0.0) && (randomGenerator.rnd() < (stickingProbability)))) {
-                                //Absorbed
-                                RecordAbsorb(collidedFacet);
-                                //currentParticle.lastHitFacet = nullptr; // null facet in case we reached des limit and want to go on, prevents leak
-                                //distTraveledSinceUpdate += distanceTraveled;
-                                insertNewParticle = true;
-                                lastHitFacet=nullptr;
-                                particle.lastIntersected = -1;
-                            } else {
-                                //Reflected
-                                PerformBounce(collidedFacet);
-                            }
-                        } else { //Low flux mode
-                            if (stickingProbability > 0.0) {
-                                const double oriRatioBeforeCollision = oriRatio; //Local copy
-                                oriRatio *= (stickingProbability); //Sticking part
-                                RecordAbsorb(collidedFacet);
-                                oriRatio =
-                                        oriRatioBeforeCollision * (1.0 - stickingProbability); //Reflected part
-                            } else
-                                oriRatio *= (1.0 - stickingProbability);
-                            if (oriRatio > model->otfParams.lowFluxCutoff) {
-                                PerformBounce(collidedFacet);
-                            } else { //eliminate remainder and create new particle
-                                insertNewParticle = true;
-                                lastHitFacet=nullptr;
-                                particle.lastIntersected = -1;
-                            }
-                        }
+                } else { //Low flux mode
+                    if (stickingProbability > 0.0) {
+                        const double oriRatioBeforeCollision = oriRatio; //Local copy
+                        oriRatio *= (stickingProbability); //Sticking part
+                        RecordAbsorb(collidedFacet);
+                        oriRatio =
+                                oriRatioBeforeCollision * (1.0 - stickingProbability); //Reflected part
+                    } else
+                        oriRatio *= (1.0 - stickingProbability);
+                    if (oriRatio > model->otfParams.lowFluxCutoff) {
+                        PerformBounce(collidedFacet);
+                    } else { //eliminate remainder and create new particle
+                        insertNewParticle = true;
+                        lastHitFacet=nullptr;
+                        particle.lastIntersected = -1;
                     }
-                } //end hit within measured time
-            } //end intersection found
-            else {
-                // No intersection found: Leak
-                tmpState.globalHits.nbLeakTotal++;
-                if (particleId == 0)RecordLeakPos();
-                insertNewParticle = true;
-                particle.lastIntersected = -1;
-                lastHitFacet=nullptr;
-                particle.lastIntersected = -1;
+                }
             }
-        }
-
-/*#pragma omp critical
-            ++allQuit;*/
-    } // omp parallel
+        } //end hit within measured time
+    } //end intersection found
+    else {
+        // No intersection found: Leak
+        tmpState.globalHits.nbLeakTotal++;
+        if (particleId == 0)RecordLeakPos();
+        insertNewParticle = true;
+        particle.lastIntersected = -1;
+        lastHitFacet=nullptr;
+        particle.lastIntersected = -1;
+    }
 
-    return returnVal;
+    return insertNewParticle;
 }
 
 void Particle::IncreaseDistanceCounters(double distanceIncrement) {
@@ -481,13 +599,12 @@ void Particle::IncreaseDistanceCounters(double distanceIncrement) {
 // Launch a ray from a source facet. The ray
 // particle.direction is chosen according to the desorption type.
 bool Particle::StartFromSource(Ray& ray) {
+    MF_PROFILE_SCOPE(profileCounters, ProfileEvent::SourceGeneration);
     bool found = false;
     bool foundInMap = false;
     bool reverse;
     size_t mapPositionW, mapPositionH;
-    double srcRnd;
-    double sumA = 0.0;
-    size_t i = 0, j = 0;
+    size_t i = 0;
     int nbTry = 0;
 
     // Check end of simulation
@@ -500,75 +617,33 @@ bool Particle::StartFromSource(Ray& ray) {
     }*/
 
     // Select source
-    srcRnd = ray.rng->rnd() * model->wp.totalDesorbedMolecules;
-
-    i = 0;
-    for(auto& fac : model->facets) { //Go through facets in a structure
-        auto f = std::dynamic_pointer_cast<MolflowSimFacet>(fac);
-        if (f->sh.desorbType != DES_NONE) { //there is some kind of outgassing
-            if (f->sh.useOutgassingFile) { //Using SynRad-generated outgassing map
-                if (f->sh.totalOutgassing > 0.0) {
-                    found = (srcRnd >= sumA) && (srcRnd < (sumA + model->wp.latestMoment * f->sh.totalOutgassing /
-                                                                  (1.38E-23 * f->sh.temperature)));
-                    if (found) {
-                        //look for exact position in map
-                        double rndRemainder = (srcRnd - sumA) / model->wp.latestMoment * (1.38E-23 *
-                                                                                          f->sh.temperature); //remainder, should be less than f->sh.totalOutgassing
-                        /*double sumB = 0.0;
-                        for (w = 0; w < f->sh.outgassingMapWidth && !foundInMap; w++) {
-                            for (h = 0; h < f->sh.outgassingMapHeight && !foundInMap; h++) {
-                                double cellOutgassing = f->outgassingMap[h*f->sh.outgassingMapWidth + w];
-                                if (cellOutgassing > 0.0) {
-                                    foundInMap = (rndRemainder >= sumB) && (rndRemainder < (sumB + cellOutgassing));
-                                    if (foundInMap) mapPositionW = w; mapPositionH = h;
-                                    sumB += cellOutgassing;
-                                }
-                            }
-                        }*/
-                        double lookupValue = rndRemainder;
-                        int outgLowerIndex = my_lower_bound(lookupValue,
-                                                            f->ogMap.outgassingMap_cdf); //returns line number AFTER WHICH LINE lookup value resides in ( -1 .. size-2 )
-                        outgLowerIndex++;
-                        mapPositionH = (size_t) ((double) outgLowerIndex / (double) f->ogMap.outgassingMapWidth);
-                        mapPositionW = (size_t) outgLowerIndex - mapPositionH * f->ogMap.outgassingMapWidth;
-                        foundInMap = true;
-                        /*if (!foundInMap) {
-                            SetErrorSub("Starting point not found in imported desorption map");
-                            return false;
-                        }*/
-                    }
-                    sumA += model->wp.latestMoment * f->sh.totalOutgassing / (1.38E-23 * f->sh.temperature);
-                }
-            } //end outgassing file block
-            else { //constant or time-dependent outgassing
-                double facetOutgassing =
-                        ((f->sh.outgassing_paramId >= 0)
-                         ? model->tdParams.IDs[f->sh.IDid].back().second
-                         : model->wp.latestMoment * f->sh.outgassing) / (1.38E-23 * f->sh.temperature);
-                found = (srcRnd >= sumA) && (srcRnd < (sumA + facetOutgassing));
-                sumA += facetOutgassing;
-            } //end constant or time-dependent outgassing block
-        } //end 'there is some kind of outgassing'
-        if (!found) i++;
-        if (f->sh.is2sided) reverse = ray.rng->rnd() > 0.5;
-        else reverse = false;
-
-        if(found) break;
-    } // facet loop
-
-    if (!found) {
+    if (model->sourceAlias.empty()) {
         fmt::print(stderr,  "No starting point, aborting\n");
         return false;
     }
-
+    i = model->sourceFacetIds[model->sourceAlias.Sample(ray.rng->rnd())];
     auto src = model->facets[i].get();
+
+    if (src->sh.useOutgassingFile) { //Using SynRad-generated outgassing map
+        //look for exact position in map
+        auto& outgMap = ((MolflowSimFacet*)(src))->ogMap;
+        double lookupValue = ray.rng->rnd() * outgMap.outgassingMap_cdf.back();
+        int outgLowerIndex = my_lower_bound(lookupValue,
+                                            outgMap.outgassingMap_cdf); //returns line number AFTER WHICH LINE lookup value resides in ( -1 .. size-2 )
+        outgLowerIndex++;
+        mapPositionH = (size_t) ((double) outgLowerIndex / (double) outgMap.outgassingMapWidth);
+        mapPositionW = (size_t) outgLowerIndex - mapPositionH * outgMap.outgassingMapWidth;
+        foundInMap = true;
+    }
+    if (src->sh.is2sided) reverse = ray.rng->rnd() > 0.5;
+    else reverse = false;
+
     lastHitFacet = src;
     ray.lastIntersected = lastHitFacet->globalId;
     //distanceTraveled = 0.0;  //for mean free path calculations
     //particle.time = desorptionStartTime + (desorptionStopTime - desorptionStartTime)*randomGenerator.rnd();
-    ray.time = generationTime = Physics::GenerateDesorptionTime(model->tdParams.IDs, src, randomGenerator.rnd(), model->wp.latestMoment);
-    lastMomentIndex = 0;
-    if (model->wp.useMaxwellDistribution) velocity = Physics::GenerateRandomVelocity(model->tdParams.CDFs, src->sh.CDFid, randomGenerator.rnd());
+    ray.time = generationTime = Physics::GenerateDesorptionTime(model->tdParams, src, randomGenerator.rnd(), model->wp.latestMoment);
+    if (model->wp.useMaxwellDistribution) velocity = Physics::GenerateRandomVelocity(model->tdParams, src->sh.CDFid, randomGenerator.rnd());
     else
         velocity =
                 145.469 * std::sqrt(src->sh.temperature / model->wp.gasMass);  //sqrt(8*R/PI/1000)=145.47
@@ -590,7 +665,17 @@ bool Particle::StartFromSource(Ray& ray) {
 
     found = false; //Starting point within facet
 
-    // Choose a starting point
+    auto& srcTriangulation = ((MolflowSimFacet*)(src))->triangulation;
+    if (!foundInMap && !srcTriangulation.empty()) {
+        // Exact uniform sampling on the triangulated facet, no rejection needed
+        Vector2d uv = srcTriangulation.SamplePoint(randomGenerator.rnd(), randomGenerator.rnd(), randomGenerator.rnd());
+        ray.origin = src->sh.O + uv.u * src->sh.U + uv.v * src->sh.V;
+        tmpFacetVars[src->globalId].colU = uv.u;
+        tmpFacetVars[src->globalId].colV = uv.v;
+        found = true;
+    }
+
+    // Choose a starting point (inside an outgassing map cell, or if the facet couldn't be triangulated)
     while (!found && nbTry < 1000) {
         double u, v;
         if (foundInMap) {
@@ -676,11 +761,21 @@ bool Particle::StartFromSource(Ray& ray) {
                                          randomGenerator.rnd() * 2.0 * PI, reverse);
             break;
         case DES_ANGLEMAP: {
-            auto[theta, thetaLowerIndex, thetaOvershoot] = AnglemapGeneration::GenerateThetaFromAngleMap(
-                    src->sh.anglemapParams, ((MolflowSimFacet*)(src))->angleMap, randomGenerator.rnd());
-
-            auto phi = AnglemapGeneration::GeneratePhiFromAngleMap(thetaLowerIndex, thetaOvershoot,
-                                                                   src->sh.anglemapParams, ((MolflowSimFacet*)(src))->angleMap, randomGenerator.rnd());
+            auto &angleMap = ((MolflowSimFacet*)(src))->angleMap;
+            double theta, phi;
+            if (!angleMap.thetaLineAlias.empty()) {
+                const double rndTheta = randomGenerator.rnd();
+                std::tie(theta, phi) = AnglemapGeneration::GenerateAnglesFromAliases(src->sh.anglemapParams, angleMap,
+                                                                                     rndTheta, randomGenerator.rnd());
+            }
+            else {
+                int thetaLowerIndex;
+                double thetaOvershoot;
+                std::tie(theta, thetaLowerIndex, thetaOvershoot) = AnglemapGeneration::GenerateThetaFromAngleMap(
+                        src->sh.anglemapParams, angleMap, randomGenerator.rnd());
+                phi = AnglemapGeneration::GeneratePhiFromAngleMap(thetaLowerIndex, thetaOvershoot,
+                                                                  src->sh.anglemapParams, angleMap, randomGenerator.rnd());
+            }
                             
             /*                                                      
             //Debug
@@ -734,18 +829,15 @@ bool Particle::StartFromSource(Ray& ray) {
     /*src->sh.tmpCounter.hit.nbDesorbed++;
     src->sh.tmpCounter.hit.sum_1_per_ort_velocity += 2.0 / ortVelocity; //was 2.0 / ortV
     src->sh.tmpCounter.hit.sum_v_ort += (model->wp.useMaxwellDistribution ? 1.0 : 1.1781)*ortVelocity;*/
-    int momentIndex = -1;
-    if ((momentIndex = LookupMomentIndex(ray.time, model->tdParams.moments, lastMomentIndex)) > 0) {
-        lastMomentIndex = momentIndex - 1;
-    }
+    const std::vector<int> &momentSlots = LookupMomentSlots(ray.time);
 
-    IncreaseFacetCounter(src, momentIndex, 0, 1, 0, 2.0 / ortVelocity,
+    IncreaseFacetCounter(src, momentSlots, 0, 1, 0, 2.0 / ortVelocity,
                          (model->wp.useMaxwellDistribution ? 1.0 : 1.1781) * ortVelocity);
     //Desorption doesn't contribute to angular profiles, nor to angle maps
-    ProfileFacet(src, momentIndex, false, 2.0, 1.0); //was 2.0, 1.0
+    ProfileFacet(src, momentSlots, false, 2.0, 1.0); //was 2.0, 1.0
     LogHit(src);
     if (/*src->texture && */src->sh.countDes)
-        RecordHitOnTexture(src, momentIndex, true, 2.0, 1.0); //was 2.0, 1.0
+        RecordHitOnTexture(src, momentSlots, true, 2.0, 1.0); //was 2.0, 1.0
     //if (src->direction && src->sh.countDirection) RecordDirectionVector(src, particle.time);
 
     // Reset volatile state
@@ -766,6 +858,7 @@ bool Particle::StartFromSource(Ray& ray) {
 * \param iFacet facet corresponding to the bounce event
 */
 void Particle::PerformBounce(SimulationFacet *iFacet) {
+    MF_PROFILE_SCOPE(profileCounters, ProfileEvent::Bounce);
 
     bool revert = false;
     tmpState.globalHits.globalHits.nbMCHit++; //global
@@ -773,12 +866,9 @@ void Particle::PerformBounce(SimulationFacet *iFacet) {
 
     // Handle super structure link facet. Can be
     if (iFacet->sh.superDest) {
-        int momentIndex = -1;
-        if ((momentIndex = LookupMomentIndex(particle.time, model->tdParams.moments, lastMomentIndex)) > 0) {
-            lastMomentIndex = momentIndex - 1;
-        }
+        const std::vector<int> &momentSlots = LookupMomentSlots(particle.time);
 
-        IncreaseFacetCounter(iFacet, momentIndex, 1, 0, 0, 0, 0);
+        IncreaseFacetCounter(iFacet, momentSlots, 1, 0, 0, 0, 0);
         particle.structure = iFacet->sh.superDest - 1;
         if (iFacet->sh.isMoving) { //A very special case where link facets can be used as transparent but moving facets
             if (particleId == 0)RecordHit(HIT_MOVING);
@@ -789,12 +879,12 @@ void Particle::PerformBounce(SimulationFacet *iFacet) {
         }
         LogHit(iFacet);
 
-        ProfileFacet(iFacet, momentIndex, true, 2.0, 2.0);
+        ProfileFacet(iFacet, momentSlots, true, 2.0, 2.0);
         if (iFacet->sh.anglemapParams.record) RecordAngleMap(iFacet);
         if (/*iFacet->texture &&*/ iFacet->sh.countTrans)
-            RecordHitOnTexture(iFacet, momentIndex, true, 2.0, 2.0);
+            RecordHitOnTexture(iFacet, momentSlots, true, 2.0, 2.0);
         if (/*iFacet->direction &&*/ iFacet->sh.countDirection)
-            RecordDirectionVector(iFacet, momentIndex);
+            RecordDirectionVector(iFacet, momentSlots);
 
         return;
 
@@ -803,19 +893,16 @@ void Particle::PerformBounce(SimulationFacet *iFacet) {
     // Handle volatile facet
     if (iFacet->sh.isVolatile) {
         if (iFacet->isReady) {
-            int momentIndex = -1;
-            if ((momentIndex = LookupMomentIndex(particle.time, model->tdParams.moments, lastMomentIndex)) > 0) {
-                lastMomentIndex = momentIndex - 1;
-            }
+            const std::vector<int> &momentSlots = LookupMomentSlots(particle.time);
 
-            IncreaseFacetCounter(iFacet, momentIndex, 0, 0, 1, 0, 0);
+            IncreaseFacetCounter(iFacet, momentSlots, 0, 0, 1, 0, 0);
             iFacet->isReady = false;
             LogHit(iFacet);
-            ProfileFacet(iFacet, momentIndex, true, 2.0, 1.0);
+            ProfileFacet(iFacet, momentSlots, true, 2.0, 1.0);
             if (/*iFacet->texture && */iFacet->sh.countAbs)
-                RecordHitOnTexture(iFacet, momentIndex, true, 2.0, 1.0);
+                RecordHitOnTexture(iFacet, momentSlots, true, 2.0, 1.0);
             if (/*iFacet->direction && */iFacet->sh.countDirection)
-                RecordDirectionVector(iFacet, momentIndex);
+                RecordDirectionVector(iFacet, momentSlots);
         }
         return;
 
@@ -837,20 +924,17 @@ void Particle::PerformBounce(SimulationFacet *iFacet) {
     iFacet->sh.tmpCounter.hit.sum_1_per_ort_velocity += 1.0 / ortVelocity;
     iFacet->sh.tmpCounter.hit.sum_v_ort += (model->wp.useMaxwellDistribution ? 1.0 : 1.1781)*ortVelocity;*/
 
-    int momentIndex = -1;
-    if ((momentIndex = LookupMomentIndex(particle.time, model->tdParams.moments, lastMomentIndex)) > 0) {
-        lastMomentIndex = momentIndex - 1;
-    }
+    const std::vector<int> &momentSlots = LookupMomentSlots(particle.time);
 
-    IncreaseFacetCounter(iFacet, momentIndex, 1, 0, 0, 1.0 / ortVelocity,
+    IncreaseFacetCounter(iFacet, momentSlots, 1, 0, 0, 1.0 / ortVelocity,
                          (model->wp.useMaxwellDistribution ? 1.0 : 1.1781) * ortVelocity);
     nbBounces++;
     if (/*iFacet->texture &&*/ iFacet->sh.countRefl)
-        RecordHitOnTexture(iFacet, momentIndex, true, 1.0, 1.0);
+        RecordHitOnTexture(iFacet, momentSlots, true, 1.0, 1.0);
     if (/*iFacet->direction &&*/ iFacet->sh.countDirection)
-        RecordDirectionVector(iFacet, momentIndex);
+        RecordDirectionVector(iFacet, momentSlots);
     LogHit(iFacet);
-    ProfileFacet(iFacet, momentIndex, true, 1.0, 1.0);
+    ProfileFacet(iFacet, momentSlots, true, 1.0, 1.0);
     if (iFacet->sh.anglemapParams.record) RecordAngleMap(iFacet);
 
     // Relaunch particle
@@ -859,7 +943,7 @@ void Particle::PerformBounce(SimulationFacet *iFacet) {
     if (iFacet->sh.enableSojournTime) {
         double A = exp(-iFacet->sh.sojournE / (8.31 * iFacet->sh.temperature));
         particle.time += -log(randomGenerator.rnd()) / (A * iFacet->sh.sojournFreq);
-        momentIndex = LookupMomentIndex(particle.time, model->tdParams.moments, lastMomentIndex); //reflection might happen in another moment
+        LookupMomentSlots(particle.time); //reflection might happen in another moment, refills the buffer behind momentSlots
     }
 
     if (iFacet->sh.reflection.diffusePart > 0.999999) { //Speedup branch for most common, diffuse case
@@ -898,12 +982,12 @@ void Particle::PerformBounce(SimulationFacet *iFacet) {
 
     /*iFacet->sh.tmpCounter.hit.sum_1_per_ort_velocity += 1.0 / ortVelocity;
     iFacet->sh.tmpCounter.hit.sum_v_ort += (model->wp.useMaxwellDistribution ? 1.0 : 1.1781)*ortVelocity;*/
-    IncreaseFacetCounter(iFacet, momentIndex, 0, 0, 0, 1.0 / ortVelocity,
+    IncreaseFacetCounter(iFacet, momentSlots, 0, 0, 0, 1.0 / ortVelocity,
                          (model->wp.useMaxwellDistribution ? 1.0 : 1.1781) * ortVelocity);
     if (/*iFacet->texture &&*/ iFacet->sh.countRefl)
-        RecordHitOnTexture(iFacet, momentIndex, false, 1.0,
+        RecordHitOnTexture(iFacet, momentSlots, false, 1.0,
                            1.0); //count again for outward velocity
-    ProfileFacet(iFacet, momentIndex, false, 1.0, 1.0);
+    ProfileFacet(iFacet, momentSlots, false, 1.0, 1.0);
     //no particle.direction count on outgoing, neither angle map
 
     if (iFacet->sh.isMoving && model->wp.motionType) {
@@ -932,32 +1016,30 @@ void Particle::PerformBounce(SimulationFacet *iFacet) {
 }*/
 
 void Particle::RecordAbsorb(SimulationFacet *iFacet) {
+    MF_PROFILE_SCOPE(profileCounters, ProfileEvent::Absorb);
     tmpState.globalHits.globalHits.nbMCHit++; //global
     tmpState.globalHits.globalHits.nbHitEquiv += oriRatio;
     tmpState.globalHits.globalHits.nbAbsEquiv += oriRatio;
 
-    int momentIndex = -1;
-    if ((momentIndex = LookupMomentIndex(particle.time, model->tdParams.moments, lastMomentIndex)) > 0) {
-        lastMomentIndex = momentIndex - 1;
-    }
+    const std::vector<int> &momentSlots = LookupMomentSlots(particle.time);
 
-    RecordHistograms(iFacet, momentIndex);
+    RecordHistograms(iFacet, momentSlots);
 
     if (particleId == 0) RecordHit(HIT_ABS);
     double ortVelocity =
             velocity * std::abs(Dot(particle.direction, iFacet->sh.N));
-    IncreaseFacetCounter(iFacet, momentIndex, 1, 0, 1, 2.0 / ortVelocity,
+    IncreaseFacetCounter(iFacet, momentSlots, 1, 0, 1, 2.0 / ortVelocity,
                          (model->wp.useMaxwellDistribution ? 1.0 : 1.1781) * ortVelocity);
     LogHit(iFacet);
-    ProfileFacet(iFacet, momentIndex, true, 2.0, 1.0); //was 2.0, 1.0
+    ProfileFacet(iFacet, momentSlots, true, 2.0, 1.0); //was 2.0, 1.0
     if (iFacet->sh.anglemapParams.record) RecordAngleMap(iFacet);
     if (/*iFacet->texture &&*/ iFacet->sh.countAbs)
-        RecordHitOnTexture(iFacet, momentIndex, true, 2.0, 1.0); //was 2.0, 1.0
+        RecordHitOnTexture(iFacet, momentSlots, true, 2.0, 1.0); //was 2.0, 1.0
     if (/*iFacet->direction &&*/ iFacet->sh.countDirection)
-        RecordDirectionVector(iFacet, momentIndex);
+        RecordDirectionVector(iFacet, momentSlots);
 }
 
-void Particle::RecordHistograms(SimulationFacet *iFacet, int m) {
+void Particle::RecordHistograms(SimulationFacet *iFacet, const std::vector<int> &momentSlots) {
     //Record in global and facet histograms
     size_t binIndex;
 
@@ -966,9 +1048,8 @@ void Particle::RecordHistograms(SimulationFacet *iFacet, int m) {
     auto &globHistParams = model->wp.globalHistogramParams;
     auto &facHistParams = iFacet->sh.facetHistogramParams;
 
-    for (const int moment : {0, m}) {
-        if (moment < 0) return;
-
+    MarkDirty(iFacet->globalId, momentSlots);
+    for (const int moment : momentSlots) {
         if (globHistParams.recordBounce) {
             binIndex = Min(nbBounces / globHistParams.nbBounceBinsize,
                            globHistParams.GetBounceHistogramSize() - 1);
@@ -1006,9 +1087,51 @@ void Particle::RecordHistograms(SimulationFacet *iFacet, int m) {
     }
 }
 
+/**
+* \brief Flags the results of a facet for the next merge
+*/
+void Particle::MarkDirty(size_t facetId, const std::vector<int> &momentSlots) {
+    for (const int moment : momentSlots)
+        dirtyFacets.Mark(facetId, moment);
+}
+
+/**
+* \brief Collects the result slots an event at a given time is recorded into
+* \param time time of the event
+* \return 0 (constant flow) followed by every moment containing the time, moments may overlap
+*/
+const std::vector<int> &Particle::LookupMomentSlots(double time) {
+    momentSlotBuffer.resize(1, 0);
+    if (!model->tdParams.moments.empty())
+        model->tdParams.momentIndex.LookupAll(time, model->tdParams.moments, momentSlotBuffer);
+    return momentSlotBuffer;
+}
+
+/**
+* \brief Access to a thread local texture cell, either in the arena or in the sparse buffer
+*/
+TextureCell &Particle::GetTextureCell(size_t facetId, size_t m, size_t add) {
+    if (model->sparseThreadResults)
+        return tmpSparseCells.Texture(facetId, m, add);
+    return tmpCells.Texture(facetId, m, add);
+}
+
+ProfileSlice &Particle::GetProfileSlice(size_t facetId, size_t m, size_t pos) {
+    if (model->sparseThreadResults)
+        return tmpSparseCells.Profile(facetId, m, pos);
+    return tmpCells.Profile(facetId, m, pos);
+}
+
+DirectionCell &Particle::GetDirectionCell(size_t facetId, size_t m, size_t add) {
+    if (model->sparseThreadResults)
+        return tmpSparseCells.Direction(facetId, m, add);
+    return tmpCells.Direction(facetId, m, add);
+}
+
 void
-Particle::RecordHitOnTexture(const SimulationFacet *f, int m, bool countHit, double velocity_factor,
-                             double ortSpeedFactor) {
+Particle::RecordHitOnTexture(const SimulationFacet *f, const std::vector<int> &momentSlots, bool countHit,
+                             double velocity_factor, double ortSpeedFactor) {
+    MF_PROFILE_SCOPE(profileCounters, ProfileEvent::TextureRecording);
 
     size_t tu = (size_t) (tmpFacetVars[f->globalId].colU * f->sh.texWidth_precise);
     size_t tv = (size_t) (tmpFacetVars[f->globalId].colV * f->sh.texHeight_precise);
@@ -1017,16 +1140,9 @@ Particle::RecordHitOnTexture(const SimulationFacet *f, int m, bool countHit, dou
                          std::abs(Dot(particle.direction,
                                       f->sh.N)); //surface-orthogonal velocity component
 
-    {
-        TextureCell &texture = tmpState.facetStates[f->globalId].momentResults[0].texture[add];
-        if (countHit) texture.countEquiv += oriRatio;
-        texture.sum_1_per_ort_velocity +=
-                oriRatio * velocity_factor / ortVelocity;
-        texture.sum_v_ort_per_area += oriRatio * ortSpeedFactor * ortVelocity *
-                                      f->textureCellIncrements[add]; // sum ortho_velocity[m/s] / cell_area[cm2]
-    }
-    if (m > 0) {
-        TextureCell &texture = tmpState.facetStates[f->globalId].momentResults[m].texture[add];
+    MarkDirty(f->globalId, momentSlots);
+    for (const int moment : momentSlots) {
+        TextureCell &texture = GetTextureCell(f->globalId, moment, add);
         if (countHit) texture.countEquiv += oriRatio;
         texture.sum_1_per_ort_velocity +=
                 oriRatio * velocity_factor / ortVelocity;
@@ -1035,57 +1151,41 @@ Particle::RecordHitOnTexture(const SimulationFacet *f, int m, bool countHit, dou
     }
 }
 
-void Particle::RecordDirectionVector(const SimulationFacet *f, int m) {
+void Particle::RecordDirectionVector(const SimulationFacet *f, const std::vector<int> &momentSlots) {
     size_t tu = (size_t) (tmpFacetVars[f->globalId].colU * f->sh.texWidth_precise);
     size_t tv = (size_t) (tmpFacetVars[f->globalId].colV * f->sh.texHeight_precise);
     size_t add = tu + tv * (f->sh.texWidth);
 
-    {
-        DirectionCell &dirCell = tmpState.facetStates[f->globalId].momentResults[0].direction[add];
-        dirCell.dir += oriRatio * particle.direction * velocity;
-        dirCell.count++;
-    }
-    if (m > 0) {
-        lastMomentIndex = m - 1;
-        DirectionCell &dirCell = tmpState.facetStates[f->globalId].momentResults[m].direction[add];
+    MarkDirty(f->globalId, momentSlots);
+    for (const int moment : momentSlots) {
+        DirectionCell &dirCell = GetDirectionCell(f->globalId, moment, add);
         dirCell.dir += oriRatio * particle.direction * velocity;
         dirCell.count++;
     }
-
 }
 
 void
-Particle::ProfileFacet(const SimulationFacet *f, int m, bool countHit, double velocity_factor,
-                       double ortSpeedFactor) {
+Particle::ProfileFacet(const SimulationFacet *f, const std::vector<int> &momentSlots, bool countHit,
+                       double velocity_factor, double ortSpeedFactor) {
+    MF_PROFILE_SCOPE(profileCounters, ProfileEvent::ProfileRecording);
 
-    size_t nbMoments = model->tdParams.moments.size();
+    if (f->sh.profileType != PROFILE_NONE)
+        MarkDirty(f->globalId, momentSlots);
     if (countHit && f->sh.profileType == PROFILE_ANGULAR) {
         double dot = Dot(f->sh.N, particle.direction);
         double theta = std::acos(std::abs(dot));     // Angle to normal (PI/2 => PI)
         size_t pos = (size_t) (theta / (PI / 2) * ((double) PROFILE_SIZE)); // To Grad
         Saturate(pos, 0, PROFILE_SIZE - 1);
 
-        tmpState.facetStates[f->globalId].momentResults[0].profile[pos].countEquiv += oriRatio;
-        if (m > 0) {
-            tmpState.facetStates[f->globalId].momentResults[m].profile[pos].countEquiv += oriRatio;
-        }
+        for (const int moment : momentSlots)
+            GetProfileSlice(f->globalId, moment, pos).countEquiv += oriRatio;
     } else if (f->sh.profileType == PROFILE_U || f->sh.profileType == PROFILE_V) {
         size_t pos = (size_t) (
                 (f->sh.profileType == PROFILE_U ? tmpFacetVars[f->globalId].colU : tmpFacetVars[f->globalId].colV) *
                 (double) PROFILE_SIZE);
         if (pos >= 0 && pos < PROFILE_SIZE) {
-            {
-                ProfileSlice &profile = tmpState.facetStates[f->globalId].momentResults[0].profile[pos];
-                if (countHit) profile.countEquiv += oriRatio;
-                double ortVelocity = velocity *
-                                     std::abs(Dot(f->sh.N, particle.direction));
-                profile.sum_1_per_ort_velocity +=
-                        oriRatio * velocity_factor / ortVelocity;
-                profile.sum_v_ort += oriRatio * ortSpeedFactor *
-                                     (model->wp.useMaxwellDistribution ? 1.0 : 1.1781) * ortVelocity;
-            }
-            if (m > 0) {
-                ProfileSlice &profile = tmpState.facetStates[f->globalId].momentResults[m].profile[pos];
+            for (const int moment : momentSlots) {
+                ProfileSlice &profile = GetProfileSlice(f->globalId, moment, pos);
                 if (countHit) profile.countEquiv += oriRatio;
                 double ortVelocity = velocity *
                                      std::abs(Dot(f->sh.N, particle.direction));
@@ -1108,10 +1208,8 @@ Particle::ProfileFacet(const SimulationFacet *f, int m, bool countHit, double ve
         size_t pos = (size_t) (dot * velocity / f->sh.maxSpeed *
                                (double) PROFILE_SIZE); //"dot" default value is 1.0
         if (pos >= 0 && pos < PROFILE_SIZE) {
-            tmpState.facetStates[f->globalId].momentResults[0].profile[pos].countEquiv += oriRatio;
-            if (m > 0) {
-                tmpState.facetStates[f->globalId].momentResults[m].profile[pos].countEquiv += oriRatio;
-            }
+            for (const int moment : momentSlots)
+                GetProfileSlice(f->globalId, moment, pos).countEquiv += oriRatio;
         }
     }
 }
@@ -1162,6 +1260,7 @@ void Particle::RecordAngleMap(const SimulationFacet *collidedFacet) {
         size_t phiIndex = (size_t) ((inPhi + 3.1415926) / (2.0 * PI) *
                                     (double) collidedFacet->sh.anglemapParams.phiWidth); //Phi: -PI..PI , and shifting by a number slightly smaller than PI to store on interval [0,2PI[
 
+        dirtyFacets.Mark(collidedFacet->globalId, 0);
         auto &angleMap = tmpState.facetStates[collidedFacet->globalId].recordedAngleMapPdf;
         angleMap[thetaIndex * collidedFacet->sh.anglemapParams.phiWidth + phiIndex]++;
     }
@@ -1170,7 +1269,7 @@ void Particle::RecordAngleMap(const SimulationFacet *collidedFacet) {
 void Particle::UpdateVelocity(const SimulationFacet *collidedFacet) {
     if (collidedFacet->sh.accomodationFactor > 0.9999) { //speedup for the most common case: perfect thermalization
         if (model->wp.useMaxwellDistribution)
-            velocity = Physics::GenerateRandomVelocity(model->tdParams.CDFs, collidedFacet->sh.CDFid, randomGenerator.rnd());
+            velocity = Physics::GenerateRandomVelocity(model->tdParams, collidedFacet->sh.CDFid, randomGenerator.rnd());
         else
             velocity =
                     145.469 * std::sqrt(collidedFacet->sh.temperature / model->wp.gasMass);
@@ -1178,7 +1277,7 @@ void Particle::UpdateVelocity(const SimulationFacet *collidedFacet) {
         double oldSpeed2 = pow(velocity, 2);
         double newSpeed2;
         if (model->wp.useMaxwellDistribution)
-            newSpeed2 = pow(Physics::GenerateRandomVelocity(model->tdParams.CDFs,collidedFacet->sh.CDFid,
+            newSpeed2 = pow(Physics::GenerateRandomVelocity(model->tdParams,collidedFacet->sh.CDFid,
                                                    randomGenerator.rnd()), 2);
         else newSpeed2 = /*145.469*/ 29369.939 * (collidedFacet->sh.temperature / model->wp.gasMass);
         //sqrt(29369)=171.3766= sqrt(8*R*1000/PI)*3PI/8, that is, the constant part of the v_avg=sqrt(8RT/PI/m/0.001)) found in literature, multiplied by
@@ -1209,7 +1308,7 @@ double Particle::GenerateDesorptionTime(const SimulationFacet *src, const double
 /**
 * \brief Increase facet counter on a hit, pass etc.
 * \param f source facet
-* \param time simulation time
+* \param momentSlots result slots to record into, see LookupMomentSlots
 * \param hit amount of hits to add
 * \param desorb amount of desorptions to add
 * \param absorb amount of absorptions to add
@@ -1217,22 +1316,13 @@ double Particle::GenerateDesorptionTime(const SimulationFacet *src, const double
 * \param sum_v_ort orthogonal momentum change to add
 */
 void
-Particle::IncreaseFacetCounter(const SimulationFacet *f, int m, size_t hit, size_t desorb,
+Particle::IncreaseFacetCounter(const SimulationFacet *f, const std::vector<int> &momentSlots, size_t hit, size_t desorb,
                                size_t absorb,
                                double sum_1_per_v, double sum_v_ort) {
     const double hitEquiv = static_cast<double>(hit) * oriRatio;
-    {
-        FacetHitBuffer &hits = tmpState.facetStates[f->globalId].momentResults[0].hits;
-        hits.nbMCHit += hit;
-        hits.nbHitEquiv += hitEquiv;
-        hits.nbDesorbed += desorb;
-        hits.nbAbsEquiv += static_cast<double>(absorb) * oriRatio;
-        hits.sum_1_per_ort_velocity += oriRatio * sum_1_per_v;
-        hits.sum_v_ort += oriRatio * sum_v_ort;
-        hits.sum_1_per_velocity += (hitEquiv + static_cast<double>(desorb)) / velocity;
-    }
-    if (m > 0) {
-        FacetHitBuffer &hits = tmpState.facetStates[f->globalId].momentResults[m].hits;
+    MarkDirty(f->globalId, momentSlots);
+    for (const int moment : momentSlots) {
+        FacetHitBuffer &hits = tmpState.facetStates[f->globalId].momentResults[moment].hits;
         hits.nbMCHit += hit;
         hits.nbHitEquiv += hitEquiv;
         hits.nbDesorbed += desorb;
@@ -1244,29 +1334,27 @@ Particle::IncreaseFacetCounter(const SimulationFacet *f, int m, size_t hit, size
 }
 
 void Particle::RegisterTransparentPass(SimulationFacet *facet) {
+    MF_PROFILE_SCOPE(profileCounters, ProfileEvent::TransparentPass);
     double directionFactor = std::abs(Dot(particle.direction, facet->sh.N));
 
-    int momentIndex = -1;
-    if ((momentIndex = LookupMomentIndex(particle.time +
-                                         tmpFacetVars[facet->globalId].colDistTranspPass / 100.0 / velocity, model->tdParams.moments, lastMomentIndex)) > 0) {
-        lastMomentIndex = momentIndex - 1;
-    }
+    const std::vector<int> &momentSlots = LookupMomentSlots(particle.time +
+                                                            tmpFacetVars[facet->globalId].colDistTranspPass / 100.0 / velocity);
 
-    IncreaseFacetCounter(facet, momentIndex, 1, 0, 0,
+    IncreaseFacetCounter(facet, momentSlots, 1, 0, 0,
                          2.0 / (velocity * directionFactor),
                          2.0 * (model->wp.useMaxwellDistribution ? 1.0 : 1.1781) * velocity *
                          directionFactor);
 
     tmpFacetVars[facet->globalId].isHit = true;
     if (/*facet->texture &&*/ facet->sh.countTrans) {
-        RecordHitOnTexture(facet, momentIndex,
+        RecordHitOnTexture(facet, momentSlots,
                            true, 2.0, 2.0);
     }
     if (/*facet->direction &&*/ facet->sh.countDirection) {
-        RecordDirectionVector(facet, momentIndex);
+        RecordDirectionVector(facet, momentSlots);
     }
     LogHit(facet);
-    ProfileFacet(facet, momentIndex,
+    ProfileFacet(facet, momentSlots,
                  true, 2.0, 2.0);
     if (facet->sh.anglemapParams.record) RecordAngleMap(facet);
 }
@@ -1280,7 +1368,6 @@ void Particle::Reset() {
     oriRatio = 0.0;
 
     nbBounces = 0;
-    lastMomentIndex = 0;
     //particleId = 0;
     distanceTraveled = 0;
     generationTime = 0;
@@ -1290,6 +1377,12 @@ void Particle::Reset() {
     expectedDecayMoment = 0.0;
 
     tmpState.Reset();
+    tmpCells.Reset();
+    tmpSparseCells.clear();
+    dirtyFacets.clear();
+    wavefront.Reset();
+    profileCounters.Reset();
+    syncScheduler.Reset();
     lastHitFacet = nullptr;
     particle.lastIntersected = -1;
     //randomGenerator.SetSeed(randomGenerator.GetSeed());
@@ -1309,7 +1402,13 @@ bool Particle::UpdateHits(GlobalSimuState *globState, ParticleLog *particleLog,
     if (particleLog) UpdateLog(particleLog, timeout);
 
     // At last delete tmpCache
-    if(lastHitUpdateOK) tmpState.Reset();
+    if(lastHitUpdateOK) {
+        tmpState.ResetDirty(dirtyFacets);
+        for (const auto &[facetId, moment] : dirtyFacets.GetEntries())
+            tmpCells.ResetFacetMoment(facetId, moment);
+        dirtyFacets.clear();
+        tmpSparseCells.clear();
+    }
 
     //ResetTmpCounters();
     // only reset buffers 1..N-1
@@ -23,6 +23,11 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 
 
 #include "MolflowSimGeom.h"
+#include "SparseFacetResults.h"
+#include "FacetResultArena.h"
+#include "WavefrontEngine.h"
+#include "ProfilingCounters.h"
+#include "SyncScheduler.h"
 #include "SimulationUnit.h"
 #include <Random.h>
 
@@ -32,6 +37,8 @@ struct SimulationFacetTempVar;
 * \brief Namespace containing various simulation only classes and methods
  */
 namespace MFSim {
+    class ResultMerger;
+    class AccelReoptimizer;
 
 /**
 * \brief Implements particle state and corresponding pre-/post-processing methods (source position, hit recording etc.)
@@ -48,26 +55,36 @@ namespace MFSim {
 
         bool StartFromSource();
 
+        void ResolveIntersection(bool found, SimulationFacet *&collidedFacet, double &d);
+
+        bool ProcessIntersection(bool found, SimulationFacet *collidedFacet, double d);
+
         bool UpdateMCHits(GlobalSimuState &globSimuState, size_t nbMoments, DWORD timeout);
 
-        void RecordHitOnTexture(const SimulationFacet *f, int m, bool countHit, double velocity_factor,
-                                double ortSpeedFactor);
+        void MergeGlobalCounters(GlobalSimuState &globSimuState);
+
+        void PrepareMerge();
+
+        void MergeFacetRange(GlobalSimuState &globSimuState, size_t facetBegin, size_t facetEnd) const;
 
-        void ProfileFacet(const SimulationFacet *f, int m, bool countHit, double velocity_factor,
-                          double ortSpeedFactor);
+        void RecordHitOnTexture(const SimulationFacet *f, const std::vector<int> &momentSlots, bool countHit,
+                                double velocity_factor, double ortSpeedFactor);
+
+        void ProfileFacet(const SimulationFacet *f, const std::vector<int> &momentSlots, bool countHit,
+                          double velocity_factor, double ortSpeedFactor);
 
         void RecordHit(const int &type);
 
         void RecordLeakPos();
 
-        void IncreaseFacetCounter(const SimulationFacet *f, int m, size_t hit, size_t desorb, size_t absorb,
-                                  double sum_1_per_v, double sum_v_ort);
+        void IncreaseFacetCounter(const SimulationFacet *f, const std::vector<int> &momentSlots, size_t hit,
+                                  size_t desorb, size_t absorb, double sum_1_per_v, double sum_v_ort);
 
         void UpdateVelocity(const SimulationFacet *collidedFacet);
 
         void LogHit(SimulationFacet *f);
 
-        void RecordDirectionVector(const SimulationFacet *f, int m);
+        void RecordDirectionVector(const SimulationFacet *f, const std::vector<int> &momentSlots);
 
         void RecordAngleMap(const SimulationFacet *collidedFacet);
 
@@ -79,7 +96,15 @@ namespace MFSim {
 
         void PerformBounce(SimulationFacet *iFacet);
 
-        void RecordHistograms(SimulationFacet *iFacet, int m);
+        void RecordHistograms(SimulationFacet *iFacet, const std::vector<int> &momentSlots);
+
+        void MarkDirty(size_t facetId, const std::vector<int> &momentSlots);
+
+        const std::vector<int> &LookupMomentSlots(double time);
+
+        TextureCell &GetTextureCell(size_t facetId, size_t m, size_t add);
+        ProfileSlice &GetProfileSlice(size_t facetId, size_t m, size_t pos);
+        DirectionCell &GetDirectionCell(size_t facetId, size_t m, size_t add);
 
         bool UpdateHits(GlobalSimuState *globState, ParticleLog *particleLog, size_t timeout);
         bool UpdateLog(ParticleLog *globalLog, size_t timeout);
@@ -92,7 +117,6 @@ namespace MFSim {
         //Recordings for histogram
         uint64_t totalDesorbed;
         size_t nbBounces; // Number of hit (current particle) since desorption
-        size_t lastMomentIndex; // Speedup for binary search
         size_t particleId;
         double distanceTraveled;
         double generationTime; //Time it was created, constant
@@ -102,13 +126,27 @@ namespace MFSim {
         double velocity;
         double expectedDecayMoment; //for radioactive gases
         //size_t structureId;        // Current structure
-        GlobalSimuState tmpState;
+        GlobalSimuState tmpState; // counters and histograms only, cells are in tmpCells or tmpSparseCells
+        FacetResultArena tmpCells; // texture, profile and direction cells unless model->sparseThreadResults
+        SparseFacetResults tmpSparseCells; // touched cells only, with model->sparseThreadResults
+        DirtyFacetTracker dirtyFacets; // results in tmpState and tmpCells written to since the last UpdateMCHits
+        std::vector<std::pair<size_t, size_t>> mergeOrder; // dirty (facet, moment) entries sorted by facet, see PrepareMerge
+        ResultMerger *merger{nullptr}; // merges with other threads of the simulation unit, sequential merge if null
+        AccelReoptimizer *reoptimizer{nullptr}; // swaps in ProbSplit trees during the run, trees stay unchanged if null
+        WavefrontEngine wavefront; // in-flight particles with model->wavefrontSize > 0
+        SyncScheduler syncScheduler; // number of steps between two merges into the global state
+        ProfileCounters profileCounters; // only written when built with USE_PROFILING_COUNTERS, collected on UpdateMCHits
+        std::vector<int> momentSlotBuffer; // result slots of the event being recorded, see LookupMomentSlots
         ParticleLog tmpParticleLog;
         SimulationFacet *lastHitFacet;     // Last hitted facet
         MersenneTwister randomGenerator;
         MolflowSimulationModel *model;
         std::vector<SimulationFacet*> transparentHitBuffer; //Storing this buffer simulation-wide is cheaper than recreating it at every Intersect() call
         std::vector <SimulationFacetTempVar> tmpFacetVars; //One per SimulationFacet, for intersect routine
+        std::vector<size_t> transparentPassStamp; //One per SimulationFacet, last intersection test that registered a transparent pass on it
+        size_t intersectionStamp{0}; // incremented on every intersection test with a hit, see ResolveIntersection
+        size_t hitBufferCapacity{0}; // largest capacity of the per-step hit buffers seen so far
+        size_t nbHitBufferGrowths{0}; // heap reallocations of the per-step hit buffers, stays constant once warmed up
 
         bool allQuit{false};
 
@@ -28,6 +28,16 @@ double Physics::GenerateRandomVelocity(const std::vector<std::vector<std::pair<d
     return v;
 }
 
+/**
+* \brief Samples a Maxwell-Boltzmann speed from the inverse speed distribution table of a temperature
+* Falls back to interpolating the CDF if no table has been built for it
+*/
+double Physics::GenerateRandomVelocity(const TimeDependentParamters &tdParams, int CDFId, const double rndVal) {
+    if (CDFId >= 0 && CDFId < (int) tdParams.velocityTables.size())
+        return tdParams.velocityTables[CDFId].Sample(rndVal);
+    return GenerateRandomVelocity(tdParams.CDFs, CDFId, rndVal);
+}
+
 double Physics::GenerateDesorptionTime(const std::vector<std::vector<std::pair<double, double>>> &IDs,
                                        const SimulationFacet *src, double rndVal, double latestMoment) {
     if (src->sh.outgassing_paramId >= 0) { //time-dependent desorption
@@ -38,6 +48,19 @@ double Physics::GenerateDesorptionTime(const std::vector<std::vector<std::pair<d
     }
 }
 
+/**
+* \brief Samples a desorption time from the guide table of the facet's integrated desorption
+* Falls back to interpolating the ID if no table has been built for it
+*/
+double Physics::GenerateDesorptionTime(const TimeDependentParamters &tdParams, const SimulationFacet *src,
+                                       const double rndVal, const double latestMoment) {
+    if (src->sh.outgassing_paramId >= 0 && src->sh.IDid >= 0 && src->sh.IDid < (int) tdParams.desorptionTimeTables.size()
+        && !tdParams.desorptionTimeTables[src->sh.IDid].empty()) {
+        return tdParams.desorptionTimeTables[src->sh.IDid].Sample(rndVal);
+    }
+    return GenerateDesorptionTime(tdParams.IDs, src, rndVal, latestMoment);
+}
+
 /**
 * \brief Updates particle direction and velocity if we are dealing with a moving facet (translated or rotated)
 */
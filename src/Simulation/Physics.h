@@ -30,8 +30,12 @@ public:
     static double
     GenerateDesorptionTime(const std::vector<std::vector<std::pair<double, double>>> &IDs,
                            const SimulationFacet *src, double rndVal, double latestMoment);
+    static double
+    GenerateDesorptionTime(const TimeDependentParamters &tdParams, const SimulationFacet *src, double rndVal,
+                           double latestMoment);
 
     static double GenerateRandomVelocity(const std::vector<std::vector<std::pair<double, double>>>& CDFs, int CDFId, double rndVal);
+    static double GenerateRandomVelocity(const TimeDependentParamters &tdParams, int CDFId, double rndVal);
 
     static void TreatMovingFacet(MolflowSimulationModel *model, const Vector3d &position, Vector3d &direction, double &velocity);
 };
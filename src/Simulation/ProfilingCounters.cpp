@@ -0,0 +1,190 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "ProfilingCounters.h"
+#include <fstream>
+#include <sstream>
+
+namespace MFSim {
+
+    namespace {
+        std::mutex totalsMutex;
+        std::vector<ProfileCounters> threadTotals; // indexed by thread (particle) id
+        uint64_t startTicks = ReadProfileTicks();
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+        void AppendEvents(std::ostringstream &out, const ProfileCounters &counters, double ticksPerSecond) {
+            out << "{";
+            for (size_t e = 0; e < NB_PROFILE_EVENTS; e++) {
+                const double seconds = ticksPerSecond > 0.0 ? (double) counters.ticks[e] / ticksPerSecond : 0.0;
+                out << (e ? ", " : "") << "\"" << GetProfileEventName(static_cast<ProfileEvent>(e)) << "\": {"
+                    << "\"count\": " << counters.counts[e] << ", "
+                    << "\"ticks\": " << counters.ticks[e] << ", "
+                    << "\"seconds\": " << seconds << "}";
+            }
+            out << "}";
+        }
+    }
+
+    const char *GetProfileEventName(ProfileEvent event) {
+        switch (event) {
+            case ProfileEvent::Intersect:
+                return "intersect";
+            case ProfileEvent::TransparentPass:
+                return "transparentPass";
+            case ProfileEvent::Bounce:
+                return "bounce";
+            case ProfileEvent::Absorb:
+                return "absorb";
+            case ProfileEvent::SourceGeneration:
+                return "sourceGeneration";
+            case ProfileEvent::TextureRecording:
+                return "textureRecording";
+            case ProfileEvent::ProfileRecording:
+                return "profileRecording";
+            case ProfileEvent::UpdateLockWait:
+                return "updateLockWait";
+            case ProfileEvent::ResultMerge:
+                return "resultMerge";
+            default:
+                return "unknown";
+        }
+    }
+
+    void ProfileCounters::Reset() {
+        ticks.fill(0);
+        counts.fill(0);
+    }
+
+    bool ProfileCounters::empty() const {
+        for (const auto count : counts) {
+            if (count) return false;
+        }
+        return true;
+    }
+
+    ProfileCounters &ProfileCounters::operator+=(const ProfileCounters &rhs) {
+        for (size_t e = 0; e < NB_PROFILE_EVENTS; e++) {
+            ticks[e] += rhs.ticks[e];
+            counts[e] += rhs.counts[e];
+        }
+        return *this;
+    }
+
+    /**
+    * \brief Moves the counters of one thread into the process wide totals
+    * \param threadId id of the thread (particle) the counters belong to
+    * \param threadCounters counters of the thread, reset afterwards
+    */
+    void Profiling::Collect(size_t threadId, ProfileCounters &threadCounters) {
+        if (threadCounters.empty())
+            return;
+        std::lock_guard<std::mutex> lock(totalsMutex);
+        if (threadTotals.size() <= threadId)
+            threadTotals.resize(threadId + 1);
+        threadTotals[threadId] += threadCounters;
+        threadCounters.Reset();
+    }
+
+    /**
+    * \brief Clears the totals and restarts the tick rate calibration
+    */
+    void Profiling::ResetTotals() {
+        std::lock_guard<std::mutex> lock(totalsMutex);
+        threadTotals.clear();
+        startTicks = ReadProfileTicks();
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    std::vector<ProfileCounters> Profiling::GetThreadTotals() {
+        std::lock_guard<std::mutex> lock(totalsMutex);
+        return threadTotals;
+    }
+
+    ProfileCounters Profiling::GetTotals() {
+        std::lock_guard<std::mutex> lock(totalsMutex);
+        ProfileCounters totals;
+        for (const auto &counters : threadTotals)
+            totals += counters;
+        return totals;
+    }
+
+    /**
+    * \brief Tick rate of ReadProfileTicks, the time stamp counter is calibrated against steady_clock since the last reset
+    * \return ticks per second, 0 if not measurable yet
+    */
+    double Profiling::GetTicksPerSecond() {
+#if defined(MF_PROFILE_RDTSC)
+        std::lock_guard<std::mutex> lock(totalsMutex);
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        if (elapsed < 1e-3)
+            return 0.0;
+        return (double) (ReadProfileTicks() - startTicks) / elapsed;
+#else
+        return (double) std::chrono::steady_clock::period::den / (double) std::chrono::steady_clock::period::num;
+#endif
+    }
+
+    /**
+    * \brief Human readable summary, one line per event with its count, total time and mean time
+    */
+    std::string Profiling::FormatSummary(const ProfileCounters &totals, double ticksPerSecond) {
+        std::ostringstream out;
+        out.precision(3);
+        for (size_t e = 0; e < NB_PROFILE_EVENTS; e++) {
+            if (!totals.counts[e])
+                continue;
+            const double seconds = ticksPerSecond > 0.0 ? (double) totals.ticks[e] / ticksPerSecond : 0.0;
+            out << "  " << GetProfileEventName(static_cast<ProfileEvent>(e)) << ": " << totals.counts[e]
+                << " events, " << seconds << " s, " << 1e9 * seconds / (double) totals.counts[e] << " ns/event\n";
+        }
+        return out.str();
+    }
+
+    std::string Profiling::ToJSON(const std::vector<ProfileCounters> &threadCounters, double ticksPerSecond) {
+        ProfileCounters totals;
+        for (const auto &counters : threadCounters)
+            totals += counters;
+
+        std::ostringstream out;
+        out.precision(9);
+        out << "{\n  \"ticksPerSecond\": " << ticksPerSecond << ",\n  \"total\": ";
+        AppendEvents(out, totals, ticksPerSecond);
+        out << ",\n  \"threads\": [";
+        for (size_t t = 0; t < threadCounters.size(); t++) {
+            out << (t ? ",\n    " : "\n    ");
+            AppendEvents(out, threadCounters[t], ticksPerSecond);
+        }
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+    /**
+    * \brief Writes the current totals, per thread and summed, to a JSON file
+    * \return true on success
+    */
+    bool Profiling::WriteJSON(const std::string &fileName) {
+        std::ofstream file(fileName);
+        if (!file)
+            return false;
+        file << ToJSON(GetThreadTotals(), GetTicksPerSecond());
+        return file.good();
+    }
+}
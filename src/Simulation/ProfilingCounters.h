@@ -0,0 +1,138 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_PROFILINGCOUNTERS_H
+#define MOLFLOW_PROJ_PROFILINGCOUNTERS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(USE_PROFILING_COUNTERS) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define MF_PROFILE_RDTSC
+#endif
+
+namespace MFSim {
+
+    //! Instrumented sections of the Monte Carlo loop, times are inclusive (a bounce contains its texture recording)
+    enum class ProfileEvent : size_t {
+        Intersect,
+        TransparentPass,
+        Bounce,
+        Absorb,
+        SourceGeneration,
+        TextureRecording,
+        ProfileRecording,
+        UpdateLockWait, // waiting for the global state, merge work excluded
+        ResultMerge, // merging thread results into the global state, including slices of other threads
+        NbEvents
+    };
+
+    constexpr size_t NB_PROFILE_EVENTS = static_cast<size_t>(ProfileEvent::NbEvents);
+
+    const char *GetProfileEventName(ProfileEvent event);
+
+    /**
+    * \brief Reads the cheapest monotonic tick source: the time stamp counter on x86, steady_clock otherwise
+    */
+    inline uint64_t ReadProfileTicks() {
+#if defined(MF_PROFILE_RDTSC)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    /**
+    * \brief Tick and event counts of one thread, written without synchronisation
+    */
+    struct ProfileCounters {
+        std::array<uint64_t, NB_PROFILE_EVENTS> ticks{};
+        std::array<uint64_t, NB_PROFILE_EVENTS> counts{};
+
+        void Add(ProfileEvent event, uint64_t nbTicks, uint64_t nbEvents = 1) {
+            ticks[static_cast<size_t>(event)] += nbTicks;
+            counts[static_cast<size_t>(event)] += nbEvents;
+        };
+        void Reset();
+        [[nodiscard]] bool empty() const;
+        ProfileCounters &operator+=(const ProfileCounters &rhs);
+    };
+
+    /**
+    * \brief Adds the ticks spent in its scope to one event of a counter set
+    */
+    class ProfileScope {
+    public:
+        ProfileScope(ProfileCounters &counters, ProfileEvent event, uint64_t nbEvents = 1)
+                : counters(counters), event(event), nbEvents(nbEvents), start(ReadProfileTicks()) {};
+        ~ProfileScope() { counters.Add(event, ReadProfileTicks() - start, nbEvents); };
+        ProfileScope(const ProfileScope &) = delete;
+        ProfileScope &operator=(const ProfileScope &) = delete;
+    private:
+        ProfileCounters &counters;
+        ProfileEvent event;
+        uint64_t nbEvents;
+        uint64_t start;
+    };
+
+    /**
+    * \brief Process wide totals of the per-thread counters, collected on every hit update
+    */
+    namespace Profiling {
+#if defined(USE_PROFILING_COUNTERS)
+        constexpr bool enabled = true;
+#else
+        constexpr bool enabled = false;
+#endif
+
+        void Collect(size_t threadId, ProfileCounters &threadCounters);
+        void ResetTotals();
+        std::vector<ProfileCounters> GetThreadTotals();
+        ProfileCounters GetTotals();
+        double GetTicksPerSecond();
+
+        std::string FormatSummary(const ProfileCounters &totals, double ticksPerSecond);
+        std::string ToJSON(const std::vector<ProfileCounters> &threadTotals, double ticksPerSecond);
+        bool WriteJSON(const std::string &fileName);
+    }
+}
+
+// Hot path hooks, compiled out unless built with USE_PROFILING_COUNTERS
+#if defined(USE_PROFILING_COUNTERS)
+#define MF_PROFILE_CONCAT_IMPL(a, b) a##b
+#define MF_PROFILE_CONCAT(a, b) MF_PROFILE_CONCAT_IMPL(a, b)
+#define MF_PROFILE_SCOPE(counters, event) MFSim::ProfileScope MF_PROFILE_CONCAT(profileScope, __LINE__)(counters, event)
+#define MF_PROFILE_SCOPE_N(counters, event, n) MFSim::ProfileScope MF_PROFILE_CONCAT(profileScope, __LINE__)(counters, event, n)
+#else
+#define MF_PROFILE_SCOPE(counters, event)
+#define MF_PROFILE_SCOPE_N(counters, event, n)
+#endif
+
+#endif //MOLFLOW_PROJ_PROFILINGCOUNTERS_H
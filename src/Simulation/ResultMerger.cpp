@@ -0,0 +1,186 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "ResultMerger.h"
+#include "Particle.h"
+#include <algorithm>
+
+// Slices per merged thread, more slices balance uneven facet loads better
+static constexpr size_t slicesPerThread = 4;
+// Polling interval of threads waiting for their request to be merged
+static constexpr std::chrono::microseconds waitInterval{100};
+
+namespace MFSim {
+
+    /**
+    * \brief Sets the number of threads that can merge, must not be called during a merge
+    */
+    void ResultMerger::Resize(size_t nbThreads) {
+        slots = std::make_unique<Slot[]>(nbThreads);
+        nbSlots = nbThreads;
+        batch.clear();
+        batch.reserve(nbThreads);
+        batchOpen = false;
+        nbBatches = 0;
+        nbMerged = 0;
+    }
+
+    /**
+    * \brief Merges the thread results of a particle into the global state, possibly together with other threads
+    * \param particle particle with prepared results (Particle::PrepareMerge), owned by the calling thread
+    * \param globState global state, locked only by the combining thread
+    * \param timeout time after which a request that has not been claimed yet is withdrawn
+    * Merge work done by the calling thread, also for other requests, is profiled as ProfileEvent::ResultMerge
+    * \return true if the results have been merged
+    */
+    bool ResultMerger::Merge(Particle &particle, GlobalSimuState &globState, std::chrono::milliseconds timeout) {
+        if (particle.particleId >= nbSlots)
+            return false;
+        Slot &slot = slots[particle.particleId];
+        slot.particle = &particle;
+        slot.state.store(Pending, std::memory_order_release);
+
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true) {
+            const int state = slot.state.load(std::memory_order_acquire);
+            if (state == Done)
+                return Finish(slot);
+            if (state == Pending && globState.tMutex.try_lock()) {
+                // Requests are only claimed with the lock held, so here it is either still pending or done
+                if (slot.state.load(std::memory_order_acquire) != Done)
+                    Combine(globState, particle.profileCounters);
+                globState.tMutex.unlock();
+                return Finish(slot);
+            }
+            if (state == Pending && std::chrono::steady_clock::now() >= deadline) {
+                int expected = Pending;
+                if (slot.state.compare_exchange_strong(expected, Idle, std::memory_order_acq_rel)) {
+                    slot.particle = nullptr;
+                    return false;
+                }
+                continue; // claimed in the meantime
+            }
+            // Help the running batch instead of only waiting for the lock
+            if (!MergeNextSlice(particle.profileCounters)) {
+                std::unique_lock<std::mutex> lock(batchMutex);
+                batchCondition.wait_for(lock, waitInterval);
+            }
+        }
+    }
+
+    bool ResultMerger::Finish(Slot &slot) {
+        slot.particle = nullptr;
+        slot.state.store(Idle, std::memory_order_release);
+        return true;
+    }
+
+    /**
+    * \brief Merges all pending requests, the global state has to be locked by the caller
+    * \param counters profiling counters of the calling thread
+    */
+    void ResultMerger::Combine(GlobalSimuState &globState, ProfileCounters &counters) {
+        std::vector<size_t> claimed;
+        claimed.reserve(nbSlots);
+        {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            batch.clear();
+            for (size_t i = 0; i < nbSlots; i++) {
+                int expected = Pending;
+                if (slots[i].state.compare_exchange_strong(expected, Claimed, std::memory_order_acq_rel)) {
+                    claimed.push_back(i);
+                    batch.push_back(slots[i].particle);
+                }
+            }
+        }
+
+        // Global counters and caches are small, they are added in thread order
+        {
+            MF_PROFILE_SCOPE(counters, ProfileEvent::ResultMerge);
+            for (auto *p : batch)
+                p->MergeGlobalCounters(globState);
+        }
+
+        const size_t nbFacets = globState.facetStates.size();
+        {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            batchState = &globState;
+            nbSlices = std::min(nbFacets, slicesPerThread * batch.size());
+            nextSlice = 0;
+            nbSlicesDone = 0;
+            batchOpen = nbSlices > 0;
+        }
+        batchCondition.notify_all();
+
+        while (MergeNextSlice(counters)) {
+            // the combining thread merges slices as well
+        }
+        {
+            std::unique_lock<std::mutex> lock(batchMutex);
+            batchCondition.wait(lock, [this] { return nbSlicesDone == nbSlices; });
+            batchOpen = false;
+            batchState = nullptr;
+        }
+
+        globState.stateChanged = true;
+        nbBatches++;
+        nbMerged += claimed.size();
+        for (const size_t i : claimed)
+            slots[i].state.store(Done, std::memory_order_release);
+        batchCondition.notify_all();
+    }
+
+    /**
+    * \brief Merges the next unprocessed facet slice of the running batch for all of its requests
+    * \param counters profiling counters of the calling thread
+    * \return false if no batch is running or all of its slices are taken
+    */
+    bool ResultMerger::MergeNextSlice(ProfileCounters &counters) {
+        size_t slice;
+        size_t sliceCount;
+        GlobalSimuState *globState;
+        {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            if (!batchOpen || nextSlice >= nbSlices)
+                return false;
+            slice = nextSlice++;
+            sliceCount = nbSlices;
+            globState = batchState;
+        }
+
+        // The batch stays unchanged until all slices are done
+        {
+            MF_PROFILE_SCOPE(counters, ProfileEvent::ResultMerge);
+            const size_t nbFacets = globState->facetStates.size();
+            const size_t facetBegin = slice * nbFacets / sliceCount;
+            const size_t facetEnd = (slice + 1) * nbFacets / sliceCount;
+            for (auto *p : batch)
+                p->MergeFacetRange(*globState, facetBegin, facetEnd);
+        }
+
+        bool lastSlice;
+        {
+            std::lock_guard<std::mutex> lock(batchMutex);
+            lastSlice = ++nbSlicesDone == nbSlices;
+        }
+        if (lastSlice)
+            batchCondition.notify_all();
+        return true;
+    }
+}
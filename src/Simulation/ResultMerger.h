@@ -0,0 +1,94 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_RESULTMERGER_H
+#define MOLFLOW_PROJ_RESULTMERGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ProfilingCounters.h"
+
+class GlobalSimuState;
+
+namespace MFSim {
+    class Particle;
+
+    /**
+    * \brief Merges the results of several threads into the global state at once, in parallel over facet slices
+    * A thread that wants to merge registers its request and tries to lock the global state. The thread that gets
+    * the lock claims all pending requests, adds their global counters, then splits the facets into slices. All
+    * claimed threads, which would otherwise wait for the lock, merge the dirty results of every request for one
+    * slice at a time. Slices are disjoint, and readers of the global state still only see complete merges.
+     */
+    class ResultMerger {
+    public:
+        ResultMerger() = default;
+        ResultMerger(const ResultMerger &) = delete;
+        ResultMerger &operator=(const ResultMerger &) = delete;
+
+        void Resize(size_t nbThreads);
+        bool Merge(Particle &particle, GlobalSimuState &globState, std::chrono::milliseconds timeout);
+
+        [[nodiscard]] size_t GetNbThreads() const { return nbSlots; };
+        [[nodiscard]] uint64_t GetNbBatches() const { return nbBatches; };
+        [[nodiscard]] uint64_t GetNbMerged() const { return nbMerged; };
+
+    private:
+        enum SlotState : int {
+            Idle, // no request
+            Pending, // waiting to be claimed by a combining thread
+            Claimed, // part of the running batch
+            Done // merged, the owner resets it to Idle
+        };
+
+        struct Slot {
+            std::atomic<int> state{Idle};
+            Particle *particle{nullptr};
+        };
+
+        void Combine(GlobalSimuState &globState, ProfileCounters &counters);
+        bool MergeNextSlice(ProfileCounters &counters);
+        bool Finish(Slot &slot);
+
+        std::unique_ptr<Slot[]> slots;
+        size_t nbSlots{0};
+
+        // Running batch, guarded by batchMutex
+        std::mutex batchMutex;
+        std::condition_variable batchCondition;
+        std::vector<Particle *> batch;
+        GlobalSimuState *batchState{nullptr};
+        size_t nbSlices{0};
+        size_t nextSlice{0};
+        size_t nbSlicesDone{0};
+        bool batchOpen{false};
+
+        std::atomic<uint64_t> nbBatches{0};
+        std::atomic<uint64_t> nbMerged{0};
+    };
+}
+
+#endif //MOLFLOW_PROJ_RESULTMERGER_H
@@ -48,10 +48,13 @@ Simulation::Simulation(Simulation&& o) noexcept : tMutex() {
     model = o.model;
 
     particles = o.particles;
+    merger.Resize(particles.size());
     for(auto& particle : particles) {
         particle.lastHitFacet = nullptr;
         particle.particle.lastIntersected = -1;
         particle.model = (MolflowSimulationModel*) model.get();
+        particle.merger = &merger;
+        particle.reoptimizer = &reoptimizer;
     }
 
     hasVolatile =  o.hasVolatile;
@@ -178,7 +181,11 @@ void Simulation::ClearSimulation() {
     //std::vector<CurrentParticleStatus>(this->nbThreads).swap(this->currentParticles);
     for(auto& particle : particles) {
         particle.tmpFacetVars.assign(model->sh.nbFacet, SimulationFacetTempVar());
+        particle.transparentPassStamp.assign(model->sh.nbFacet, 0);
         particle.tmpState.Reset();
+        particle.tmpCells.Reset();
+        particle.tmpSparseCells.clear();
+        particle.dirtyFacets.clear();
         particle.model = (MolflowSimulationModel*) model.get();
         particle.totalDesorbed = 0;
 
@@ -226,14 +233,39 @@ size_t Simulation::LoadSimulation(char *loadStatus) {
     
     auto* simModel = (MolflowSimulationModel*) model.get();
 
+    // Dense thread cells grow with the moments of every textured facet, threads fall back to touched cells only
+    // when all their copies would exceed the budget
+    if (!simModel->sparseThreadResults && simModel->denseThreadResultsBudget > 0) {
+        const size_t denseSize = FacetResultArena::GetDenseSize(*simModel) * particles.size();
+        if (denseSize > simModel->denseThreadResultsBudget) {
+            Log::console_msg_master(2, "Dense thread results would take {} bytes, using sparse thread results\n", denseSize);
+            simModel->sparseThreadResults = true;
+        }
+    }
+
     // New GlobalSimuState structure for threads
+    merger.Resize(particles.size());
     for(auto& particle : particles)
     {
+        particle.merger = &merger;
+        particle.reoptimizer = &reoptimizer;
         auto& tmpResults = particle.tmpState;
-        tmpResults.Resize(model);
+        tmpResults.Resize(model, false);
+        if (simModel->sparseThreadResults)
+            particle.tmpCells.clear();
+        else
+            particle.tmpCells.Resize(*simModel);
+        particle.tmpSparseCells.clear();
+        particle.dirtyFacets.Resize(simModel->sh.nbFacet, simModel->tdParams.moments.size());
+        particle.wavefront.Resize(simModel->wavefrontSize);
+        SyncScheduler::Params syncParams;
+        syncParams.maxInterval = simModel->syncMaxLatency;
+        particle.syncScheduler.SetParams(syncParams);
+        particle.syncScheduler.Reset();
 
         // Init tmp vars per thread
         particle.tmpFacetVars.assign(simModel->sh.nbFacet, SimulationFacetTempVar());
+        particle.transparentPassStamp.assign(simModel->sh.nbFacet, 0);
 
         //currentParticle.tmpState = *tmpResults;
         //delete tmpResults;
@@ -244,6 +276,7 @@ size_t Simulation::LoadSimulation(char *loadStatus) {
 
     // Build ADS
     RebuildAccelStructure();
+    reoptimizer.Reset(*simModel, particles.size());
 
     // Initialise simulation
 
@@ -264,6 +297,18 @@ size_t Simulation::LoadSimulation(char *loadStatus) {
     printf("  Direction : %zd bytes\n", dirTotalSize);*/
 
     Log::console_msg_master(3, "  Total     : {} bytes\n", GetHitsSize());
+    if (simModel->sparseThreadResults)
+        Log::console_msg_master(3, "  Thread results: sparse texture/profile/direction cells\n");
+    else if (!particles.empty())
+        Log::console_msg_master(3, "  Thread results: {} bytes of contiguous cells per thread\n", particles.front().tmpCells.GetMemSize());
+    if (simModel->wavefrontSize > 0)
+        Log::console_msg_master(3, "  Wavefront engine: {} particles in flight per thread\n", simModel->wavefrontSize);
+    if (simModel->syncMaxLatency > 0.0)
+        Log::console_msg_master(3, "  Result sync: adaptive, at most {} s between merges\n", simModel->syncMaxLatency);
+    if (reoptimizer.GetPhase() == MFSim::AccelReoptimizer::WarmUp)
+        Log::console_msg_master(3, "  ProbSplit re-optimization after {} s of tracing\n", simModel->accelReoptimizeTime);
+    if (simModel->wp.useMaxwellDistribution)
+        Log::console_msg_master(3, "  Velocity tables: {} for {} bins\n", simModel->tdParams.velocityTables.size(), simModel->velocityTableSize);
     for(auto& particle : particles)
         Log::console_msg_master(5, "  Seed for {}: {}\n", particle.particleId, particle.randomGenerator.GetSeed());
     Log::console_msg_master(3, "  Loading time: {:.2f} ms\n", timer.ElapsedMs());
@@ -286,6 +331,7 @@ void Simulation::ResetSimulation() {
     for(auto& particle : particles) {
         particle.Reset();
         particle.tmpFacetVars.assign(model->sh.nbFacet, SimulationFacetTempVar());
+        particle.transparentPassStamp.assign(model->sh.nbFacet, 0);
         particle.model = (MolflowSimulationModel*) model.get();
         particle.totalDesorbed = 0;
 
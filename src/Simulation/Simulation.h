@@ -32,6 +32,8 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 #include "SimulationController.h"
 #include "MolflowSimGeom.h"
 #include "Particle.h"
+#include "ResultMerger.h"
+#include "AccelReoptimizer.h"
 #include "RayTracing/RTHelper.h"
 
 class Parameter;
@@ -70,6 +72,8 @@ public:
     // Particle coordinates (MC)//std::vector<FacetHistogramBuffer> tmpGlobalHistograms; //Recorded histogram since last UpdateMCHits, 1+nbMoment copies
     //ParticleLog tmpParticleLog; //Recorded particle log since last UpdateMCHits
     std::vector<MFSim::Particle> particles;
+    MFSim::ResultMerger merger; // parallel merge of the particles' results into globState
+    MFSim::AccelReoptimizer reoptimizer; // ProbSplit rebuild of the trees during the run
     mutable std::timed_mutex tMutex;
 
 };
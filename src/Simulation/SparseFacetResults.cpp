@@ -0,0 +1,112 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+
+#include "SparseFacetResults.h"
+#include <algorithm>
+#include <functional>
+
+namespace {
+    template<typename Table, typename Order>
+    void SortByFacet(const Table &cells, Order &order) {
+        order.clear();
+        order.reserve(cells.size());
+        for (const auto &entry : cells.GetEntries())
+            order.push_back(&entry);
+        std::sort(order.begin(), order.end(), [](const auto *lhs, const auto *rhs) {
+            return lhs->key.facetId < rhs->key.facetId;
+        });
+    }
+
+    //! Calls add(key, cell) for the cells of facets in [facetBegin, facetEnd[ of a sorted order
+    template<typename Order, typename Add>
+    void ForFacetRange(const Order &order, size_t facetBegin, size_t facetEnd, Add add) {
+        auto entry = std::lower_bound(order.begin(), order.end(), facetBegin, [](const auto *e, size_t facetId) {
+            return e->key.facetId < facetId;
+        });
+        for (; entry != order.end() && (*entry)->key.facetId < facetEnd; ++entry)
+            add((*entry)->key, (*entry)->value);
+    }
+}
+
+size_t SparseFacetResults::CellKeyHash::operator()(const CellKey &key) const noexcept {
+    // Boost style hash combine
+    size_t seed = std::hash<size_t>{}(key.facetId);
+    seed ^= std::hash<size_t>{}(key.moment) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+    seed ^= std::hash<size_t>{}(key.cell) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+/**
+* \brief Adds all touched cells to a dense result structure
+* \param facetStates dense facet results, e.g. from the global simulation state
+*/
+void SparseFacetResults::MergeInto(std::vector<FacetState> &facetStates) const {
+    for (const auto &[key, cell] : texture.GetEntries())
+        facetStates[key.facetId].momentResults[key.moment].texture[key.cell] += cell;
+    for (const auto &[key, slice] : profile.GetEntries())
+        facetStates[key.facetId].momentResults[key.moment].profile[key.cell] += slice;
+    for (const auto &[key, cell] : direction.GetEntries())
+        facetStates[key.facetId].momentResults[key.moment].direction[key.cell] += cell;
+}
+
+/**
+* \brief Sorts the touched cells by facet once per merge, so that each facet range only visits its own cells
+*/
+void SparseFacetResults::PrepareMerge() {
+    SortByFacet(texture, textureOrder);
+    SortByFacet(profile, profileOrder);
+    SortByFacet(direction, directionOrder);
+}
+
+/**
+* \brief Adds only the cells of facets in [facetBegin, facetEnd[, used to merge disjoint facet ranges in parallel
+* PrepareMerge has to be called after the last recorded cell
+*/
+void SparseFacetResults::MergeInto(std::vector<FacetState> &facetStates, size_t facetBegin, size_t facetEnd) const {
+    ForFacetRange(textureOrder, facetBegin, facetEnd, [&facetStates](const CellKey &key, const TextureCell &cell) {
+        facetStates[key.facetId].momentResults[key.moment].texture[key.cell] += cell;
+    });
+    ForFacetRange(profileOrder, facetBegin, facetEnd, [&facetStates](const CellKey &key, const ProfileSlice &slice) {
+        facetStates[key.facetId].momentResults[key.moment].profile[key.cell] += slice;
+    });
+    ForFacetRange(directionOrder, facetBegin, facetEnd, [&facetStates](const CellKey &key, const DirectionCell &cell) {
+        facetStates[key.facetId].momentResults[key.moment].direction[key.cell] += cell;
+    });
+}
+
+/**
+* \brief Drops all cells, the tables keep room for as many cells as in this period
+*/
+void SparseFacetResults::clear() {
+    texture.clear();
+    profile.clear();
+    direction.clear();
+    textureOrder.clear();
+    profileOrder.clear();
+    directionOrder.clear();
+}
+
+size_t SparseFacetResults::GetMemSize() const {
+    size_t sum = sizeof(SparseFacetResults);
+    sum += texture.GetMemSize() + profile.GetMemSize() + direction.GetMemSize();
+    sum += (textureOrder.capacity() + profileOrder.capacity() + directionOrder.capacity()) * sizeof(void *);
+    return sum;
+}
@@ -0,0 +1,164 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+
+#ifndef MOLFLOW_PROJ_SPARSEFACETRESULTS_H
+#define MOLFLOW_PROJ_SPARSEFACETRESULTS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "MolflowSimGeom.h"
+
+/**
+* \brief Per-thread buffer for texture, profile and direction cells, only holding cells touched since the last merge
+* Used instead of the dense per-thread copies in GlobalSimuState, memory and merge cost scale with the number of touched cells
+ */
+class SparseFacetResults {
+public:
+    //! Identifies one cell of one facet for one moment (0 = constant flow)
+    struct CellKey {
+        size_t facetId;
+        size_t moment;
+        size_t cell;
+
+        bool operator==(const CellKey &rhs) const {
+            return facetId == rhs.facetId && moment == rhs.moment && cell == rhs.cell;
+        }
+    };
+
+    struct CellKeyHash {
+        size_t operator()(const CellKey &key) const noexcept;
+    };
+
+    /**
+    * \brief Open addressing (linear probing) map from cell keys to cells, stored densely in order of first touch
+    * Replaces one heap node per touched cell. clear() keeps room for as many cells as were recorded since the
+    * previous clear, so that a sync interval touching a similar number of cells records without rehashing.
+     */
+    template<typename T>
+    class CellTable {
+    public:
+        struct Entry {
+            CellKey key;
+            T value;
+        };
+
+        T &operator[](const CellKey &key) {
+            if (2 * (entries.size() + 1) > slots.size())
+                Rehash(slots.empty() ? minSlots : 2 * slots.size());
+            size_t slot = SlotOf(key);
+            while (slots[slot]) {
+                Entry &entry = entries[slots[slot] - 1];
+                if (entry.key == key)
+                    return entry.value;
+                slot = (slot + 1) & (slots.size() - 1);
+            }
+            entries.push_back(Entry{key, T()});
+            slots[slot] = static_cast<uint32_t>(entries.size());
+            return entries.back().value;
+        };
+
+        void clear() {
+            size_t nbSlots = minSlots;
+            while (nbSlots < 2 * entries.size())
+                nbSlots *= 2;
+            const size_t nbCells = entries.size();
+            entries.clear();
+            if (slots.size() < nbSlots || slots.size() > 4 * nbSlots) {
+                slots.assign(nbSlots, 0);
+                shift = 64 - Log2(nbSlots);
+            }
+            else {
+                std::fill(slots.begin(), slots.end(), 0);
+            }
+            entries.reserve(nbCells);
+        };
+
+        [[nodiscard]] const std::vector<Entry> &GetEntries() const { return entries; };
+        [[nodiscard]] size_t size() const { return entries.size(); };
+        [[nodiscard]] bool empty() const { return entries.empty(); };
+        [[nodiscard]] size_t GetMemSize() const {
+            return entries.capacity() * sizeof(Entry) + slots.capacity() * sizeof(uint32_t);
+        };
+
+    private:
+        static constexpr size_t minSlots = 64;
+
+        static size_t Log2(size_t n) {
+            size_t log = 0;
+            while ((size_t(1) << log) < n)
+                log++;
+            return log;
+        };
+
+        //! Fibonacci hashing spreads keys of neighbouring cells over the table
+        [[nodiscard]] size_t SlotOf(const CellKey &key) const {
+            return static_cast<size_t>((static_cast<uint64_t>(CellKeyHash{}(key)) * 0x9e3779b97f4a7c15ULL) >> shift);
+        };
+
+        void Rehash(size_t nbSlots) {
+            slots.assign(nbSlots, 0);
+            shift = 64 - Log2(nbSlots);
+            for (size_t i = 0; i < entries.size(); i++) {
+                size_t slot = SlotOf(entries[i].key);
+                while (slots[slot])
+                    slot = (slot + 1) & (slots.size() - 1);
+                slots[slot] = static_cast<uint32_t>(i + 1);
+            }
+        };
+
+        std::vector<Entry> entries;
+        std::vector<uint32_t> slots; // 1 + index in entries, 0 for a free slot, power of 2 size
+        size_t shift{64}; // 64 - log2(slots.size())
+    };
+
+    TextureCell &Texture(size_t facetId, size_t moment, size_t cell) {
+        return texture[CellKey{facetId, moment, cell}];
+    };
+    ProfileSlice &Profile(size_t facetId, size_t moment, size_t cell) {
+        return profile[CellKey{facetId, moment, cell}];
+    };
+    DirectionCell &Direction(size_t facetId, size_t moment, size_t cell) {
+        return direction[CellKey{facetId, moment, cell}];
+    };
+
+    void MergeInto(std::vector<FacetState> &facetStates) const;
+    void PrepareMerge();
+    void MergeInto(std::vector<FacetState> &facetStates, size_t facetBegin, size_t facetEnd) const;
+    void clear();
+
+    [[nodiscard]] bool empty() const { return texture.empty() && profile.empty() && direction.empty(); };
+    [[nodiscard]] size_t GetNbCells() const { return texture.size() + profile.size() + direction.size(); };
+    [[nodiscard]] size_t GetMemSize() const;
+
+private:
+    CellTable<TextureCell> texture;
+    CellTable<ProfileSlice> profile;
+    CellTable<DirectionCell> direction;
+
+    // Cells sorted by facet, see PrepareMerge
+    std::vector<const CellTable<TextureCell>::Entry *> textureOrder;
+    std::vector<const CellTable<ProfileSlice>::Entry *> profileOrder;
+    std::vector<const CellTable<DirectionCell>::Entry *> directionOrder;
+};
+
+#endif //MOLFLOW_PROJ_SPARSEFACETRESULTS_H
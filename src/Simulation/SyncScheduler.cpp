@@ -0,0 +1,106 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "SyncScheduler.h"
+#include <algorithm>
+#include <cmath>
+
+// Weight of a new sample in the moving averages
+static constexpr double smoothingFactor = 0.25;
+
+double SyncScheduler::Smooth(double average, double sample, bool first) {
+    return first ? sample : average + smoothingFactor * (sample - average);
+}
+
+/**
+* \brief Forgets all measurements, e.g. when a new model is loaded
+*/
+void SyncScheduler::Reset() {
+    stepRate = 0.0;
+    syncCost = 0.0;
+    dirtyGrowth = 0.0;
+    hasSteps = false;
+    hasMerges = false;
+    lastMerge = std::chrono::steady_clock::now();
+}
+
+/**
+* \brief Records the duration of a simulation call
+* \param nbSteps steps (bounces) performed
+* \param seconds time it took
+*/
+void SyncScheduler::RecordSteps(size_t nbSteps, double seconds) {
+    if (nbSteps == 0 || seconds <= 0.0)
+        return;
+    stepRate = Smooth(stepRate, (double) nbSteps / seconds, !hasSteps);
+    hasSteps = true;
+}
+
+/**
+* \brief Records a merge into the global state, the time since the previous merge is measured
+* \param lockWait seconds spent waiting for the global state lock
+* \param mergeTime seconds spent merging while holding the lock
+* \param dirtyBytes size of the private results that were merged
+*/
+void SyncScheduler::RecordMerge(double lockWait, double mergeTime, size_t dirtyBytes) {
+    const auto now = std::chrono::steady_clock::now();
+    const double sinceLastMerge = std::chrono::duration<double>(now - lastMerge).count();
+    lastMerge = now;
+    RecordMerge(lockWait, mergeTime, dirtyBytes, sinceLastMerge);
+}
+
+/**
+* \brief Records a merge into the global state
+* \param sinceLastMerge seconds since the previous merge, during which the private results grew to dirtyBytes
+*/
+void SyncScheduler::RecordMerge(double lockWait, double mergeTime, size_t dirtyBytes, double sinceLastMerge) {
+    syncCost = Smooth(syncCost, std::max(0.0, lockWait) + std::max(0.0, mergeTime), !hasMerges);
+    if (sinceLastMerge > 0.0)
+        dirtyGrowth = Smooth(dirtyGrowth, (double) dirtyBytes / sinceLastMerge, !hasMerges);
+    hasMerges = true;
+}
+
+/**
+* \brief Time to simulate until the next merge
+* \return interval in seconds, within [minInterval, maxInterval]
+*/
+double SyncScheduler::GetInterval() const {
+    const double minInterval = std::min(params.minInterval, params.maxInterval);
+    if (!hasMerges)
+        return minInterval;
+
+    // Long enough for the merge cost to stay below the overhead target
+    double interval = params.targetOverhead > 0.0 ? syncCost / params.targetOverhead : params.maxInterval;
+    // Short enough for the private results to stay within the budget
+    if (dirtyGrowth > 0.0)
+        interval = std::min(interval, (double) params.dirtyBudget / dirtyGrowth);
+    return std::clamp(interval, minInterval, params.maxInterval);
+}
+
+/**
+* \brief Number of steps to perform before the next merge
+* \param requestedSteps steps requested by the caller, used until the step rate is known or if disabled
+*/
+size_t SyncScheduler::GetStepCount(size_t requestedSteps) const {
+    if (!IsEnabled() || !hasSteps)
+        return requestedSteps;
+    const double steps = std::ceil(stepRate * GetInterval());
+    return std::max<size_t>(1, static_cast<size_t>(std::min(steps, 1e15)));
+}
@@ -0,0 +1,66 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_SYNCSCHEDULER_H
+#define MOLFLOW_PROJ_SYNCSCHEDULER_H
+
+#include <chrono>
+#include <cstddef>
+
+/**
+* \brief Picks how long a thread simulates before merging its results into the global state
+* The interval is the shortest one that keeps the measured merge cost (lock wait + merge) below a fraction of the
+* simulation time, shortened when the private results grow beyond a memory budget and bounded by a maximum latency
+ */
+class SyncScheduler {
+public:
+    //! Limits for the merge interval, in seconds and bytes
+    struct Params {
+        double minInterval{0.05}; // shortest interval, avoids syncing on every call for tiny models
+        double maxInterval{1.0}; // update latency bound, 0 disables the scheduler
+        double targetOverhead{0.02}; // tolerated share of time spent waiting for and merging into the global state
+        size_t dirtyBudget{64 * 1024 * 1024}; // private results allowed to pile up between two merges
+    };
+
+    void SetParams(const Params &newParams) { params = newParams; };
+    [[nodiscard]] const Params &GetParams() const { return params; };
+    [[nodiscard]] bool IsEnabled() const { return params.maxInterval > 0.0; };
+    void Reset();
+
+    void RecordSteps(size_t nbSteps, double seconds);
+    void RecordMerge(double lockWait, double mergeTime, size_t dirtyBytes);
+    void RecordMerge(double lockWait, double mergeTime, size_t dirtyBytes, double sinceLastMerge);
+
+    [[nodiscard]] double GetInterval() const;
+    [[nodiscard]] size_t GetStepCount(size_t requestedSteps) const;
+
+private:
+    static double Smooth(double average, double sample, bool first);
+
+    Params params;
+    double stepRate{0.0}; // steps per second, smoothed
+    double syncCost{0.0}; // seconds per merge, lock wait included, smoothed
+    double dirtyGrowth{0.0}; // private result bytes per second, smoothed
+    bool hasSteps{false};
+    bool hasMerges{false};
+    std::chrono::steady_clock::time_point lastMerge{std::chrono::steady_clock::now()};
+};
+
+#endif //MOLFLOW_PROJ_SYNCSCHEDULER_H
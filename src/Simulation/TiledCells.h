@@ -0,0 +1,201 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_TILEDCELLS_H
+#define MOLFLOW_PROJ_TILEDCELLS_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+/**
+* \brief Dense cell array (texture or direction) whose storage is split into fixed size tiles allocated on first write
+* Reads of cells in untouched tiles return a zero cell, so the read API is the one of a std::vector. Memory scales with
+* the area that has been hit, which matters for time-dependent runs where most moments only see a few cells.
+* Serialized as a dense std::vector, so files stay compatible.
+*/
+template<typename T>
+class TiledCells {
+public:
+    static constexpr size_t tileSize = 256; // cells per tile
+
+    TiledCells() = default;
+    TiledCells(const TiledCells &src) { *this = src; };
+    TiledCells(TiledCells &&src) noexcept = default;
+    TiledCells &operator=(TiledCells &&src) noexcept = default;
+
+    TiledCells &operator=(const TiledCells &src) {
+        if (this == &src)
+            return *this;
+        nbCells = src.nbCells;
+        tiles.clear();
+        tiles.resize(src.tiles.size());
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (src.tiles[t]) {
+                tiles[t] = AllocateTile();
+                std::copy_n(src.tiles[t].get(), tileSize, tiles[t].get());
+            }
+        }
+        return *this;
+    };
+
+    /**
+    * \brief Resizes to n cells with the given value, only a non-zero value allocates tiles
+    */
+    void assign(size_t n, const T &value = T()) {
+        nbCells = n;
+        tiles.clear();
+        tiles.resize((n + tileSize - 1) / tileSize);
+        if (!IsZero(&value, 1)) {
+            for (auto &tile : tiles) {
+                tile = AllocateTile();
+                std::fill_n(tile.get(), tileSize, value);
+            }
+        }
+    };
+
+    [[nodiscard]] size_t size() const { return nbCells; };
+    [[nodiscard]] bool empty() const { return nbCells == 0; };
+
+    const T &operator[](size_t i) const {
+        const auto &tile = tiles[i / tileSize];
+        return tile ? tile[i % tileSize] : zeroCell;
+    };
+
+    //! Write access, allocates the tile of the cell if necessary
+    T &operator[](size_t i) {
+        auto &tile = tiles[i / tileSize];
+        if (!tile)
+            tile = AllocateTile();
+        return tile[i % tileSize];
+    };
+
+    //! Releases all tiles, all cells read as zero afterwards
+    void Reset() {
+        for (auto &tile : tiles)
+            tile.reset();
+    };
+
+    //! Releases the tiles that only hold zero cells, e.g. after all cells have been written by a file loader
+    void Compact() {
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (tiles[t] && IsZero(tiles[t].get(), std::min(tileSize, nbCells - t * tileSize)))
+                tiles[t].reset();
+        }
+    };
+
+    /**
+    * \brief Adds a dense array of size() cells, tiles with only zero source cells are not allocated
+    */
+    void AddRange(const T *src) {
+        for (size_t t = 0; t < tiles.size(); t++) {
+            const size_t begin = t * tileSize;
+            const size_t count = std::min(tileSize, nbCells - begin);
+            if (!tiles[t]) {
+                if (IsZero(src + begin, count))
+                    continue;
+                tiles[t] = AllocateTile();
+            }
+            T *dst = tiles[t].get();
+            for (size_t i = 0; i < count; i++)
+                dst[i] += src[begin + i];
+        }
+    };
+
+    //! Adds another array of the same size, only its allocated tiles are visited
+    TiledCells &operator+=(const TiledCells &rhs) {
+        if (rhs.nbCells != nbCells)
+            return *this;
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (!rhs.tiles[t])
+                continue;
+            if (!tiles[t]) {
+                tiles[t] = AllocateTile();
+                std::copy_n(rhs.tiles[t].get(), tileSize, tiles[t].get());
+                continue;
+            }
+            T *dst = tiles[t].get();
+            const T *src = rhs.tiles[t].get();
+            for (size_t i = 0; i < tileSize; i++)
+                dst[i] += src[i];
+        }
+        return *this;
+    };
+
+    [[nodiscard]] std::vector<T> ToVector() const {
+        std::vector<T> cells(nbCells);
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (tiles[t])
+                std::copy_n(tiles[t].get(), std::min(tileSize, nbCells - t * tileSize), cells.begin() + (std::ptrdiff_t) (t * tileSize));
+        }
+        return cells;
+    };
+
+    //! Takes over a dense array, tiles with only zero cells stay unallocated
+    void FromVector(const std::vector<T> &cells) {
+        assign(cells.size());
+        AddRange(cells.data());
+    };
+
+    [[nodiscard]] size_t GetNbAllocatedTiles() const {
+        size_t nb = 0;
+        for (const auto &tile : tiles)
+            nb += tile ? 1 : 0;
+        return nb;
+    };
+
+    [[nodiscard]] size_t GetMemSize() const {
+        return sizeof(TiledCells) + tiles.capacity() * sizeof(std::unique_ptr<T[]>)
+               + GetNbAllocatedTiles() * tileSize * sizeof(T);
+    };
+
+    template<class Archive>
+    void save(Archive &archive) const {
+        archive(ToVector());
+    };
+
+    template<class Archive>
+    void load(Archive &archive) {
+        std::vector<T> cells;
+        archive(cells);
+        FromVector(cells);
+    };
+
+private:
+    static std::unique_ptr<T[]> AllocateTile() {
+        return std::unique_ptr<T[]>(new T[tileSize]()); // value-initialized, i.e. zero cells
+    };
+
+    static bool IsZero(const T *cells, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (std::memcmp(&cells[i], &zeroCell, sizeof(T)) != 0)
+                return false;
+        }
+        return true;
+    };
+
+    inline static const T zeroCell{};
+    std::vector<std::unique_ptr<T[]>> tiles;
+    size_t nbCells{0};
+};
+
+#endif //MOLFLOW_PROJ_TILEDCELLS_H
@@ -0,0 +1,94 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#include "VelocityTable.h"
+#include <cmath>
+#include <limits>
+
+/**
+* \brief Distribution parameter a = sqrt(kT/m), with the same constants as CDFGeneration::Generate_CDF
+*/
+double VelocityTable::GetDistributionParameter(double gasTempKelvins, double gasMassGramsPerMol) {
+    constexpr double Kb = 1.38E-23;
+    return std::sqrt(Kb * gasTempKelvins / (gasMassGramsPerMol * 1.67E-27));
+}
+
+/**
+* \brief Exact inverse of the wall collision speed distribution F(v) = 1 - exp(-s) * (1 + s), with s = v^2 / (2 a^2)
+* Solves s - log(1 + s) = -log(1 - rndVal) with Newton's method, which is monotone for this convex function
+* \param rndVal probability in [0,1[
+* \param a distribution parameter, see GetDistributionParameter
+* \return speed in m/s
+*/
+double VelocityTable::InverseCDF(double rndVal, double a) {
+    if (rndVal <= 0.0)
+        return 0.0;
+    rndVal = std::fmin(rndVal, 1.0 - std::numeric_limits<double>::epsilon());
+    const double logTail = -std::log1p(-rndVal);
+
+    // s^2/2 for small s, s - log(s) for large s
+    double s = logTail < 1.0 ? std::sqrt(2.0 * logTail) : logTail + std::log1p(logTail);
+    for (int i = 0; i < 50; i++) {
+        const double h = s - std::log1p(s) - logTail;
+        const double ds = h * (1.0 + s) / s;
+        s -= ds;
+        if (s <= 0.0) {
+            s = std::numeric_limits<double>::min();
+        }
+        if (std::abs(ds) <= 1e-15 * s)
+            break;
+    }
+    return a * std::sqrt(2.0 * s);
+}
+
+/**
+* \brief Tabulates the inverse distribution for a gas temperature and mass
+* \param resolution number of probability bins, 0 to always use the exact inverse
+*/
+void VelocityTable::Build(double gasTempKelvins, double gasMassGramsPerMol, size_t resolution) {
+    a = GetDistributionParameter(gasTempKelvins, gasMassGramsPerMol);
+    table.clear();
+    if (resolution < 3)
+        return; // no interior bin left, exact sampling
+    table.resize(resolution);
+    for (size_t i = 0; i < resolution; i++)
+        table[i] = InverseCDF((double) i / (double) resolution, a);
+}
+
+/**
+* \brief Speed for a uniform random number
+* \param rndVal uniform random number in [0,1[
+* \return speed in m/s
+*/
+double VelocityTable::Sample(double rndVal) const {
+    if (table.empty())
+        return InverseCDF(rndVal, a);
+    const double position = rndVal * (double) table.size();
+    const size_t index = (size_t) position;
+    // v ~ u^(1/4) near 0 and diverges near 1, linear interpolation is only used in between
+    if (index == 0 || index + 1 >= table.size())
+        return InverseCDF(rndVal, a);
+    const double frac = position - (double) index;
+    return table[index] + frac * (table[index + 1] - table[index]);
+}
+
+double VelocityTable::SampleExact(double rndVal) const {
+    return InverseCDF(rndVal, a);
+}
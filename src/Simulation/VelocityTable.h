@@ -0,0 +1,51 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+#ifndef MOLFLOW_PROJ_VELOCITYTABLE_H
+#define MOLFLOW_PROJ_VELOCITYTABLE_H
+
+#include <vector>
+#include <cstddef>
+
+/**
+* \brief Inverse cumulative distribution of the Maxwell-Boltzmann wall collision speed for one temperature
+* The inverse is tabulated at uniformly spaced probabilities, so that sampling is an index computation and a linear
+* interpolation. The first and last bins, where the inverse is steep, are evaluated exactly.
+ */
+class VelocityTable {
+public:
+    void Build(double gasTempKelvins, double gasMassGramsPerMol, size_t resolution);
+
+    double Sample(double rndVal) const;
+    double SampleExact(double rndVal) const;
+
+    static double GetDistributionParameter(double gasTempKelvins, double gasMassGramsPerMol);
+    static double InverseCDF(double rndVal, double a);
+
+    [[nodiscard]] bool empty() const { return table.empty(); };
+    [[nodiscard]] size_t size() const { return table.size(); };
+    [[nodiscard]] size_t GetMemSize() const { return sizeof(VelocityTable) + table.capacity() * sizeof(double); };
+
+private:
+    double a{0.0}; // distribution parameter sqrt(kT/m)
+    std::vector<double> table; // speed at probability i / size(), 0 for an exact table
+};
+
+#endif //MOLFLOW_PROJ_VELOCITYTABLE_H
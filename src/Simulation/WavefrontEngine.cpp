@@ -0,0 +1,176 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+
+#include "WavefrontEngine.h"
+#include "Particle.h"
+#include "WideBVH.h"
+#include <algorithm>
+#include <limits>
+
+namespace MFSim {
+
+    void WavefrontEngine::Resize(size_t nbParticles) {
+        states.assign(nbParticles, ParticleState());
+        batch.clear();
+        batch.reserve(nbParticles);
+        packetRays.clear();
+        packetRays.reserve(WideBVHAccel::MAX_PACKET);
+    }
+
+    /**
+    * \brief Drops all in-flight particles, e.g. on a simulation reset
+    */
+    void WavefrontEngine::Reset() {
+        for (auto &state : states) {
+            state.alive = false;
+            state.lastHitFacet = nullptr;
+            state.ray.hits.clear();
+        }
+        batch.clear();
+    }
+
+    size_t WavefrontEngine::GetNbAlive() const {
+        return std::count_if(states.begin(), states.end(), [](const ParticleState &state) { return state.alive; });
+    }
+
+    /**
+    * \brief Swaps an in-flight particle into the particle object, so that its regular routines can be used
+    */
+    void WavefrontEngine::Load(Particle &p, ParticleState &state) {
+        std::swap(p.particle, state.ray);
+        p.lastHitFacet = state.lastHitFacet;
+        p.velocity = state.velocity;
+        p.oriRatio = state.oriRatio;
+        p.generationTime = state.generationTime;
+        p.distanceTraveled = state.distanceTraveled;
+        p.expectedDecayMoment = state.expectedDecayMoment;
+        p.nbBounces = state.nbBounces;
+        p.teleportedFrom = state.teleportedFrom;
+    }
+
+    void WavefrontEngine::Store(Particle &p, ParticleState &state) {
+        std::swap(p.particle, state.ray);
+        state.lastHitFacet = p.lastHitFacet;
+        state.velocity = p.velocity;
+        state.oriRatio = p.oriRatio;
+        state.generationTime = p.generationTime;
+        state.distanceTraveled = p.distanceTraveled;
+        state.expectedDecayMoment = p.expectedDecayMoment;
+        state.nbBounces = p.nbBounces;
+        state.teleportedFrom = p.teleportedFrom;
+    }
+
+    /**
+    * \brief Intersects all alive particles, structure by structure, as packets when the wide BVH is used
+    */
+    void WavefrontEngine::IntersectBatch(Particle &p) {
+#if defined(USE_PROFILING_COUNTERS)
+        const uint64_t startTicks = ReadProfileTicks();
+#endif
+        batch.clear();
+        for (size_t s = 0; s < p.model->accel.size(); s++) {
+            auto *wide = dynamic_cast<WideBVHAccel *>(p.model->accel[s].get());
+            const size_t structBegin = batch.size();
+            for (size_t i = 0; i < states.size(); i++) {
+                auto &state = states[i];
+                if (!state.alive || state.ray.structure != static_cast<int>(s))
+                    continue;
+                state.ray.tMax = 1.0e99;
+                state.ray.lastIntersected = state.lastHitFacet ? static_cast<int>(state.lastHitFacet->globalId) : -1;
+                state.ray.rng = &p.randomGenerator;
+                state.ray.pay = nullptr;
+                batch.push_back(i);
+                if (!wide)
+                    state.found = p.model->accel[s]->Intersect(state.ray);
+            }
+            if (!wide)
+                continue;
+            for (size_t offset = structBegin; offset < batch.size(); offset += WideBVHAccel::MAX_PACKET) {
+                const size_t packetSize = std::min(WideBVHAccel::MAX_PACKET, batch.size() - offset);
+                bool found[WideBVHAccel::MAX_PACKET];
+                packetRays.clear();
+                for (size_t r = 0; r < packetSize; r++)
+                    packetRays.push_back(&states[batch[offset + r]].ray);
+                wide->IntersectPacket(packetRays.data(), packetSize, found);
+                for (size_t r = 0; r < packetSize; r++)
+                    states[batch[offset + r]].found = found[r];
+            }
+        }
+#if defined(USE_PROFILING_COUNTERS)
+        p.profileCounters.Add(ProfileEvent::Intersect, ReadProfileTicks() - startTicks, batch.size());
+#endif
+    }
+
+    /**
+    * \brief Performs at least nbStep particle steps, spread over the in-flight particles
+    * \param p thread local particle whose results buffers and routines are used
+    * \param nbStep number of steps (bounces) to perform in total
+    * \param remainingDes desorptions left until the desorption limit
+    * \param nbDone output, number of steps actually performed, at least nbStep unless stopped early
+    * \return false on a desorption error or when the desorption limit is reached and no particle is left
+    */
+    bool WavefrontEngine::Step(Particle &p, size_t nbStep, size_t remainingDes, size_t &nbDone) {
+        const auto *model = p.model;
+        nbDone = 0;
+        while (nbDone < nbStep && !p.allQuit) {
+            // Generate: desorb new particles into the free slots
+            for (auto &state : states) {
+                if (state.alive)
+                    continue;
+                if (model->otfParams.desorptionLimit > 0 && remainingDes == 0)
+                    break;
+                Load(p, state);
+                p.particle.rng = &p.randomGenerator;
+                const bool started = p.StartFromSource(p.particle);
+                Store(p, state);
+                if (!started)
+                    return false;
+                state.alive = true;
+                --remainingDes;
+            }
+
+            // Intersect the whole batch
+            IntersectBatch(p);
+            if (batch.empty())
+                return false; // desorption limit reached and all particles finished
+
+            // Classify: handle the hits facet by facet for coherent access to facet data and results, leaks last
+            std::sort(batch.begin(), batch.end(), [this](size_t a, size_t b) {
+                const size_t keyA = states[a].found ? states[a].ray.hardHit.hitId : std::numeric_limits<size_t>::max();
+                const size_t keyB = states[b].found ? states[b].ray.hardHit.hitId : std::numeric_limits<size_t>::max();
+                return keyA < keyB || (keyA == keyB && a < b);
+            });
+
+            // Record and move: transparent passes, then absorption, bounce, teleport or leak
+            for (const size_t i : batch) {
+                auto &state = states[i];
+                Load(p, state);
+                SimulationFacet *collidedFacet = nullptr;
+                double d = 0.0;
+                p.ResolveIntersection(state.found, collidedFacet, d);
+                state.alive = !p.ProcessIntersection(state.found, collidedFacet, d);
+                Store(p, state);
+            }
+            nbDone += batch.size();
+        }
+        return true;
+    }
+}
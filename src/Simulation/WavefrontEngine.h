@@ -0,0 +1,76 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+
+#ifndef MOLFLOW_PROJ_WAVEFRONTENGINE_H
+#define MOLFLOW_PROJ_WAVEFRONTENGINE_H
+
+#include <vector>
+#include <cstddef>
+#include "RayTracing/Ray.h"
+#include "FacetData.h"
+
+namespace MFSim {
+    class Particle;
+
+    /**
+    * \brief Kinematic state of one in-flight particle of the wavefront engine
+     */
+    struct ParticleState {
+        Ray ray;
+        SimulationFacet *lastHitFacet{nullptr};
+        double velocity{0.0};
+        double oriRatio{0.0};
+        double generationTime{0.0};
+        double distanceTraveled{0.0};
+        double expectedDecayMoment{0.0};
+        size_t nbBounces{0};
+        int teleportedFrom{-1};
+        bool alive{false};
+        bool found{false}; // result of the last intersection stage
+    };
+
+    /**
+    * \brief Streams many in-flight particles per thread through separate stages
+    * Generate (desorb into free slots), intersect the whole batch, classify by hit facet, then record and
+    * move every particle with the regular Particle routines. Results are statistically identical to the scalar
+    * loop in Particle::SimulationMCStep, only the order of the random numbers differs.
+     */
+    class WavefrontEngine {
+    public:
+        void Resize(size_t nbParticles);
+        void Reset();
+        [[nodiscard]] size_t size() const { return states.size(); };
+        [[nodiscard]] size_t GetNbAlive() const;
+
+        bool Step(Particle &p, size_t nbStep, size_t remainingDes, size_t &nbDone);
+
+    private:
+        static void Load(Particle &p, ParticleState &state);
+        static void Store(Particle &p, ParticleState &state);
+        void IntersectBatch(Particle &p);
+
+        std::vector<ParticleState> states;
+        std::vector<size_t> batch; // alive states of the current stage, in processing order
+        std::vector<Ray *> packetRays;
+    };
+}
+
+#endif //MOLFLOW_PROJ_WAVEFRONTENGINE_H
@@ -0,0 +1,709 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+
+#include "WideBVH.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <future>
+#include <istream>
+#include <ostream>
+#include <array>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+    constexpr double infinity = std::numeric_limits<double>::infinity();
+    constexpr size_t nbBins = 12;
+    constexpr size_t minParallelSubtree = 4096; // primitives of a subtree built as its own task
+    constexpr size_t minParallelChunk = 32768; // primitives per task when binning a single large range
+    // Conservative slab test, accounts for the rounding of the distance computation (PBRT, 3.9.2)
+    constexpr double farScale = 1.0 + 2.0 * 3.0 * std::numeric_limits<double>::epsilon();
+    constexpr uint16_t maxQuantized = std::numeric_limits<uint16_t>::max();
+
+    // Bound of a quantized coordinate, q * scale is exact in double, so the traversal decodes the same value
+    inline double Dequantize(float origin, float scale, uint16_t q) {
+        return (double) origin + (double) q * (double) scale;
+    }
+
+    //! Largest q with Dequantize(q) <= value, for value >= origin
+    uint16_t QuantizeDown(double value, float origin, float scale) {
+        auto q = static_cast<uint16_t>(std::clamp(std::floor((value - origin) / scale), 0.0, (double) maxQuantized));
+        while (q > 0 && Dequantize(origin, scale, q) > value)
+            q--;
+        return q;
+    }
+
+    //! Smallest q with Dequantize(q) >= value, for value <= Dequantize(maxQuantized)
+    uint16_t QuantizeUp(double value, float origin, float scale) {
+        auto q = static_cast<uint16_t>(std::clamp(std::ceil((value - origin) / scale), 0.0, (double) maxQuantized));
+        while (q < maxQuantized && Dequantize(origin, scale, q) < value)
+            q++;
+        return q;
+    }
+
+    double HalfArea(const double *min, const double *max) {
+        const double dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    inline size_t LowestBit(uint64_t mask) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return index;
+#else
+        return __builtin_ctzll(mask);
+#endif
+    }
+
+    void Grow(double *min, double *max, const double *pMin, const double *pMax) {
+        for (int a = 0; a < 3; a++) {
+            min[a] = std::min(min[a], pMin[a]);
+            max[a] = std::max(max[a], pMax[a]);
+        }
+    }
+
+    /**
+    * \brief Calls func(chunk, first, last) on nbChunks consecutive parts of [begin, end[, the first one on this thread
+    */
+    template<typename Func>
+    void ForEachChunk(size_t begin, size_t end, size_t nbChunks, const Func &func) {
+        std::vector<std::future<void>> tasks;
+        tasks.reserve(nbChunks);
+        for (size_t c = 1; c < nbChunks; c++) {
+            tasks.emplace_back(std::async(std::launch::async, [&, c]() {
+                func(c, begin + c * (end - begin) / nbChunks, begin + (c + 1) * (end - begin) / nbChunks);
+            }));
+        }
+        func(0, begin, begin + (end - begin) / nbChunks);
+        for (auto &task : tasks)
+            task.get();
+    }
+}
+
+/**
+* \brief Builds the tree over the facets of one structure
+* \param facets facets of the structure
+* \param maxLeafSize facets per leaf
+* \param nbThreads threads building large subtrees and splits in parallel, the tree topology does not depend on it
+*/
+WideBVHAccel::WideBVHAccel(const std::vector<SimulationFacet *> &facets, size_t maxLeafSize, size_t nbThreads)
+        : maxLeafSize(std::max<size_t>(1, maxLeafSize)) {
+    if (facets.empty())
+        return;
+
+    std::vector<BuildPrim> buildPrims;
+    buildPrims.reserve(facets.size());
+    for (auto *facet : facets) {
+        // A facet lies within O + u*U + v*V, u,v in [0,1]
+        const Vector3d corners[4] = {facet->sh.O, facet->sh.O + facet->sh.U, facet->sh.O + facet->sh.V,
+                                     facet->sh.O + facet->sh.U + facet->sh.V};
+        BuildPrim prim{};
+        prim.facet = facet;
+        for (int a = 0; a < 3; a++) {
+            prim.min[a] = infinity;
+            prim.max[a] = -infinity;
+        }
+        for (const auto &corner : corners) {
+            const double p[3] = {corner.x, corner.y, corner.z};
+            Grow(prim.min, prim.max, p, p);
+        }
+        // Pad flat (axis aligned) facets, so that rays starting on them stay inside their box
+        const double pad = 1e-9 * std::sqrt((prim.max[0] - prim.min[0]) * (prim.max[0] - prim.min[0]) +
+                                            (prim.max[1] - prim.min[1]) * (prim.max[1] - prim.min[1]) +
+                                            (prim.max[2] - prim.min[2]) * (prim.max[2] - prim.min[2])) + 1e-12;
+        for (int a = 0; a < 3; a++) {
+            prim.min[a] -= pad;
+            prim.max[a] += pad;
+            prim.centroid[a] = 0.5 * (prim.min[a] + prim.max[a]);
+        }
+        buildPrims.push_back(prim);
+    }
+
+    nbThreads = std::max<size_t>(1, nbThreads);
+    nodes.reserve(2 * facets.size() / WIDTH + 1);
+    BuildNode(buildPrims, 0, buildPrims.size(), 1, nodes, maxDepth, nbThreads);
+    if ((WIDTH - 1) * maxDepth + 1 > STACK_SIZE) {
+        // Degenerate SAH splits, median splits bound the depth by log2(nbFacets)
+        nodes.clear();
+        maxDepth = 0;
+        medianSplit = true;
+        BuildNode(buildPrims, 0, buildPrims.size(), 1, nodes, maxDepth, nbThreads);
+    }
+
+    primitives.reserve(buildPrims.size());
+    for (const auto &prim : buildPrims)
+        primitives.push_back(prim.facet);
+    ComputeBB();
+}
+
+void WideBVHAccel::ComputeBB() {
+    if (GetNbNodes() == 0)
+        return;
+    Node root{};
+    if (compact) {
+        const CompactNode &compactRoot = compactNodes.front();
+        for (size_t k = 0; k < WIDTH; k++) {
+            root.minX[k] = Dequantize(compactRoot.origin[0], compactRoot.scale[0], compactRoot.qMinX[k]);
+            root.minY[k] = Dequantize(compactRoot.origin[1], compactRoot.scale[1], compactRoot.qMinY[k]);
+            root.minZ[k] = Dequantize(compactRoot.origin[2], compactRoot.scale[2], compactRoot.qMinZ[k]);
+            root.maxX[k] = Dequantize(compactRoot.origin[0], compactRoot.scale[0], compactRoot.qMaxX[k]);
+            root.maxY[k] = Dequantize(compactRoot.origin[1], compactRoot.scale[1], compactRoot.qMaxY[k]);
+            root.maxZ[k] = Dequantize(compactRoot.origin[2], compactRoot.scale[2], compactRoot.qMaxZ[k]);
+            root.child[k] = compactRoot.child[k];
+        }
+    }
+    else {
+        root = nodes.front();
+    }
+    bb.min = Vector3d(infinity, infinity, infinity);
+    bb.max = Vector3d(-infinity, -infinity, -infinity);
+    for (size_t k = 0; k < WIDTH; k++) {
+        if (root.child[k] < 0)
+            continue;
+        bb.min = Vector3d(std::min(bb.min.x, root.minX[k]), std::min(bb.min.y, root.minY[k]), std::min(bb.min.z, root.minZ[k]));
+        bb.max = Vector3d(std::max(bb.max.x, root.maxX[k]), std::max(bb.max.y, root.maxY[k]), std::max(bb.max.z, root.maxZ[k]));
+    }
+}
+
+/**
+* \brief Partitions a range in two with a binned SAH on the centroids, median split as fallback
+* \param nbTasks tasks that may bin the range in parallel
+* \return first element of the second half
+*/
+size_t WideBVHAccel::SplitRange(std::vector<BuildPrim> &buildPrims, size_t begin, size_t end, size_t nbTasks) const {
+    const size_t nbChunks = std::max<size_t>(1, std::min(nbTasks, (end - begin) / minParallelChunk));
+    struct Bounds {
+        double min[3] = {infinity, infinity, infinity};
+        double max[3] = {-infinity, -infinity, -infinity};
+    };
+    std::vector<Bounds> chunkBounds(nbChunks);
+    ForEachChunk(begin, end, nbChunks, [&](size_t c, size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            Grow(chunkBounds[c].min, chunkBounds[c].max, buildPrims[i].centroid, buildPrims[i].centroid);
+    });
+    double cMin[3] = {infinity, infinity, infinity};
+    double cMax[3] = {-infinity, -infinity, -infinity};
+    for (const auto &bounds : chunkBounds)
+        Grow(cMin, cMax, bounds.min, bounds.max);
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (cMax[a] - cMin[a] > cMax[axis] - cMin[axis])
+            axis = a;
+    }
+    const size_t mid = begin + (end - begin) / 2;
+    if (!(cMax[axis] > cMin[axis])) // all centroids coincide
+        return mid;
+    auto medianSplitAt = [&]() {
+        std::nth_element(buildPrims.begin() + begin, buildPrims.begin() + mid, buildPrims.begin() + end,
+                         [axis](const BuildPrim &a, const BuildPrim &b) { return a.centroid[axis] < b.centroid[axis]; });
+        return mid;
+    };
+    if (medianSplit)
+        return medianSplitAt();
+
+    struct Bin {
+        double min[3] = {infinity, infinity, infinity};
+        double max[3] = {-infinity, -infinity, -infinity};
+        size_t count = 0;
+    } bins[nbBins];
+    const double binScale = (double) nbBins / (cMax[axis] - cMin[axis]);
+    auto binOf = [&](const BuildPrim &prim) {
+        return std::min(nbBins - 1, (size_t) ((prim.centroid[axis] - cMin[axis]) * binScale));
+    };
+    // Each chunk fills its own bins, summed afterwards
+    std::vector<std::array<Bin, nbBins>> chunkBins(nbChunks);
+    ForEachChunk(begin, end, nbChunks, [&](size_t c, size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            Bin &bin = chunkBins[c][binOf(buildPrims[i])];
+            Grow(bin.min, bin.max, buildPrims[i].min, buildPrims[i].max);
+            bin.count++;
+        }
+    });
+    for (const auto &chunk : chunkBins) {
+        for (size_t b = 0; b < nbBins; b++) {
+            Grow(bins[b].min, bins[b].max, chunk[b].min, chunk[b].max);
+            bins[b].count += chunk[b].count;
+        }
+    }
+
+    // Sweep from the right, then from the left to find the cheapest split plane
+    double rightCost[nbBins];
+    {
+        Bin right;
+        for (size_t b = nbBins - 1; b > 0; b--) {
+            Grow(right.min, right.max, bins[b].min, bins[b].max);
+            right.count += bins[b].count;
+            rightCost[b] = right.count ? (double) right.count * HalfArea(right.min, right.max) : 0.0;
+        }
+    }
+    Bin left;
+    double bestCost = infinity;
+    size_t bestBin = 0;
+    for (size_t b = 0; b + 1 < nbBins; b++) {
+        Grow(left.min, left.max, bins[b].min, bins[b].max);
+        left.count += bins[b].count;
+        const double cost = (left.count ? (double) left.count * HalfArea(left.min, left.max) : 0.0) + rightCost[b + 1];
+        if (left.count && left.count < end - begin && cost < bestCost) {
+            bestCost = cost;
+            bestBin = b;
+        }
+    }
+    if (bestCost == infinity)
+        return medianSplitAt();
+    auto split = std::partition(buildPrims.begin() + begin, buildPrims.begin() + end,
+                                [&](const BuildPrim &prim) { return binOf(prim) <= bestBin; });
+    return split - buildPrims.begin();
+}
+
+/**
+* \brief Recursively builds a node, splitting its range in up to WIDTH children
+* Large inner children are built as separate tasks into their own node arrays, which are appended afterwards.
+* Their ranges are disjoint, so tasks only share the (read-only) build settings. The calling thread builds the last
+* large child itself, so at most nbTasks-1 tasks are started per node.
+* \param out node array the node is appended to
+* \param outDepth deepest level reached in out
+* \param nbTasks threads that may work on this subtree
+* \return index of the node in out
+*/
+int32_t WideBVHAccel::BuildNode(std::vector<BuildPrim> &buildPrims, size_t begin, size_t end, size_t depth,
+                                std::vector<Node> &out, size_t &outDepth, size_t nbTasks) const {
+    outDepth = std::max(outDepth, depth);
+    const auto nodeId = static_cast<int32_t>(out.size());
+    out.emplace_back();
+
+    // Repeatedly split the largest range until there are WIDTH children or all fit in a leaf
+    std::vector<std::pair<size_t, size_t>> ranges{{begin, end}};
+    while (ranges.size() < WIDTH) {
+        auto largest = std::max_element(ranges.begin(), ranges.end(), [](const auto &a, const auto &b) {
+            return a.second - a.first < b.second - b.first;
+        });
+        if (largest->second - largest->first <= maxLeafSize)
+            break;
+        const auto range = *largest;
+        const size_t split = SplitRange(buildPrims, range.first, range.second, nbTasks);
+        *largest = {range.first, split};
+        ranges.emplace_back(split, range.second);
+    }
+
+    size_t nbLarge = 0;
+    for (const auto &[first, last] : ranges)
+        nbLarge += (last - first > maxLeafSize && last - first >= minParallelSubtree) ? 1 : 0;
+    const size_t tasksPerChild = nbLarge ? std::max<size_t>(1, nbTasks / nbLarge) : nbTasks;
+    const size_t maxAsync = std::min(nbLarge, nbTasks) > 0 ? std::min(nbLarge, nbTasks) - 1 : 0;
+    size_t nbAsync = 0;
+
+    struct Subtree {
+        std::vector<Node> nodes;
+        size_t depth{0};
+    };
+    std::future<Subtree> subtrees[WIDTH];
+    Node node{};
+    for (size_t k = 0; k < WIDTH; k++) {
+        double min[3] = {infinity, infinity, infinity};
+        double max[3] = {-infinity, -infinity, -infinity};
+        int32_t child = -1;
+        uint32_t count = 0;
+        if (k < ranges.size()) {
+            const auto [first, last] = ranges[k];
+            for (size_t i = first; i < last; i++)
+                Grow(min, max, buildPrims[i].min, buildPrims[i].max);
+            if (last - first <= maxLeafSize) {
+                child = static_cast<int32_t>(first);
+                count = static_cast<uint32_t>(last - first);
+            } else if (nbAsync < maxAsync && last - first >= minParallelSubtree) {
+                nbAsync++;
+                subtrees[k] = std::async(std::launch::async, [&, first = first, last = last]() {
+                    Subtree subtree;
+                    BuildNode(buildPrims, first, last, depth + 1, subtree.nodes, subtree.depth, tasksPerChild);
+                    return subtree;
+                });
+            } else {
+                child = BuildNode(buildPrims, first, last, depth + 1, out, outDepth, tasksPerChild);
+            }
+        }
+        node.minX[k] = min[0];
+        node.minY[k] = min[1];
+        node.minZ[k] = min[2];
+        node.maxX[k] = max[0];
+        node.maxY[k] = max[1];
+        node.maxZ[k] = max[2];
+        node.child[k] = child;
+        node.count[k] = count;
+    }
+
+    for (size_t k = 0; k < WIDTH; k++) {
+        if (!subtrees[k].valid())
+            continue;
+        Subtree subtree = subtrees[k].get();
+        const auto offset = static_cast<int32_t>(out.size());
+        for (auto &subNode : subtree.nodes) {
+            for (size_t c = 0; c < WIDTH; c++) {
+                if (subNode.child[c] >= 0 && subNode.count[c] == 0) // inner child, leaves keep their primitive index
+                    subNode.child[c] += offset;
+            }
+        }
+        out.insert(out.end(), subtree.nodes.begin(), subtree.nodes.end());
+        outDepth = std::max(outDepth, subtree.depth);
+        node.child[k] = offset;
+    }
+    out[nodeId] = node;
+    return nodeId;
+}
+
+/**
+* \brief Quantizes the child bounds of a node relative to the box enclosing them
+* \return false if the box cannot be represented in single precision
+*/
+bool WideBVHAccel::CompactNodeOf(const Node &node, CompactNode &out) {
+    double min[3] = {infinity, infinity, infinity};
+    double max[3] = {-infinity, -infinity, -infinity};
+    for (size_t k = 0; k < WIDTH; k++) {
+        if (node.child[k] < 0)
+            continue;
+        const double childMin[3] = {node.minX[k], node.minY[k], node.minZ[k]};
+        const double childMax[3] = {node.maxX[k], node.maxY[k], node.maxZ[k]};
+        Grow(min, max, childMin, childMax);
+    }
+
+    out = CompactNode{};
+    for (int a = 0; a < 3; a++) {
+        if (!(min[a] <= max[a])) { // no child
+            min[a] = 0.0;
+            max[a] = 0.0;
+        }
+        float origin = static_cast<float>(min[a]);
+        if ((double) origin > min[a])
+            origin = std::nextafter(origin, -std::numeric_limits<float>::infinity());
+        const double step = (max[a] - (double) origin) / maxQuantized;
+        float scale = std::max(static_cast<float>(step), std::numeric_limits<float>::min());
+        while (std::isfinite(scale) && Dequantize(origin, scale, maxQuantized) < max[a])
+            scale = std::nextafter(scale, std::numeric_limits<float>::infinity());
+        if (!std::isfinite(origin) || !std::isfinite(scale))
+            return false;
+        out.origin[a] = origin;
+        out.scale[a] = scale;
+    }
+
+    for (size_t k = 0; k < WIDTH; k++) {
+        out.child[k] = node.child[k];
+        out.count[k] = node.count[k];
+        if (node.child[k] < 0)
+            continue; // empty slot, skipped by the traversal whatever its bounds
+        out.qMinX[k] = QuantizeDown(node.minX[k], out.origin[0], out.scale[0]);
+        out.qMinY[k] = QuantizeDown(node.minY[k], out.origin[1], out.scale[1]);
+        out.qMinZ[k] = QuantizeDown(node.minZ[k], out.origin[2], out.scale[2]);
+        out.qMaxX[k] = QuantizeUp(node.maxX[k], out.origin[0], out.scale[0]);
+        out.qMaxY[k] = QuantizeUp(node.maxY[k], out.origin[1], out.scale[1]);
+        out.qMaxZ[k] = QuantizeUp(node.maxZ[k], out.origin[2], out.scale[2]);
+    }
+    return true;
+}
+
+/**
+* \brief Switches to the compact node layout, less than half the size of the double precision nodes
+* Decoded boxes enclose the original ones, so the traversal visits at least the same leaves and facets are still
+* intersected in double precision: hits are the same, only more boxes may be entered.
+* \return false if the tree is kept in double precision (coordinates out of the single precision range)
+*/
+bool WideBVHAccel::Compact() {
+    if (compact)
+        return true;
+    std::vector<CompactNode> quantized(nodes.size());
+    for (size_t n = 0; n < nodes.size(); n++) {
+        if (!CompactNodeOf(nodes[n], quantized[n]))
+            return false;
+    }
+    compactNodes = std::move(quantized);
+    nodes.clear();
+    nodes.shrink_to_fit();
+    compact = true;
+    return true;
+}
+
+/**
+* \brief Writes the tree in a binary layout, facets are referenced by their global id
+*/
+void WideBVHAccel::Write(std::ostream &out) const {
+    // The node size identifies the layout
+    const uint64_t header[6] = {compact ? sizeof(CompactNode) : sizeof(Node), maxLeafSize, maxDepth, medianSplit ? 1u : 0u,
+                                GetNbNodes(), primitives.size()};
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    if (compact)
+        out.write(reinterpret_cast<const char *>(compactNodes.data()),
+                  static_cast<std::streamsize>(sizeof(CompactNode) * compactNodes.size()));
+    else
+        out.write(reinterpret_cast<const char *>(nodes.data()), static_cast<std::streamsize>(sizeof(Node) * nodes.size()));
+    for (const auto *facet : primitives) {
+        const uint64_t facetId = facet->globalId;
+        out.write(reinterpret_cast<const char *>(&facetId), sizeof(facetId));
+    }
+}
+
+/**
+* \brief Reads a tree written by Write, the tree is checked so that a damaged file cannot break the traversal
+* \param facetsById facets of the model, indexed by global id
+* \return false if the data is truncated, has another layout or references unknown nodes or facets
+*/
+bool WideBVHAccel::Read(std::istream &in, const std::vector<SimulationFacet *> &facetsById) {
+    auto fail = [this]() {
+        nodes.clear();
+        compactNodes.clear();
+        compact = false;
+        primitives.clear();
+        return false;
+    };
+    nodes.clear();
+    compactNodes.clear();
+    compact = false;
+    primitives.clear();
+    uint64_t header[6];
+    if (!in.read(reinterpret_cast<char *>(header), sizeof(header)))
+        return false;
+    const uint64_t nbNodes = header[4];
+    const uint64_t nbPrimitives = header[5];
+    // A structure holds each facet at most once, nodes have at least two children
+    if ((header[0] != sizeof(Node) && header[0] != sizeof(CompactNode)) || header[1] == 0 || nbPrimitives > facetsById.size() || nbNodes > nbPrimitives + 1
+        || (nbNodes == 0) != (nbPrimitives == 0))
+        return false;
+
+    compact = header[0] == sizeof(CompactNode);
+    if (compact) {
+        compactNodes.resize(nbNodes);
+        if (!in.read(reinterpret_cast<char *>(compactNodes.data()), static_cast<std::streamsize>(sizeof(CompactNode) * nbNodes)))
+            return fail();
+    }
+    else {
+        nodes.resize(nbNodes);
+        if (!in.read(reinterpret_cast<char *>(nodes.data()), static_cast<std::streamsize>(sizeof(Node) * nbNodes)))
+            return fail();
+    }
+    primitives.reserve(nbPrimitives);
+    for (uint64_t p = 0; p < nbPrimitives; p++) {
+        uint64_t facetId;
+        if (!in.read(reinterpret_cast<char *>(&facetId), sizeof(facetId)) || facetId >= facetsById.size() || !facetsById[facetId])
+            return fail();
+        primitives.push_back(facetsById[facetId]);
+    }
+
+    size_t depth = 0;
+    if (!(compact ? CheckNodes(compactNodes, depth) : CheckNodes(nodes, depth)) || (WIDTH - 1) * depth + 1 > STACK_SIZE)
+        return fail();
+    maxLeafSize = header[1];
+    maxDepth = depth;
+    medianSplit = header[3] != 0;
+    ComputeBB();
+    return true;
+}
+
+/**
+* \brief Checks that the children of the nodes reference valid nodes and primitives
+* \param depth depth of the tree
+*/
+template<typename NodeType>
+bool WideBVHAccel::CheckNodes(const std::vector<NodeType> &tree, size_t &depth) const {
+    // Children are always stored after their parent, so depths follow in one pass and cycles are impossible
+    const size_t nbNodes = tree.size();
+    const size_t nbPrimitives = primitives.size();
+    std::vector<size_t> depths(nbNodes, 1);
+    depth = nbNodes ? 1 : 0;
+    for (size_t n = 0; n < nbNodes; n++) {
+        for (size_t k = 0; k < WIDTH; k++) {
+            const int64_t child = tree[n].child[k];
+            const uint64_t count = tree[n].count[k];
+            const bool valid = child < 0 || (count ? (uint64_t) child + count <= nbPrimitives
+                                             : (uint64_t) child > n && (uint64_t) child < nbNodes);
+            if (!valid)
+                return false;
+            if (child >= 0 && !count) {
+                depths[child] = depths[n] + 1;
+                depth = std::max(depth, depths[child]);
+            }
+        }
+    }
+    return true;
+}
+
+WideBVHAccel::RayData WideBVHAccel::PrepareRay(const Ray &ray) {
+    RayData data{};
+    data.origin[0] = ray.origin.x;
+    data.origin[1] = ray.origin.y;
+    data.origin[2] = ray.origin.z;
+    // Division by zero gives a signed infinity, the padded boxes keep the slab test free of NaNs
+    data.invDir[0] = 1.0 / ray.direction.x;
+    data.invDir[1] = 1.0 / ray.direction.y;
+    data.invDir[2] = 1.0 / ray.direction.z;
+    return data;
+}
+
+/**
+* \brief Tests a ray against the WIDTH child boxes of a node at once
+* \param tNear entry distances of the children
+* \return bit mask of the children hit before tMax
+*/
+unsigned WideBVHAccel::SlabTest(const Node &node, const RayData &ray, double tMax, double *tNear) {
+    int hit[WIDTH];
+#pragma omp simd
+    for (size_t k = 0; k < WIDTH; k++) {
+        const double tx0 = (node.minX[k] - ray.origin[0]) * ray.invDir[0];
+        const double tx1 = (node.maxX[k] - ray.origin[0]) * ray.invDir[0];
+        const double ty0 = (node.minY[k] - ray.origin[1]) * ray.invDir[1];
+        const double ty1 = (node.maxY[k] - ray.origin[1]) * ray.invDir[1];
+        const double tz0 = (node.minZ[k] - ray.origin[2]) * ray.invDir[2];
+        const double tz1 = (node.maxZ[k] - ray.origin[2]) * ray.invDir[2];
+        const double t0 = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0));
+        const double t1 = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax));
+        tNear[k] = t0;
+        hit[k] = t0 <= t1 * farScale;
+    }
+    unsigned mask = 0;
+    for (size_t k = 0; k < WIDTH; k++)
+        mask |= static_cast<unsigned>(hit[k]) << k;
+    return mask;
+}
+
+/**
+* \brief Decodes the child bounds of a compact node and tests them like a full node
+*/
+unsigned WideBVHAccel::SlabTest(const CompactNode &node, const RayData &ray, double tMax, double *tNear) {
+    Node bounds;
+#pragma omp simd
+    for (size_t k = 0; k < WIDTH; k++) {
+        bounds.minX[k] = Dequantize(node.origin[0], node.scale[0], node.qMinX[k]);
+        bounds.minY[k] = Dequantize(node.origin[1], node.scale[1], node.qMinY[k]);
+        bounds.minZ[k] = Dequantize(node.origin[2], node.scale[2], node.qMinZ[k]);
+        bounds.maxX[k] = Dequantize(node.origin[0], node.scale[0], node.qMaxX[k]);
+        bounds.maxY[k] = Dequantize(node.origin[1], node.scale[1], node.qMaxY[k]);
+        bounds.maxZ[k] = Dequantize(node.origin[2], node.scale[2], node.qMaxZ[k]);
+    }
+    return SlabTest(bounds, ray, tMax, tNear);
+}
+
+/**
+* \brief Traces a single ray, nearest children first
+* \return true if a hard hit was found, transparent passes are collected in ray.hits
+*/
+bool WideBVHAccel::Intersect(Ray &ray) {
+    return compact ? Traverse(compactNodes, ray) : Traverse(nodes, ray);
+}
+
+template<typename NodeType>
+bool WideBVHAccel::Traverse(const std::vector<NodeType> &tree, Ray &ray) const {
+    if (tree.empty())
+        return false;
+
+    const RayData data = PrepareRay(ray);
+    bool found = false;
+    int32_t stack[STACK_SIZE];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize) {
+        const NodeType &node = tree[stack[--stackSize]];
+        double tNear[WIDTH];
+        unsigned mask = SlabTest(node, data, ray.tMax, tNear);
+
+        std::pair<double, int32_t> inner[WIDTH];
+        size_t nbInner = 0;
+        for (size_t k = 0; k < WIDTH; k++) {
+            if (!(mask & (1u << k)) || node.child[k] < 0)
+                continue;
+            if (node.count[k]) {
+                for (size_t p = node.child[k]; p < node.child[k] + node.count[k]; p++)
+                    found |= primitives[p]->Intersect(ray);
+            } else {
+                inner[nbInner++] = {tNear[k], node.child[k]};
+            }
+        }
+        // Farthest first on the stack, so that the nearest child shrinks tMax before the others are tested
+        for (size_t i = 1; i < nbInner; i++) {
+            for (size_t j = i; j > 0 && inner[j - 1].first < inner[j].first; j--)
+                std::swap(inner[j - 1], inner[j]);
+        }
+        for (size_t i = 0; i < nbInner; i++)
+            stack[stackSize++] = inner[i].second;
+    }
+    return found;
+}
+
+/**
+* \brief Traces independent rays through one shared traversal, each ray keeps its own tMax and hit records
+* \param rays rays to trace
+* \param nbRays number of rays, traced by groups of MAX_PACKET
+* \param found per ray: true if a hard hit was found
+*/
+void WideBVHAccel::IntersectPacket(Ray *const *rays, size_t nbRays, bool *found) {
+    for (size_t offset = 0; offset < nbRays; offset += MAX_PACKET) {
+        const size_t packetSize = std::min(MAX_PACKET, nbRays - offset);
+        Ray *const *packet = rays + offset;
+        bool *packetFound = found + offset;
+        for (size_t r = 0; r < packetSize; r++)
+            packetFound[r] = false;
+        if (compact)
+            TraversePacket(compactNodes, packet, packetSize, packetFound);
+        else
+            TraversePacket(nodes, packet, packetSize, packetFound);
+    }
+}
+
+template<typename NodeType>
+void WideBVHAccel::TraversePacket(const std::vector<NodeType> &tree, Ray *const *packet, size_t packetSize, bool *found) const {
+    if (tree.empty())
+        return;
+
+    RayData data[MAX_PACKET];
+    for (size_t r = 0; r < packetSize; r++)
+        data[r] = PrepareRay(*packet[r]);
+
+    std::pair<int32_t, uint64_t> stack[STACK_SIZE];
+    size_t stackSize = 0;
+    stack[stackSize++] = {0, packetSize == 64 ? ~uint64_t(0) : (uint64_t(1) << packetSize) - 1};
+    while (stackSize) {
+        const auto [nodeId, rayMask] = stack[--stackSize];
+        const NodeType &node = tree[nodeId];
+
+        uint64_t childMask[WIDTH] = {};
+        double tNear[WIDTH];
+        for (uint64_t active = rayMask; active; active &= active - 1) {
+            const size_t r = LowestBit(active);
+            const unsigned mask = SlabTest(node, data[r], packet[r]->tMax, tNear);
+            for (size_t k = 0; k < WIDTH; k++) {
+                if (mask & (1u << k))
+                    childMask[k] |= uint64_t(1) << r;
+            }
+        }
+
+        for (size_t k = 0; k < WIDTH; k++) {
+            if (!childMask[k] || node.child[k] < 0)
+                continue;
+            if (node.count[k]) {
+                for (uint64_t active = childMask[k]; active; active &= active - 1) {
+                    const size_t r = LowestBit(active);
+                    for (size_t p = node.child[k]; p < node.child[k] + node.count[k]; p++)
+                        found[r] |= primitives[p]->Intersect(*packet[r]);
+                }
+            } else {
+                stack[stackSize++] = {node.child[k], childMask[k]};
+            }
+        }
+    }
+}
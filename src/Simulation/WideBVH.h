@@ -0,0 +1,118 @@
+/*
+Program:     MolFlow+ / Synrad+
+Description: Monte Carlo simulator for ultra-high vacuum and synchrotron radiation
+Authors:     Jean-Luc PONS / Roberto KERSEVAN / Marton ADY / Pascal BAEHR
+Copyright:   E.S.R.F / CERN
+Website:     https://cern.ch/molflow
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+*/
+
+
+#ifndef MOLFLOW_PROJ_WIDEBVH_H
+#define MOLFLOW_PROJ_WIDEBVH_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+#include "RayTracing/BVH.h"
+#include "FacetData.h"
+
+/**
+* \brief 4-wide BVH with SoA child bounds, tested with one SIMD slab test per node
+* Leaves call the facets' own intersection routine, so hits are recorded exactly like with BVHAccel.
+* Besides single rays, a packet of independent rays can be traced in one traversal (IntersectPacket).
+* Compact() replaces the nodes by a smaller layout with 16-bit child bounds quantized relative to the parent box,
+* rounded outwards, for large models whose traversal is limited by memory bandwidth.
+ */
+class WideBVHAccel : public RTPrimitive {
+public:
+    static constexpr size_t WIDTH = 4; // children per node, one AVX2 register of doubles
+    static constexpr size_t MAX_PACKET = 64; // rays per traversal, one bit each in the lane masks
+    static constexpr size_t STACK_SIZE = 256; // traversal stack, bounds the tree depth
+
+    WideBVHAccel() = default; //!< empty tree, to be filled by Read
+    explicit WideBVHAccel(const std::vector<SimulationFacet *> &facets, size_t maxLeafSize = 4, size_t nbThreads = 1);
+    ~WideBVHAccel() override = default;
+
+    void ComputeBB() override;
+    bool Intersect(Ray &ray) override;
+    void IntersectPacket(Ray *const *rays, size_t nbRays, bool *found);
+
+    bool Compact();
+
+    void Write(std::ostream &out) const;
+    bool Read(std::istream &in, const std::vector<SimulationFacet *> &facetsById);
+
+    [[nodiscard]] size_t GetNbNodes() const { return compact ? compactNodes.size() : nodes.size(); };
+    [[nodiscard]] bool IsCompact() const { return compact; };
+    [[nodiscard]] size_t GetNbPrimitives() const { return primitives.size(); };
+    [[nodiscard]] size_t GetMaxDepth() const { return maxDepth; };
+    [[nodiscard]] size_t GetMemSize() const {
+        return sizeof(WideBVHAccel) + sizeof(Node) * nodes.capacity() + sizeof(CompactNode) * compactNodes.capacity()
+               + sizeof(SimulationFacet *) * primitives.capacity();
+    };
+
+private:
+    struct Node {
+        double minX[WIDTH], minY[WIDTH], minZ[WIDTH];
+        double maxX[WIDTH], maxY[WIDTH], maxZ[WIDTH];
+        int32_t child[WIDTH]; // inner node index, first primitive for leaves, -1 for an empty slot
+        uint32_t count[WIDTH]; // primitives of a leaf child, 0 for inner children
+    };
+
+    //! Node with child bounds origin + q * scale, q in [0, 65535], enclosing the bounds of the Node it was made from
+    struct CompactNode {
+        float origin[3]; // lower corner of the parent box, rounded down
+        float scale[3]; // quantization step per axis, rounded up
+        uint16_t qMinX[WIDTH], qMinY[WIDTH], qMinZ[WIDTH];
+        uint16_t qMaxX[WIDTH], qMaxY[WIDTH], qMaxZ[WIDTH];
+        int32_t child[WIDTH];
+        uint32_t count[WIDTH];
+    };
+
+    struct BuildPrim {
+        double min[3], max[3], centroid[3];
+        SimulationFacet *facet;
+    };
+
+    struct RayData {
+        double origin[3];
+        double invDir[3];
+    };
+
+    int32_t BuildNode(std::vector<BuildPrim> &buildPrims, size_t begin, size_t end, size_t depth,
+                      std::vector<Node> &out, size_t &outDepth, size_t nbTasks) const;
+    size_t SplitRange(std::vector<BuildPrim> &buildPrims, size_t begin, size_t end, size_t nbTasks) const;
+    static RayData PrepareRay(const Ray &ray);
+    static unsigned SlabTest(const Node &node, const RayData &ray, double tMax, double *tNear);
+    static unsigned SlabTest(const CompactNode &node, const RayData &ray, double tMax, double *tNear);
+    static bool CompactNodeOf(const Node &node, CompactNode &out);
+    template<typename NodeType>
+    bool Traverse(const std::vector<NodeType> &tree, Ray &ray) const;
+    template<typename NodeType>
+    void TraversePacket(const std::vector<NodeType> &tree, Ray *const *packet, size_t packetSize, bool *found) const;
+    template<typename NodeType>
+    bool CheckNodes(const std::vector<NodeType> &tree, size_t &depth) const;
+
+    size_t maxLeafSize{4};
+    size_t maxDepth{0};
+    bool medianSplit{false}; // fallback when SAH splits produce a tree too deep for the traversal stack
+    bool compact{false}; // nodes are stored in compactNodes
+    std::vector<Node> nodes;
+    std::vector<CompactNode> compactNodes;
+    std::vector<SimulationFacet *> primitives; // leaf order
+};
+
+#endif //MOLFLOW_PROJ_WIDEBVH_H
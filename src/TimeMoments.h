@@ -26,8 +26,6 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 
 class TimeMoments {
 public:
-    static int CheckIntervalOverlap(const std::vector<Moment>& vecA, const std::vector<Moment>& vecB);
-    static std::pair<int, int> CheckIntervalOverlap(const std::vector<std::vector<Moment>>& vecParsedMoments);
     static std::vector<Moment> ParseMoment(const std::string& userInput, double timeWindow);
     static int
     ParseAndCheckUserMoments(std::vector<Moment> *moments, std::vector<UserMoment> *userMoments,
@@ -23,19 +23,43 @@ Full license text: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
 #include "../src/Initializer.h"
 #include "../src/ParameterParser.h"
 #include "../src/Simulation/MolflowSimFacet.h"
+#include "../src/Simulation/AliasTable.h"
+#include "../src/Simulation/SparseFacetResults.h"
+#include "../src/Simulation/FacetResultArena.h"
+#include "../src/Simulation/MomentIndex.h"
+#include "../src/TimeMoments.h"
+#include "../src/Simulation/WideBVH.h"
+#include "../src/Simulation/Simulation.h"
+#include "../src/Simulation/ProfilingCounters.h"
+#include "../src/Simulation/SyncScheduler.h"
+#include "../src/Simulation/ResultMerger.h"
+#include "../src/Simulation/AccelReoptimizer.h"
+#include "../src/Simulation/VelocityTable.h"
+#include "../src/Simulation/GuideTable.h"
+#include "../src/Simulation/IDGeneration.h"
+#include "../src/Simulation/AnglemapGeneration.h"
+#include <thread>
+#include <random>
 //#define MOLFLOW_PATH ""
 
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 
 // hash time to create random file name
 #include <ctime>
 #include <functional>
+#include <algorithm>
 #include <Helper/Chronometer.h>
+#include <Helper/MathTools.h>
 #include <memory>
 #include <numeric>
 #include <cmath>
 #include <IO/WriterXML.h>
+#include <IO/StateBinary.h>
+#include <IO/StateJournal.h>
+#include <IO/AsyncStateWriter.h>
+#include <IO/AccelCache.h>
 #include <IO/CSVExporter.h>
 #include <SettingsIO.h>
 #include <fmt/core.h>
@@ -1080,6 +1104,1301 @@ namespace {
 
         std::filesystem::remove(paramFile);
     }
+
+    TEST(AliasTable, Distribution) {
+        std::vector<double> weights{1.0, 0.0, 3.0, 6.0, 0.0};
+        AliasTable table(weights);
+        ASSERT_EQ(table.size(), weights.size());
+        ASSERT_DOUBLE_EQ(table.GetTotalWeight(), 10.0);
+
+        // Stratified uniform numbers reproduce the weights up to the sampling resolution
+        const size_t nbSamples = 100000;
+        std::vector<size_t> counts(weights.size(), 0);
+        for (size_t k = 0; k < nbSamples; ++k) {
+            counts[table.Sample(((double) k + 0.5) / (double) nbSamples)]++;
+        }
+        for (size_t i = 0; i < weights.size(); ++i) {
+            EXPECT_NEAR((double) counts[i] / (double) nbSamples, weights[i] / table.GetTotalWeight(), 1e-3);
+        }
+        EXPECT_EQ(counts[1], 0);
+        EXPECT_EQ(counts[4], 0);
+
+        AliasTable emptyTable(std::vector<double>{0.0, 0.0});
+        EXPECT_TRUE(emptyTable.empty());
+    }
+
+    TEST(FacetTriangulation, NonConvexPolygon) {
+        // L-shaped facet, clockwise order, unit square without its upper right quarter
+        std::vector<Vector2d> polygon{{0.0, 0.0}, {0.0, 1.0}, {0.5, 1.0}, {0.5, 0.5}, {1.0, 0.5}, {1.0, 0.0}};
+        FacetTriangulation triangulation;
+        ASSERT_TRUE(triangulation.Build(polygon));
+        EXPECT_EQ(triangulation.vertices.size(), 3 * (polygon.size() - 2));
+        EXPECT_NEAR(triangulation.areaAlias.GetTotalWeight(), 0.75, 1e-12);
+
+        // All samples inside, evenly spread over the three unit quarters
+        const size_t nbSamples = 30000;
+        size_t nbUpperLeft = 0;
+        for (size_t k = 0; k < nbSamples; ++k) {
+            double r = ((double) k + 0.5) / (double) nbSamples;
+            Vector2d uv = triangulation.SamplePoint(r, std::fmod(r * 7.31, 1.0), std::fmod(r * 13.17, 1.0));
+            ASSERT_GE(uv.u, -1e-12);
+            ASSERT_GE(uv.v, -1e-12);
+            ASSERT_FALSE(uv.u > 0.5 + 1e-12 && uv.v > 0.5 + 1e-12);
+            if (uv.v > 0.5) nbUpperLeft++;
+        }
+        EXPECT_NEAR((double) nbUpperLeft / (double) nbSamples, 1.0 / 3.0, 2e-2);
+
+        // Degenerate polygon is rejected, caller falls back to rejection sampling
+        EXPECT_FALSE(triangulation.Build({{0.0, 0.0}, {1.0, 0.0}, {2.0, 0.0}}));
+        EXPECT_TRUE(triangulation.empty());
+    }
+
+    TEST(SparseFacetResults, MergeInto) {
+        // Dense target: 2 facets, constant flow + 1 moment, 4 texture cells and profile slices
+        FacetMomentSnapshot snapshot{};
+        snapshot.texture.assign(4, TextureCell());
+        snapshot.profile.assign(4, ProfileSlice());
+        std::vector<FacetState> facetStates(2);
+        for (auto &state : facetStates)
+            state.momentResults.assign(2, snapshot);
+
+        SparseFacetResults sparse;
+        sparse.Texture(1, 0, 3).countEquiv += 1.0;
+        sparse.Texture(1, 0, 3).countEquiv += 2.0;
+        sparse.Texture(1, 1, 3).countEquiv += 0.5;
+        sparse.Profile(0, 0, 2).sum_v_ort += 4.0;
+        EXPECT_EQ(sparse.GetNbCells(), 3);
+
+        sparse.MergeInto(facetStates);
+        sparse.MergeInto(facetStates);
+        EXPECT_DOUBLE_EQ(facetStates[1].momentResults[0].texture[3].countEquiv, 6.0);
+        EXPECT_DOUBLE_EQ(facetStates[1].momentResults[1].texture[3].countEquiv, 1.0);
+        EXPECT_DOUBLE_EQ(facetStates[0].momentResults[0].profile[2].sum_v_ort, 8.0);
+        EXPECT_DOUBLE_EQ(facetStates[0].momentResults[0].texture[3].countEquiv, 0.0);
+
+        // Facet ranges, as merged in parallel by ResultMerger, only add their own cells
+        sparse.PrepareMerge();
+        sparse.MergeInto(facetStates, 1, 2);
+        EXPECT_DOUBLE_EQ(facetStates[1].momentResults[0].texture[3].countEquiv, 9.0);
+        EXPECT_DOUBLE_EQ(facetStates[0].momentResults[0].profile[2].sum_v_ort, 8.0);
+        sparse.MergeInto(facetStates, 0, 1);
+        EXPECT_DOUBLE_EQ(facetStates[1].momentResults[0].texture[3].countEquiv, 9.0);
+        EXPECT_DOUBLE_EQ(facetStates[0].momentResults[0].profile[2].sum_v_ort, 12.0);
+
+        sparse.clear();
+        EXPECT_TRUE(sparse.empty());
+
+        // The tables keep room for the cells of the previous period, recording as many again doesn't allocate
+        for (size_t i = 0; i < 1000; i++)
+            sparse.Texture(i % 2, i % 2, i % 4).countEquiv += 1.0;
+        for (size_t i = 0; i < 1000; i++)
+            sparse.Profile(i / 4 % 2, 0, i % 4).countEquiv += 1.0;
+        EXPECT_EQ(sparse.GetNbCells(), 4 + 8);
+        sparse.clear();
+        const size_t memSize = sparse.GetMemSize();
+        for (size_t i = 0; i < 1000; i++)
+            sparse.Profile(i / 4 % 2, 1, i % 4).countEquiv += 1.0;
+        sparse.Texture(0, 1, 2).countEquiv += 1.0;
+        EXPECT_EQ(sparse.GetNbCells(), 1 + 8);
+        EXPECT_EQ(sparse.GetMemSize(), memSize);
+    }
+
+    TEST(DirtyFacetTracker, MergesAndResetsOnlyDirtyEntries) {
+        DirtyFacetTracker dirty;
+        dirty.Resize(3, 1);
+        dirty.Mark(2, 1);
+        dirty.Mark(0, 0);
+        dirty.Mark(2, 1); // already marked
+        ASSERT_EQ(dirty.GetEntries().size(), 2);
+        EXPECT_EQ(dirty.GetEntries()[0], std::make_pair(size_t(2), size_t(1)));
+        EXPECT_EQ(dirty.GetEntries()[1], std::make_pair(size_t(0), size_t(0)));
+
+        // 3 facets, constant flow + 1 moment, every entry written to in the source
+        auto makeState = [](GlobalSimuState &state, double value) {
+            state.facetStates.resize(3);
+            for (auto &facetState : state.facetStates) {
+                facetState.momentResults.resize(2);
+                for (auto &snapshot : facetState.momentResults) {
+                    snapshot.hits.nbMCHit = (size_t) value;
+                    snapshot.texture.assign(4, TextureCell());
+                    snapshot.texture[1].countEquiv = value;
+                }
+                facetState.recordedAngleMapPdf.assign(2, (size_t) value);
+            }
+        };
+        GlobalSimuState src, dst;
+        makeState(src, 3.0);
+        makeState(dst, 0.0);
+
+        dst.MergeDirtyFacets(src, dirty, true);
+        EXPECT_EQ(dst.facetStates[2].momentResults[1].hits.nbMCHit, 3);
+        EXPECT_DOUBLE_EQ(dst.facetStates[2].momentResults[1].texture[1].countEquiv, 3.0);
+        EXPECT_EQ(dst.facetStates[0].momentResults[0].hits.nbMCHit, 3);
+        EXPECT_EQ(dst.facetStates[0].recordedAngleMapPdf[1], 3); // with moment 0
+        EXPECT_EQ(dst.facetStates[2].recordedAngleMapPdf[1], 0); // only moment 1 dirty
+        EXPECT_EQ(dst.facetStates[2].momentResults[0].hits.nbMCHit, 0);
+        EXPECT_EQ(dst.facetStates[1].momentResults[0].hits.nbMCHit, 0);
+        EXPECT_DOUBLE_EQ(dst.facetStates[1].momentResults[1].texture[1].countEquiv, 0.0);
+
+        src.ResetDirty(dirty);
+        EXPECT_EQ(src.facetStates[2].momentResults[1].hits.nbMCHit, 0);
+        EXPECT_DOUBLE_EQ(src.facetStates[2].momentResults[1].texture[1].countEquiv, 0.0);
+        EXPECT_EQ(src.facetStates[0].momentResults[0].hits.nbMCHit, 0);
+        EXPECT_EQ(src.facetStates[0].recordedAngleMapPdf[1], 0);
+        EXPECT_EQ(src.facetStates[2].recordedAngleMapPdf[1], 3);
+        EXPECT_EQ(src.facetStates[2].momentResults[0].hits.nbMCHit, 3);
+        EXPECT_EQ(src.facetStates[1].momentResults[1].hits.nbMCHit, 3);
+        EXPECT_DOUBLE_EQ(src.facetStates[0].momentResults[1].texture[1].countEquiv, 3.0);
+
+        // Entries can be marked again after clear
+        dirty.clear();
+        EXPECT_TRUE(dirty.empty());
+        dirty.Mark(2, 1);
+        EXPECT_EQ(dirty.GetEntries().size(), 1);
+    }
+
+    TEST(FacetResultArena, MatchesDenseLayout) {
+        std::string outPath = "TPath_FRA_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset",
+                                         "--file", "TestCases/B02-lr10_pipe_tex.zip", "--outputPath", outPath};
+        CharPVec argc_v(argv);
+        char **args = argc_v.data();
+        Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+        ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+
+        FacetResultArena arena;
+        arena.Resize(*model);
+        size_t nbCells = 0;
+        size_t texturedFacet = globState.facetStates.size();
+        for (size_t f = 0; f < globState.facetStates.size(); f++) {
+            for (const auto &snapshot : globState.facetStates[f].momentResults)
+                nbCells += snapshot.texture.size() + snapshot.profile.size() + snapshot.direction.size();
+            if (texturedFacet == globState.facetStates.size() && globState.facetStates[f].momentResults[0].texture.size() > 1)
+                texturedFacet = f;
+        }
+        EXPECT_EQ(arena.GetNbCells(), nbCells);
+        ASSERT_LT(texturedFacet, globState.facetStates.size());
+
+        // Cells of different facets do not overlap, merge adds to the dense snapshot
+        const size_t lastCell = globState.facetStates[texturedFacet].momentResults[0].texture.size() - 1;
+        arena.Texture(texturedFacet, 0, 0).countEquiv += 1.0;
+        arena.Texture(texturedFacet, 0, lastCell).countEquiv += 2.0;
+        for (size_t f = 0; f < globState.facetStates.size(); f++) {
+            if (f != texturedFacet && !globState.facetStates[f].momentResults[0].texture.empty())
+                arena.Texture(f, 0, 0).countEquiv += 10.0;
+        }
+        auto &snapshot = globState.facetStates[texturedFacet].momentResults[0];
+        const double before = snapshot.texture[0].countEquiv;
+        arena.MergeFacetMoment(snapshot, texturedFacet, 0);
+        EXPECT_DOUBLE_EQ(snapshot.texture[0].countEquiv, before + 1.0);
+        EXPECT_DOUBLE_EQ(arena.Texture(texturedFacet, 0, lastCell).countEquiv, 2.0);
+
+        arena.ResetFacetMoment(texturedFacet, 0);
+        EXPECT_DOUBLE_EQ(arena.Texture(texturedFacet, 0, 0).countEquiv, 0.0);
+        EXPECT_DOUBLE_EQ(arena.Texture(texturedFacet, 0, lastCell).countEquiv, 0.0);
+        for (size_t f = 0; f < globState.facetStates.size(); f++) {
+            if (f != texturedFacet && !globState.facetStates[f].momentResults[0].texture.empty())
+                EXPECT_DOUBLE_EQ(arena.Texture(f, 0, 0).countEquiv, 10.0);
+        }
+        arena.Reset();
+        for (size_t f = 0; f < globState.facetStates.size(); f++) {
+            if (!globState.facetStates[f].momentResults[0].texture.empty())
+                EXPECT_DOUBLE_EQ(arena.Texture(f, 0, 0).countEquiv, 0.0);
+        }
+
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(FacetResultArena, SparseAboveBudget) {
+        std::string outPath = "TPath_FRB_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset",
+                                         "--file", "TestCases/B02-lr10_pipe_tex.zip", "--outputPath", outPath};
+        CharPVec argc_v(argv);
+        char **args = argc_v.data();
+        Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+        ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+        ASSERT_FALSE(model->sparseThreadResults);
+        ASSERT_GT(FacetResultArena::GetDenseSize(*model), 0);
+
+        // Threads would need more than the budget for their dense cells
+        model->denseThreadResultsBudget = FacetResultArena::GetDenseSize(*model) - 1;
+        Simulation sim;
+        sim.model = model;
+        sim.globState = &globState;
+        sim.SetNParticle(1, true);
+        char loadStatus[128];
+        ASSERT_EQ(sim.LoadSimulation(loadStatus), 0);
+        EXPECT_TRUE(model->sparseThreadResults);
+        MFSim::Particle *particle = sim.GetParticle(0);
+        EXPECT_TRUE(particle->tmpCells.empty());
+
+        particle->SimulationMCStep(1000, 0, 0);
+        ASSERT_TRUE(particle->UpdateHits(&globState, nullptr, 1000));
+        EXPECT_GT(globState.globalHits.globalHits.nbMCHit, 0);
+
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(TiledCells, AllocatesOnFirstWrite) {
+        const size_t nbCells = 5 * TiledCells<TextureCell>::tileSize + 3; // last tile partially used
+        TiledCells<TextureCell> cells;
+        cells.assign(nbCells, TextureCell());
+        const auto &readOnly = cells;
+        EXPECT_EQ(cells.size(), nbCells);
+        EXPECT_DOUBLE_EQ(readOnly[nbCells - 1].countEquiv, 0.0);
+        EXPECT_EQ(cells.GetNbAllocatedTiles(), 0);
+
+        cells[nbCells - 1].countEquiv = 2.0;
+        EXPECT_EQ(cells.GetNbAllocatedTiles(), 1);
+
+        // Dense merge only allocates tiles with hits
+        std::vector<TextureCell> dense(nbCells);
+        dense[1].countEquiv = 1.0;
+        dense[nbCells - 1].countEquiv = 1.0;
+        cells.AddRange(dense.data());
+        EXPECT_EQ(cells.GetNbAllocatedTiles(), 2);
+        EXPECT_DOUBLE_EQ(readOnly[1].countEquiv, 1.0);
+        EXPECT_DOUBLE_EQ(readOnly[nbCells - 1].countEquiv, 3.0);
+
+        TiledCells<TextureCell> sum = cells;
+        sum += cells;
+        EXPECT_EQ(sum.GetNbAllocatedTiles(), 2);
+        const std::vector<TextureCell> flat = sum.ToVector();
+        ASSERT_EQ(flat.size(), nbCells);
+        for (size_t i = 0; i < nbCells; i++)
+            EXPECT_DOUBLE_EQ(flat[i].countEquiv, 2.0 * readOnly[i].countEquiv);
+
+        // Tiles written with zeros only, e.g. by a file loader, are released again
+        sum[3 * TiledCells<TextureCell>::tileSize].countEquiv = 0.0;
+        EXPECT_EQ(sum.GetNbAllocatedTiles(), 3);
+        sum.Compact();
+        EXPECT_EQ(sum.GetNbAllocatedTiles(), 2);
+
+        sum.Reset();
+        EXPECT_EQ(sum.GetNbAllocatedTiles(), 0);
+        EXPECT_EQ(sum.size(), nbCells);
+        EXPECT_DOUBLE_EQ(sum.ToVector()[1].countEquiv, 0.0);
+    }
+
+    TEST(StateBinary, RoundTrip) {
+        MolflowSimulationModel model;
+        GlobalSimuState state;
+        state.globalHits.globalHits.nbMCHit = 1234;
+        state.globalHits.globalHits.nbDesorbed = 56;
+        state.facetStates.resize(3);
+        for (auto &facetState : state.facetStates) {
+            facetState.momentResults.resize(1);
+            facetState.momentResults[0].texture.assign(16, TextureCell());
+        }
+        state.facetStates[2].momentResults[0].hits.nbMCHit = 42;
+        state.facetStates[2].momentResults[0].texture[5].countEquiv = 3.5;
+
+        std::string fileName = std::filesystem::temp_directory_path()
+                .append("stateBinary_" + std::to_string(std::hash<std::string>{}(std::to_string(std::time(nullptr)))))
+                .string();
+        ASSERT_TRUE(FlowIO::StateBinary::Save(fileName, model, state));
+
+        {
+            FlowIO::StateBinaryReader reader;
+            ASSERT_TRUE(reader.Open(fileName));
+            EXPECT_EQ(reader.GetNbFacets(), 3);
+            EXPECT_EQ(reader.GetNbMoments(), 0);
+
+            GlobalSimuState loaded;
+            ASSERT_TRUE(reader.LoadGlobal(loaded));
+            EXPECT_EQ(loaded.globalHits.globalHits.nbMCHit, 1234);
+            EXPECT_EQ(loaded.globalHits.globalHits.nbDesorbed, 56);
+
+            // Single facet only, without reading the others
+            FacetState facetState;
+            ASSERT_TRUE(reader.LoadFacet(2, facetState));
+            ASSERT_EQ(facetState.momentResults.size(), 1);
+            EXPECT_EQ(facetState.momentResults[0].hits.nbMCHit, 42);
+            ASSERT_EQ(facetState.momentResults[0].texture.size(), 16);
+            EXPECT_DOUBLE_EQ(facetState.momentResults[0].texture[5].countEquiv, 3.5);
+            EXPECT_FALSE(reader.LoadFacet(3, facetState));
+        }
+
+        // Facets whose cell counts differ from the stored ones are rejected without touching the state
+        {
+            auto geometry = std::make_shared<MolflowSimulationModel>();
+            for (size_t i = 0; i < 3; i++) {
+                auto facet = std::make_shared<MolflowSimFacet>();
+                facet->globalId = i;
+                facet->sh.isTextured = true;
+                facet->sh.texWidth = 4;
+                facet->sh.texHeight = 4;
+                facet->sh.isProfile = false;
+                facet->sh.countDirection = false;
+                facet->sh.anglemapParams.record = false;
+                geometry->facets.push_back(facet);
+            }
+            FlowIO::StateBinaryReader reader;
+            ASSERT_TRUE(reader.Open(fileName));
+            GlobalSimuState loaded;
+            ASSERT_EQ(reader.LoadAll(geometry, loaded), 0);
+            EXPECT_EQ(loaded.facetStates[2].momentResults[0].hits.nbMCHit, 42);
+
+            geometry->facets[1]->sh.texWidth = 2;
+            GlobalSimuState rejected;
+            EXPECT_EQ(reader.LoadAll(geometry, rejected), 1);
+            EXPECT_TRUE(rejected.facetStates.empty());
+        }
+
+        // Truncated files are rejected
+        std::filesystem::resize_file(fileName, std::filesystem::file_size(fileName) - 1);
+        FlowIO::StateBinaryReader reader;
+        EXPECT_FALSE(reader.Open(fileName));
+        std::filesystem::remove(fileName);
+    }
+
+    TEST(StateJournal, ReplayOnSnapshot) {
+        MolflowSimulationModel model;
+        GlobalSimuState state;
+        state.facetStates.resize(4);
+        for (auto &facetState : state.facetStates) {
+            facetState.momentResults.resize(2);
+            facetState.momentResults[0].texture.assign(4, TextureCell());
+        }
+
+        std::string xmlFileName = std::filesystem::temp_directory_path()
+                .append("stateJournal_" + std::to_string(std::hash<std::string>{}(std::to_string(std::time(nullptr)))) + ".xml")
+                .string();
+        FlowIO::StateJournal journal(xmlFileName, 10);
+
+        // States without a journal, e.g. thread states, do not track merged entries
+        DirtyFacetTracker dirty;
+        dirty.Resize(4, 1);
+        dirty.Mark(1, 0);
+        state.MarkChanged(dirty);
+        state.Reset();
+        EXPECT_FALSE(state.trackChanges);
+        EXPECT_FALSE(state.changedFacets.Fits(4, 1));
+
+        // First checkpoint is a full snapshot
+        ASSERT_TRUE(journal.Checkpoint(model, state));
+        EXPECT_EQ(journal.GetNbRecords(), 0);
+        EXPECT_TRUE(state.trackChanges);
+
+        // Deltas only contain the facet moments marked as changed, as merging thread results does
+        state.globalHits.globalHits.nbMCHit = 10;
+        state.facetStates[1].momentResults[0].hits.nbMCHit = 7;
+        state.facetStates[1].momentResults[0].texture[2].countEquiv = 7.0;
+        state.changedFacets.Mark(1, 0);
+        ASSERT_TRUE(journal.Checkpoint(model, state));
+        EXPECT_TRUE(state.changedFacets.empty());
+        state.globalHits.globalHits.nbMCHit = 20;
+        state.facetStates[3].momentResults[1].hits.nbMCHit = 3;
+        state.changedFacets.Mark(3, 1);
+        ASSERT_TRUE(journal.Checkpoint(model, state));
+        EXPECT_EQ(journal.GetNbRecords(), 2);
+
+        FlowIO::StateBinaryReader reader;
+        ASSERT_TRUE(reader.Open(FlowIO::StateBinary::GetSidecarName(xmlFileName)));
+        GlobalSimuState restored;
+        restored.facetStates.resize(reader.GetNbFacets());
+        ASSERT_TRUE(reader.LoadGlobal(restored));
+        for (size_t i = 0; i < reader.GetNbFacets(); i++)
+            ASSERT_TRUE(reader.LoadFacet(i, restored.facetStates[i]));
+        EXPECT_EQ(restored.globalHits.globalHits.nbMCHit, 0);
+        const uint64_t snapshotId = reader.GetSnapshotId();
+        reader.Close();
+
+        ASSERT_EQ(FlowIO::StateJournal::Replay(FlowIO::StateJournal::GetJournalName(xmlFileName), snapshotId, model,
+                                               restored), 0);
+        EXPECT_EQ(restored.globalHits.globalHits.nbMCHit, 20);
+        EXPECT_EQ(restored.facetStates[1].momentResults[0].hits.nbMCHit, 7);
+        EXPECT_DOUBLE_EQ(restored.facetStates[1].momentResults[0].texture[2].countEquiv, 7.0);
+        EXPECT_EQ(restored.facetStates[3].momentResults[1].hits.nbMCHit, 3);
+
+        // A sidecar rewritten outside the journal (e.g. FlowCLI --binaryState) invalidates the old journal
+        state.globalHits.globalHits.nbMCHit = 50;
+        uint64_t newSnapshotId = 0;
+        ASSERT_TRUE(FlowIO::StateBinary::Save(FlowIO::StateBinary::GetSidecarName(xmlFileName), model, state,
+                                              &newSnapshotId));
+        EXPECT_NE(newSnapshotId, snapshotId);
+        ASSERT_TRUE(reader.Open(FlowIO::StateBinary::GetSidecarName(xmlFileName)));
+        EXPECT_EQ(reader.GetSnapshotId(), newSnapshotId);
+        GlobalSimuState reloaded;
+        reloaded.facetStates.resize(reader.GetNbFacets());
+        ASSERT_TRUE(reader.LoadGlobal(reloaded));
+        for (size_t i = 0; i < reader.GetNbFacets(); i++)
+            ASSERT_TRUE(reader.LoadFacet(i, reloaded.facetStates[i]));
+        reader.Close();
+        ASSERT_EQ(FlowIO::StateJournal::Replay(FlowIO::StateJournal::GetJournalName(xmlFileName), newSnapshotId, model,
+                                               reloaded), 0);
+        EXPECT_EQ(reloaded.globalHits.globalHits.nbMCHit, 50);
+
+        std::filesystem::remove(FlowIO::StateBinary::GetSidecarName(xmlFileName));
+        std::filesystem::remove(FlowIO::StateJournal::GetJournalName(xmlFileName));
+    }
+
+    TEST(StateJournal, RejectsBadRecords) {
+        MolflowSimulationModel model;
+        GlobalSimuState state;
+        state.facetStates.resize(2);
+        for (auto &facetState : state.facetStates) {
+            facetState.momentResults.resize(1);
+            facetState.momentResults[0].texture.assign(4, TextureCell());
+        }
+
+        std::string xmlFileName = std::filesystem::temp_directory_path()
+                .append("stateJournalBR_" + std::to_string(std::hash<std::string>{}(std::to_string(std::time(nullptr)))) + ".xml")
+                .string();
+        const std::string journalFileName = FlowIO::StateJournal::GetJournalName(xmlFileName);
+        auto loadSnapshot = [&xmlFileName](GlobalSimuState &loaded, uint64_t &snapshotId) {
+            FlowIO::StateBinaryReader reader;
+            ASSERT_TRUE(reader.Open(FlowIO::StateBinary::GetSidecarName(xmlFileName)));
+            loaded.facetStates.resize(reader.GetNbFacets());
+            ASSERT_TRUE(reader.LoadGlobal(loaded));
+            for (size_t i = 0; i < reader.GetNbFacets(); i++)
+                ASSERT_TRUE(reader.LoadFacet(i, loaded.facetStates[i]));
+            snapshotId = reader.GetSnapshotId();
+        };
+
+        FlowIO::StateJournal journal(xmlFileName, 10);
+        ASSERT_TRUE(journal.Checkpoint(model, state));
+        state.facetStates[0].momentResults[0].hits.nbMCHit = 5;
+        state.changedFacets.Mark(0, 0);
+        ASSERT_TRUE(journal.Checkpoint(model, state));
+
+        // A length beyond the end of the file is an incomplete last record, nothing is allocated for it
+        {
+            std::ofstream out(journalFileName, std::ios::binary | std::ios::app);
+            const uint64_t blobSize = uint64_t(1) << 60;
+            out.write(reinterpret_cast<const char *>(&blobSize), sizeof(blobSize));
+        }
+        GlobalSimuState restored;
+        uint64_t snapshotId = 0;
+        loadSnapshot(restored, snapshotId);
+        ASSERT_EQ(FlowIO::StateJournal::Replay(journalFileName, snapshotId, model, restored), 0);
+        EXPECT_EQ(restored.facetStates[0].momentResults[0].hits.nbMCHit, 5);
+
+        // A record not matching the snapshot layout rejects the journal, earlier records are not applied either
+        state.Reset();
+        ASSERT_TRUE(journal.Checkpoint(model, state));
+        EXPECT_EQ(journal.GetNbRecords(), 0);
+        state.facetStates[0].momentResults[0].hits.nbMCHit = 6;
+        state.changedFacets.Mark(0, 0);
+        ASSERT_TRUE(journal.Checkpoint(model, state));
+        state.facetStates[1].momentResults[0].texture.assign(8, TextureCell());
+        state.changedFacets.Mark(1, 0);
+        ASSERT_TRUE(journal.Checkpoint(model, state));
+        EXPECT_EQ(journal.GetNbRecords(), 2);
+
+        GlobalSimuState reloaded;
+        loadSnapshot(reloaded, snapshotId);
+        EXPECT_EQ(FlowIO::StateJournal::Replay(journalFileName, snapshotId, model, reloaded), 1);
+        EXPECT_EQ(reloaded.facetStates[0].momentResults[0].hits.nbMCHit, 0);
+        EXPECT_EQ(reloaded.facetStates[1].momentResults[0].texture.size(), 4);
+
+        std::filesystem::remove(FlowIO::StateBinary::GetSidecarName(xmlFileName));
+        std::filesystem::remove(journalFileName);
+    }
+
+    TEST(StateJournal, ReplaysAngleMaps) {
+        auto model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState state;
+        state.facetStates.resize(2);
+        for (size_t i = 0; i < 2; i++) {
+            auto facet = std::make_shared<MolflowSimFacet>();
+            facet->globalId = i;
+            facet->sh.anglemapParams.record = true;
+            facet->sh.anglemapParams.phiWidth = 2;
+            facet->sh.anglemapParams.thetaLowerRes = 2;
+            facet->sh.anglemapParams.thetaHigherRes = 2;
+            model->facets.push_back(facet);
+            state.facetStates[i].momentResults.resize(1);
+            state.facetStates[i].recordedAngleMapPdf.assign(8, 0);
+        }
+
+        std::string xmlFileName = std::filesystem::temp_directory_path()
+                .append("stateJournalAM_" + std::to_string(std::hash<std::string>{}(std::to_string(std::time(nullptr)))) + ".xml")
+                .string();
+        FlowIO::StateJournal journal(xmlFileName, 10);
+        ASSERT_TRUE(journal.Checkpoint(*model, state));
+        state.facetStates[1].recordedAngleMapPdf[3] = 5;
+        state.changedFacets.Mark(1, 0);
+        ASSERT_TRUE(journal.Checkpoint(*model, state));
+        EXPECT_EQ(journal.GetNbRecords(), 1);
+
+        // Reload like Initializer::loadSimulationState: snapshot, then journal
+        GlobalSimuState restored;
+        uint64_t snapshotId = 0;
+        {
+            FlowIO::StateBinaryReader reader;
+            ASSERT_TRUE(reader.Open(FlowIO::StateBinary::GetSidecarName(xmlFileName)));
+            ASSERT_EQ(reader.LoadAll(model, restored), 0);
+            snapshotId = reader.GetSnapshotId();
+        }
+        auto facet = std::dynamic_pointer_cast<MolflowSimFacet>(model->facets[1]);
+        ASSERT_EQ(facet->angleMap.pdf.size(), 8);
+        EXPECT_EQ(facet->angleMap.pdf[3], 0);
+        ASSERT_EQ(FlowIO::StateJournal::Replay(FlowIO::StateJournal::GetJournalName(xmlFileName), snapshotId, *model,
+                                               restored), 0);
+
+        // The facet angle map, which the loader copies back into the state, holds the journaled hits
+        ASSERT_EQ(facet->angleMap.pdf.size(), 8);
+        EXPECT_EQ(facet->angleMap.pdf[3], 5);
+        EXPECT_EQ(restored.facetStates[1].recordedAngleMapPdf[3], 5);
+
+        // A reset is not tracked per entry, the next checkpoint is a snapshot again
+        state.Reset();
+        ASSERT_TRUE(journal.Checkpoint(*model, state));
+        EXPECT_EQ(journal.GetNbRecords(), 0);
+
+        std::filesystem::remove(FlowIO::StateBinary::GetSidecarName(xmlFileName));
+        std::filesystem::remove(FlowIO::StateJournal::GetJournalName(xmlFileName));
+    }
+
+    TEST(AsyncStateWriter, SerializesSnapshot) {
+        GlobalSimuState state;
+        state.facetStates.resize(2);
+        state.globalHits.globalHits.nbMCHit = 5;
+
+        std::mutex releaseMutex;
+        releaseMutex.lock();
+        size_t writtenHits = 0;
+        {
+            FlowIO::AsyncStateWriter writer;
+            ASSERT_TRUE(writer.Submit([&](GlobalSimuState &snapshot) {
+                std::lock_guard<std::mutex> release(releaseMutex); // keep the writer busy
+                writtenHits = snapshot.globalHits.globalHits.nbMCHit;
+            }, state, false));
+
+            // Live state can change while the snapshot is written, the state lock is free again
+            ASSERT_TRUE(state.tMutex.try_lock());
+            state.globalHits.globalHits.nbMCHit = 10;
+            state.tMutex.unlock();
+
+            // Busy writer drops a non-blocking job
+            EXPECT_FALSE(writer.Submit([](GlobalSimuState &) {}, state, false));
+            releaseMutex.unlock();
+            writer.Wait();
+            EXPECT_FALSE(writer.IsBusy());
+        }
+        EXPECT_EQ(writtenHits, 5);
+    }
+
+    TEST(MomentIndex, MatchesLinearSearch) {
+        auto linearLookup = [](double time, const std::vector<Moment> &moments) {
+            for (size_t i = 0; i < moments.size(); ++i) {
+                if (time >= moments[i].first - 0.5 * moments[i].second &&
+                    time < moments[i].first + 0.5 * moments[i].second)
+                    return static_cast<int>(i + 1);
+            }
+            return -1;
+        };
+
+        // Uniform series with gaps, and log-spaced windows over six decades
+        std::vector<Moment> uniform, logSpaced;
+        for (size_t i = 0; i < 100; ++i) uniform.emplace_back(0.1 + 0.1 * (double) i, 0.05);
+        for (size_t i = 0; i < 60; ++i) {
+            double begin = 1e-6 * std::pow(10.0, (double) i / 10.0);
+            double end = 1e-6 * std::pow(10.0, (double) (i + 1) / 10.0);
+            logSpaced.emplace_back(0.5 * (begin + end), end - begin);
+        }
+
+        for (const auto &moments : {uniform, logSpaced}) {
+            MomentIndex index;
+            index.Build(moments);
+            const double tMin = moments.front().first - moments.front().second;
+            const double tMax = moments.back().first + moments.back().second;
+            for (size_t k = 0; k < 20000; ++k) {
+                double time = tMin + (tMax - tMin) * std::pow((double) k / 20000.0, 3.0);
+                ASSERT_EQ(index.Lookup(time, moments), linearLookup(time, moments)) << "time " << time;
+            }
+            // Boundaries: start is inclusive, end is exclusive
+            for (size_t i = 0; i < moments.size(); ++i) {
+                double start = moments[i].first - 0.5 * moments[i].second;
+                ASSERT_EQ(index.Lookup(start, moments), linearLookup(start, moments));
+            }
+            EXPECT_LE(index.GetMaxBucketLoad(), 2);
+        }
+
+        MomentIndex logIndex;
+        logIndex.Build(logSpaced);
+        EXPECT_EQ(logIndex.GetGridType(), MomentIndex::GridType::Logarithmic);
+
+        // Index built for other moments falls back to binary search
+        EXPECT_EQ(logIndex.Lookup(0.42, uniform), linearLookup(0.42, uniform));
+    }
+
+    TEST(MomentIndex, OverlappingMoments) {
+        // Fine and coarse series over the same time range, windows of the second series overlap each other
+        std::vector<UserMoment> userMoments{{"0.05,0.1,0.95", 0.1}, {"0.25,0.25,1", 0.5}};
+        std::vector<Moment> moments;
+        ASSERT_EQ(TimeMoments::ParseAndCheckUserMoments(&moments, &userMoments, nullptr), 0);
+        ASSERT_EQ(moments.size(), 10 + 4);
+
+        MomentIndex index;
+        index.Build(moments);
+        for (size_t k = 0; k < 1000; ++k) {
+            const double time = 1.3 * (double) k / 1000.0;
+            std::vector<int> expected;
+            for (size_t i = 0; i < moments.size(); ++i) {
+                if (time >= moments[i].first - 0.5 * moments[i].second &&
+                    time < moments[i].first + 0.5 * moments[i].second)
+                    expected.push_back(static_cast<int>(i + 1));
+            }
+            std::vector<int> found{0};
+            EXPECT_EQ(index.LookupAll(time, moments, found), expected.size());
+            expected.insert(expected.begin(), 0);
+            ASSERT_EQ(found, expected) << "time " << time;
+        }
+
+        // Every time within [0,1[ is in one fine moment and one or two coarse ones
+        std::vector<int> found;
+        EXPECT_EQ(index.LookupAll(0.4, moments, found), 3);
+
+        // Invalid expressions are still rejected
+        std::vector<UserMoment> invalidMoments{{"1,-0.1,0", 0.1}};
+        EXPECT_EQ(TimeMoments::ParseAndCheckUserMoments(&moments, &invalidMoments, nullptr), 1);
+    }
+
+    TEST(WideBVH, MatchesBinaryBVH) {
+        std::string outPath = "TPath_WB_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        {
+            std::vector<std::string> argv = {"tester", "--config", "simulation.cfg", "--reset",
+                                             "--file", "TestCases/B01-lr1000_pipe.zip", "--outputPath", outPath};
+            CharPVec argc_v(argv);
+            char **args = argc_v.data();
+            Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+            ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+        }
+        ASSERT_EQ(model->BuildAccelStructure(nullptr, BVH, BVHAccel::SplitMethod::SAH, 2), 0);
+
+        std::vector<SimulationFacet *> facets;
+        for (auto &facet : model->facets) {
+            if (facet->sh.superIdx == -1 || facet->sh.superIdx == 0)
+                facets.push_back(facet.get());
+        }
+        WideBVHAccel wide(facets, 2);
+        ASSERT_GT(wide.GetNbNodes(), 0);
+
+        // Same rays from the facet centers through both structures, as single rays and as one packet
+        MersenneTwister rng;
+        rng.SetSeed(42);
+        const size_t nbRays = 1000;
+        std::vector<Ray> reference(nbRays), single(nbRays), packet(nbRays);
+        std::vector<Ray *> packetPtrs;
+        for (size_t r = 0; r < nbRays; ++r) {
+            const SimulationFacet *facet = facets[r % facets.size()];
+            Ray ray;
+            ray.origin = facet->sh.O + 0.5 * facet->sh.U + 0.5 * facet->sh.V;
+            const double theta = std::acos(2.0 * rng.rnd() - 1.0);
+            const double phi = 2.0 * std::acos(-1.0) * rng.rnd();
+            ray.direction = Vector3d(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+            ray.tMax = 1.0e99;
+            ray.lastIntersected = facet->globalId;
+            ray.pay = nullptr;
+            ray.rng = &rng;
+            reference[r] = single[r] = packet[r] = ray;
+            packetPtrs.push_back(&packet[r]);
+        }
+        std::unique_ptr<bool[]> packetFound(new bool[nbRays]);
+        wide.IntersectPacket(packetPtrs.data(), nbRays, packetFound.get());
+        for (size_t r = 0; r < nbRays; ++r) {
+            const bool refFound = model->accel.front()->Intersect(reference[r]);
+            ASSERT_EQ(wide.Intersect(single[r]), refFound);
+            ASSERT_EQ(packetFound[r], refFound);
+            if (refFound) {
+                EXPECT_EQ(single[r].hardHit.hitId, reference[r].hardHit.hitId);
+                EXPECT_EQ(packet[r].hardHit.hitId, reference[r].hardHit.hitId);
+                EXPECT_DOUBLE_EQ(single[r].tMax, reference[r].tMax);
+            }
+        }
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(WideBVH, ParallelBuildMatchesSerialBuild) {
+        std::string outPath = "TPath_WBP_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        {
+            std::vector<std::string> argv = {"tester", "--config", "simulation.cfg", "--reset",
+                                             "--file", "TestCases/B01-lr1000_pipe.zip", "--outputPath", outPath};
+            CharPVec argc_v(argv);
+            char **args = argc_v.data();
+            Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+            ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+        }
+
+        // Per-structure parallel build through the model
+        model->wideAccel = true;
+        model->accelBuildThreads = 4;
+        ASSERT_EQ(model->BuildAccelStructure(nullptr, BVH, BVHAccel::SplitMethod::SAH, 2), 0);
+        ASSERT_EQ(model->accel.size(), model->sh.nbSuper);
+        for (const auto &accel : model->accel)
+            EXPECT_NE(std::dynamic_pointer_cast<WideBVHAccel>(accel), nullptr);
+
+        // Repeated facets, so that subtrees and splits are large enough to be built by several tasks
+        std::vector<SimulationFacet *> facets;
+        while (facets.size() < 100000) {
+            for (auto &facet : model->facets)
+                facets.push_back(facet.get());
+        }
+        WideBVHAccel serial(facets, 2, 1);
+        WideBVHAccel parallel(facets, 2, 4);
+        EXPECT_EQ(parallel.GetNbNodes(), serial.GetNbNodes());
+        EXPECT_EQ(parallel.GetMaxDepth(), serial.GetMaxDepth());
+
+        MersenneTwister rng;
+        rng.SetSeed(42);
+        for (size_t r = 0; r < 1000; ++r) {
+            const SimulationFacet *facet = model->facets[r % model->facets.size()].get();
+            Ray ray;
+            ray.origin = facet->sh.O + 0.5 * facet->sh.U + 0.5 * facet->sh.V;
+            const double theta = std::acos(2.0 * rng.rnd() - 1.0);
+            const double phi = 2.0 * std::acos(-1.0) * rng.rnd();
+            ray.direction = Vector3d(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+            ray.tMax = 1.0e99;
+            ray.lastIntersected = facet->globalId;
+            ray.pay = nullptr;
+            ray.rng = &rng;
+            Ray serialRay = ray;
+            const bool found = serial.Intersect(serialRay);
+            ASSERT_EQ(parallel.Intersect(ray), found);
+            if (found) {
+                EXPECT_EQ(ray.hardHit.hitId, serialRay.hardHit.hitId);
+                EXPECT_DOUBLE_EQ(ray.tMax, serialRay.tMax);
+            }
+        }
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(WideBVH, CompactMatchesFullPrecision) {
+        std::string outPath = "TPath_WBC_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        {
+            std::vector<std::string> argv = {"tester", "--config", "simulation.cfg", "--reset", "--wideBVH", "--compactBVH",
+                                             "--file", "TestCases/B01-lr1000_pipe.zip", "--outputPath", outPath};
+            CharPVec argc_v(argv);
+            char **args = argc_v.data();
+            Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+            ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+        }
+        ASSERT_TRUE(model->compactAccel);
+        ASSERT_EQ(model->BuildAccelStructure(nullptr, BVH, BVHAccel::SplitMethod::SAH, 2), 0);
+        for (const auto &accel : model->accel) {
+            auto wide = std::dynamic_pointer_cast<WideBVHAccel>(accel);
+            ASSERT_NE(wide, nullptr);
+            EXPECT_TRUE(wide->IsCompact());
+        }
+
+        std::vector<SimulationFacet *> facets;
+        for (auto &facet : model->facets)
+            facets.push_back(facet.get());
+        WideBVHAccel full(facets, 2);
+        WideBVHAccel compact(facets, 2);
+        ASSERT_TRUE(compact.Compact());
+        EXPECT_EQ(compact.GetNbNodes(), full.GetNbNodes());
+        EXPECT_LT(compact.GetMemSize(), full.GetMemSize());
+
+        // Written and read back in the compact layout
+        std::stringstream stream;
+        compact.Write(stream);
+        std::vector<SimulationFacet *> facetsById(model->facets.size(), nullptr);
+        for (auto &facet : model->facets)
+            facetsById[facet->globalId] = facet.get();
+        WideBVHAccel loaded;
+        ASSERT_TRUE(loaded.Read(stream, facetsById));
+        EXPECT_TRUE(loaded.IsCompact());
+
+        // Decoded boxes enclose the original ones, facets are intersected in double precision: same hits
+        MersenneTwister rng;
+        rng.SetSeed(42);
+        for (size_t r = 0; r < 1000; ++r) {
+            const SimulationFacet *facet = facets[r % facets.size()];
+            Ray ray;
+            ray.origin = facet->sh.O + 0.5 * facet->sh.U + 0.5 * facet->sh.V;
+            const double theta = std::acos(2.0 * rng.rnd() - 1.0);
+            const double phi = 2.0 * std::acos(-1.0) * rng.rnd();
+            ray.direction = Vector3d(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+            ray.tMax = 1.0e99;
+            ray.lastIntersected = facet->globalId;
+            ray.pay = nullptr;
+            ray.rng = &rng;
+            Ray fullRay = ray;
+            Ray loadedRay = ray;
+            const bool found = full.Intersect(fullRay);
+            ASSERT_EQ(compact.Intersect(ray), found);
+            ASSERT_EQ(loaded.Intersect(loadedRay), found);
+            if (found) {
+                EXPECT_EQ(ray.hardHit.hitId, fullRay.hardHit.hitId);
+                EXPECT_DOUBLE_EQ(ray.tMax, fullRay.tMax);
+                EXPECT_EQ(loadedRay.hardHit.hitId, fullRay.hardHit.hitId);
+            }
+        }
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(AccelCache, ReusedForSameGeometry) {
+        std::string outPath = "TPath_AC_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        {
+            std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset", "--wideBVH",
+                                             "--file", "TestCases/B01-lr1000_pipe.zip", "--outputPath", outPath};
+            CharPVec argc_v(argv);
+            char **args = argc_v.data();
+            Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+            ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+        }
+        const std::string cacheFile = outPath + "/accel.cache";
+        model->accelCacheFile = cacheFile;
+        ASSERT_EQ(model->BuildAccelStructure(nullptr, BVH, BVHAccel::SplitMethod::SAH, 2), 0);
+        ASSERT_TRUE(std::filesystem::exists(cacheFile));
+        auto built = std::dynamic_pointer_cast<WideBVHAccel>(model->accel.front());
+        ASSERT_NE(built, nullptr);
+
+        // Same geometry: trees are loaded, sticking or opacity do not take part in the key
+        const uint64_t key = FlowIO::AccelCache::ComputeKey(*model, static_cast<int>(BVHAccel::SplitMethod::SAH), 2);
+        model->facets.front()->sh.sticking = 0.5;
+        EXPECT_EQ(FlowIO::AccelCache::ComputeKey(*model, static_cast<int>(BVHAccel::SplitMethod::SAH), 2), key);
+        EXPECT_NE(FlowIO::AccelCache::ComputeKey(*model, static_cast<int>(BVHAccel::SplitMethod::SAH), 4), key);
+        model->accel.clear();
+        ASSERT_TRUE(FlowIO::AccelCache::Load(cacheFile, key, *model));
+        ASSERT_EQ(model->accel.size(), model->sh.nbSuper);
+        auto loaded = std::dynamic_pointer_cast<WideBVHAccel>(model->accel.front());
+        ASSERT_NE(loaded, nullptr);
+        EXPECT_EQ(loaded->GetNbNodes(), built->GetNbNodes());
+        EXPECT_EQ(loaded->GetNbPrimitives(), built->GetNbPrimitives());
+
+        // Moved geometry: the cache is ignored and the model keeps its structures
+        model->vertices3.front().x += 1.0;
+        const uint64_t movedKey = FlowIO::AccelCache::ComputeKey(*model, static_cast<int>(BVHAccel::SplitMethod::SAH), 2);
+        EXPECT_NE(movedKey, key);
+        EXPECT_FALSE(FlowIO::AccelCache::Load(cacheFile, movedKey, *model));
+        EXPECT_EQ(model->accel.front(), loaded);
+
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(MolflowSimulationModel, RefreshSurfacesKeepsAccel) {
+        std::string outPath = "TPath_RS_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        {
+            std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset",
+                                             "--file", "TestCases/B01-lr1000_pipe.zip", "--outputPath", outPath};
+            CharPVec argc_v(argv);
+            char **args = argc_v.data();
+            Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+            ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+        }
+        ASSERT_EQ(model->BuildAccelStructure(nullptr, BVH, BVHAccel::SplitMethod::SAH, 2), 0);
+        const auto accel = model->accel;
+
+        // Find a desorbing facet to change its outgassing
+        auto source = std::find_if(model->facets.begin(), model->facets.end(), [](const auto &f) {
+            return f->sh.desorbType != DES_NONE && !f->sh.useOutgassingFile && f->sh.outgassing_paramId == -1;
+        });
+        ASSERT_NE(source, model->facets.end());
+        const double rate = model->wp.finalOutgassingRate;
+        (*source)->sh.outgassing *= 2.0;
+        model->facets.back()->sh.opacity = 2.0;
+        model->facets.back()->sh.sticking = 0.5;
+
+        ASSERT_EQ(model->RefreshSurfaces(), 0);
+        EXPECT_EQ(model->accel, accel);
+        EXPECT_GT(model->wp.finalOutgassingRate, rate);
+        EXPECT_DOUBLE_EQ(model->facets.back()->sh.opacity, 1.0);
+        EXPECT_NE(model->facets.back()->surf, nullptr);
+
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(WavefrontEngine, MatchesScalarStatistics) {
+        // Same desorption limit with the scalar loop and the wavefront engine
+        auto meanHitsPerParticle = [](bool wavefront) {
+            std::string outPath = "TPath_WF_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+            SimulationManager simManager{0};
+            simManager.interactiveMode = false;
+            std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+            GlobalSimuState globState{};
+            std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset", "-j", "2",
+                                             "-d", "100000", "--file", "TestCases/B02-lr10_pipe_tex.zip",
+                                             "--outputPath", outPath};
+            if (wavefront) {
+                argv.emplace_back("--wavefront");
+                argv.emplace_back("256");
+            }
+            CharPVec argc_v(argv);
+            char **args = argc_v.data();
+            Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+            EXPECT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+            EXPECT_EQ(model->wavefrontSize, wavefront ? size_t(256) : size_t(0));
+
+            // Non-interactive runs block until the desorption limit is reached
+            EXPECT_NO_THROW(simManager.StartSimulation());
+            simManager.StopSimulation();
+            simManager.KillAllSimUnits();
+            std::filesystem::remove_all(outPath);
+
+            EXPECT_GE(globState.globalHits.globalHits.nbDesorbed, model->otfParams.desorptionLimit);
+            return (double) globState.globalHits.globalHits.nbMCHit / (double) globState.globalHits.globalHits.nbDesorbed;
+        };
+
+        const double scalarHits = meanHitsPerParticle(false);
+        const double wavefrontHits = meanHitsPerParticle(true);
+        ASSERT_GT(scalarHits, 0.0);
+        EXPECT_NEAR(wavefrontHits / scalarHits, 1.0, 0.02);
+    }
+
+    TEST(Particle, HitBuffersStopGrowing) {
+        std::string outPath = "TPath_HB_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset",
+                                         "--file", "TestCases/B04-lr10_pipe_trans.zip", "--outputPath", outPath};
+        CharPVec argc_v(argv);
+        char **args = argc_v.data();
+        Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+        ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+
+        // Drive a single particle directly, without the simulation manager
+        Simulation sim;
+        sim.model = model;
+        sim.globState = &globState;
+        sim.SetNParticle(1, true);
+        char loadStatus[128];
+        ASSERT_EQ(sim.LoadSimulation(loadStatus), 0);
+        MFSim::Particle *particle = sim.GetParticle(0);
+        ASSERT_NE(particle, nullptr);
+
+        particle->SimulationMCStep(100000, 0, 0);
+        EXPECT_GT(particle->intersectionStamp, 0);
+        particle->SimulationMCStep(100000, 0, 0);
+
+        // Buffers only reallocate when they grow, i.e. logarithmically in the largest hit count
+        const size_t maxGrowths = 2 + (size_t) std::ceil(std::log2((double) model->sh.nbFacet + 1.0));
+        EXPECT_LE(particle->nbHitBufferGrowths, maxGrowths);
+        EXPECT_LT(particle->nbHitBufferGrowths, particle->intersectionStamp);
+
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(AccelReoptimizer, SwapsProbSplitTreesDuringRun) {
+        std::string outPath = "TPath_RO_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset", "--accelReoptimize", "0.001",
+                                         "--file", "TestCases/B01-lr1000_pipe.zip", "--outputPath", outPath};
+        CharPVec argc_v(argv);
+        char **args = argc_v.data();
+        Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+        ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+        EXPECT_DOUBLE_EQ(model->accelReoptimizeTime, 0.001);
+
+        Simulation sim;
+        sim.model = model;
+        sim.globState = &globState;
+        sim.SetNParticle(1, true);
+        char loadStatus[128];
+        ASSERT_EQ(sim.LoadSimulation(loadStatus), 0);
+        ASSERT_EQ(sim.reoptimizer.GetPhase(), MFSim::AccelReoptimizer::WarmUp);
+        const auto initialAccel = model->accel;
+        MFSim::Particle *particle = sim.GetParticle(0);
+
+        // Warm-up, rebuild and swap in UpdateHits, and the measurement after the swap
+        for (size_t i = 0; i < 100000 && sim.reoptimizer.GetPhase() != MFSim::AccelReoptimizer::Done; i++) {
+            particle->SimulationMCStep(1000, 0, 0);
+            while (!particle->UpdateHits(&globState, nullptr, 100)) {}
+        }
+        ASSERT_EQ(sim.reoptimizer.GetPhase(), MFSim::AccelReoptimizer::Done);
+        EXPECT_GT(sim.reoptimizer.GetHitRateBefore(), 0.0);
+        EXPECT_GT(sim.reoptimizer.GetHitRateAfter(), 0.0);
+        ASSERT_EQ(model->accel.size(), initialAccel.size());
+        EXPECT_NE(model->accel.front(), initialAccel.front());
+
+        // Tracing continues on the new trees
+        const size_t nbHits = globState.globalHits.globalHits.nbMCHit;
+        particle->SimulationMCStep(1000, 0, 0);
+        while (!particle->UpdateHits(&globState, nullptr, 100)) {}
+        EXPECT_GT(globState.globalHits.globalHits.nbMCHit, nbHits);
+
+        std::filesystem::remove_all(outPath);
+    }
+
+    TEST(ProfilingCounters, CollectPerThread) {
+        MFSim::Profiling::ResetTotals();
+        MFSim::ProfileCounters first;
+        MFSim::ProfileCounters second;
+        first.Add(MFSim::ProfileEvent::Bounce, 100);
+        first.Add(MFSim::ProfileEvent::Intersect, 300, 64);
+        second.Add(MFSim::ProfileEvent::Bounce, 50, 2);
+
+        MFSim::Profiling::Collect(0, first);
+        MFSim::Profiling::Collect(2, second);
+        EXPECT_TRUE(first.empty()); // moved into the totals
+        EXPECT_TRUE(second.empty());
+
+        auto threadTotals = MFSim::Profiling::GetThreadTotals();
+        ASSERT_EQ(threadTotals.size(), 3);
+        EXPECT_TRUE(threadTotals[1].empty());
+        auto totals = MFSim::Profiling::GetTotals();
+        EXPECT_EQ(totals.counts[static_cast<size_t>(MFSim::ProfileEvent::Bounce)], 3);
+        EXPECT_EQ(totals.ticks[static_cast<size_t>(MFSim::ProfileEvent::Bounce)], 150);
+        EXPECT_EQ(totals.counts[static_cast<size_t>(MFSim::ProfileEvent::Intersect)], 64);
+
+        std::string json = MFSim::Profiling::ToJSON(threadTotals, 1.0e9);
+        EXPECT_NE(json.find("\"bounce\": {\"count\": 3, \"ticks\": 150"), std::string::npos);
+        EXPECT_NE(json.find("\"threads\""), std::string::npos);
+        MFSim::Profiling::ResetTotals();
+        EXPECT_TRUE(MFSim::Profiling::GetTotals().empty());
+    }
+
+    TEST(SyncScheduler, AdaptsToMergeCost) {
+        SyncScheduler scheduler;
+        SyncScheduler::Params params;
+        params.minInterval = 0.05;
+        params.maxInterval = 2.0;
+        params.targetOverhead = 0.02;
+        params.dirtyBudget = 1024 * 1024;
+        scheduler.SetParams(params);
+
+        // Caller's step count until the step rate is known
+        EXPECT_EQ(scheduler.GetStepCount(123), 123);
+        scheduler.RecordSteps(100000, 0.1); // 1e6 steps/s
+        EXPECT_DOUBLE_EQ(scheduler.GetInterval(), params.minInterval);
+
+        // Cheap merges: sync often
+        for (int i = 0; i < 20; i++)
+            scheduler.RecordMerge(0.0, 1e-4, 1024, 0.05);
+        EXPECT_DOUBLE_EQ(scheduler.GetInterval(), params.minInterval);
+
+        // Contended lock: longer interval, bounded by the latency limit
+        for (int i = 0; i < 20; i++)
+            scheduler.RecordMerge(0.01, 0.002, 1024, 0.5);
+        EXPECT_NEAR(scheduler.GetInterval(), 0.012 / params.targetOverhead, 0.01);
+        for (int i = 0; i < 20; i++)
+            scheduler.RecordMerge(0.5, 0.1, 1024, 1.0);
+        EXPECT_DOUBLE_EQ(scheduler.GetInterval(), params.maxInterval);
+        EXPECT_NEAR((double) scheduler.GetStepCount(1), 2.0e6, 1.0e3);
+
+        // Fast growing private results: merge before exceeding the budget
+        for (int i = 0; i < 20; i++)
+            scheduler.RecordMerge(0.5, 0.1, 4 * params.dirtyBudget, 1.0);
+        EXPECT_NEAR(scheduler.GetInterval(), 0.25, 0.01);
+
+        // Disabled: always the caller's step count
+        params.maxInterval = 0.0;
+        scheduler.SetParams(params);
+        EXPECT_EQ(scheduler.GetStepCount(123), 123);
+    }
+
+    TEST(ResultMerger, ConcurrentMergesMatchSequentialSum) {
+        std::string outPath = "TPath_RM_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        SimulationManager simManager{0};
+        std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+        GlobalSimuState globState{};
+        std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset",
+                                         "--file", "TestCases/B02-lr10_pipe_tex.zip", "--outputPath", outPath};
+        CharPVec argc_v(argv);
+        char **args = argc_v.data();
+        Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+        ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+
+        const size_t nbThreads = 8;
+        Simulation sim;
+        sim.model = model;
+        sim.globState = &globState;
+        sim.SetNParticle(nbThreads, true);
+        char loadStatus[128];
+        ASSERT_EQ(sim.LoadSimulation(loadStatus), 0);
+        ASSERT_EQ(sim.merger.GetNbThreads(), nbThreads);
+
+        // Expected sums, taken from the thread results before they are merged
+        std::vector<std::thread> threads;
+        std::vector<size_t> threadHits(nbThreads, 0);
+        std::vector<std::vector<size_t>> threadFacetHits(nbThreads);
+        for (size_t t = 0; t < nbThreads; t++) {
+            threads.emplace_back([&, t]() {
+                MFSim::Particle *particle = sim.GetParticle(t);
+                for (int round = 0; round < 5; round++) {
+                    particle->SimulationMCStep(2000, t, 0);
+                    threadHits[t] += particle->tmpState.globalHits.globalHits.nbMCHit;
+                    threadFacetHits[t].resize(particle->tmpState.facetStates.size(), 0);
+                    for (size_t f = 0; f < particle->tmpState.facetStates.size(); f++)
+                        threadFacetHits[t][f] += particle->tmpState.facetStates[f].momentResults[0].hits.nbMCHit;
+                    while (!particle->UpdateHits(&globState, nullptr, 100)) {}
+                }
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+
+        size_t expectedHits = 0;
+        for (size_t t = 0; t < nbThreads; t++)
+            expectedHits += threadHits[t];
+        EXPECT_EQ(globState.globalHits.globalHits.nbMCHit, expectedHits);
+        for (size_t f = 0; f < globState.facetStates.size(); f++) {
+            size_t expectedFacetHits = 0;
+            for (size_t t = 0; t < nbThreads; t++)
+                expectedFacetHits += threadFacetHits[t][f];
+            EXPECT_EQ(globState.facetStates[f].momentResults[0].hits.nbMCHit, expectedFacetHits);
+        }
+        EXPECT_EQ(sim.merger.GetNbMerged(), 5 * nbThreads);
+        EXPECT_LE(sim.merger.GetNbBatches(), sim.merger.GetNbMerged());
+
+        std::filesystem::remove_all(outPath);
+    }
+    TEST(VelocityTable, MatchesExactInverse) {
+        const double a = VelocityTable::GetDistributionParameter(293.15, 28.0);
+
+        // Exact inverse satisfies F(v) = 1 - exp(-s) * (1 + s)
+        for (double u : {1e-9, 1e-3, 0.25, 0.5, 0.9, 0.999999}) {
+            const double v = VelocityTable::InverseCDF(u, a);
+            const double s = v * v / (2.0 * a * a);
+            EXPECT_NEAR(1.0 - std::exp(-s) * (1.0 + s), u, 1e-12);
+        }
+
+        VelocityTable table;
+        table.Build(293.15, 28.0, 4096);
+        ASSERT_EQ(table.size(), 4096);
+        VelocityTable exact;
+        exact.Build(293.15, 28.0, 0);
+        EXPECT_TRUE(exact.empty());
+
+        // Tabulated speeds stay close to the exact inverse, the mean matches the analytic one
+        const size_t nbSamples = 1000000;
+        double sum = 0.0;
+        for (size_t i = 0; i < nbSamples; i++) {
+            const double u = ((double) i + 0.5) / (double) nbSamples;
+            const double v = table.Sample(u);
+            EXPECT_NEAR(v, exact.Sample(u), 0.02 * exact.Sample(u));
+            sum += v;
+        }
+        const double analyticMean = 1.5 * a * std::sqrt(M_PI / 2.0);
+        EXPECT_NEAR(sum / (double) nbSamples, analyticMean, 1e-4 * analyticMean);
+    }
+    TEST(VelocityTable, SizeFromCommandLine) {
+        std::string outPath = "TPath_VT_" + std::to_string(std::hash<time_t>()(time(nullptr)));
+        for (size_t tableSize : {256, 0}) {
+            SimulationManager simManager{0};
+            std::shared_ptr<MolflowSimulationModel> model = std::make_shared<MolflowSimulationModel>();
+            GlobalSimuState globState{};
+            std::vector<std::string> argv = {"tester", "--verbosity", "0", "--reset",
+                                             "--velocityTable", std::to_string(tableSize),
+                                             "--file", "TestCases/B01-lr1000_pipe.zip", "--outputPath", outPath};
+            CharPVec argc_v(argv);
+            char **args = argc_v.data();
+            Initializer::initFromArgv(argv.size(), (args), &simManager, model);
+            ASSERT_EQ(Initializer::initFromFile(&simManager, model, &globState), 0);
+
+            // Tables are built by PrepareToRun while loading, with the requested number of bins
+            EXPECT_EQ(model->velocityTableSize, tableSize);
+            ASSERT_FALSE(model->tdParams.velocityTables.empty());
+            for (const auto &table : model->tdParams.velocityTables)
+                EXPECT_EQ(table.size(), tableSize);
+        }
+        std::filesystem::remove_all(outPath);
+    }
+    TEST(GuideTable, MatchesLinearSearchInverse) {
+        // Integrated desorption with a flat section and a steep decay
+        std::vector<std::pair<double, double>> cumulative{{0.0, 0.0}};
+        for (int i = 1; i <= 2000; i++) {
+            const double t = 0.01 * i;
+            const double rate = (i > 500 && i <= 700) ? 0.0 : std::exp(-0.002 * i);
+            cumulative.emplace_back(t, cumulative.back().second + rate);
+        }
+
+        GuideTable table;
+        table.Build(cumulative);
+        ASSERT_EQ(table.size(), cumulative.size());
+        EXPECT_DOUBLE_EQ(table.GetTotal(), cumulative.back().second);
+
+        for (int k = 0; k < 100000; k++) {
+            const double u = (k + 0.5) / 100000.0;
+            const double target = u * cumulative.back().second;
+            size_t segment = 0;
+            while (cumulative[segment + 1].second < target) segment++;
+            const auto &p0 = cumulative[segment];
+            const auto &p1 = cumulative[segment + 1];
+            const double expected = p0.first + (target - p0.second) / (p1.second - p0.second) * (p1.first - p0.first);
+            EXPECT_NEAR(table.Sample(u), expected, 1e-9);
+            // never inside the flat section
+            EXPECT_FALSE(table.Sample(u) > 5.0 + 1e-9 && table.Sample(u) < 7.0 - 1e-9);
+        }
+
+        // Subsections of the ID follow the change of the outgassing rate
+        EXPECT_EQ(IDGeneration::GetNbSubsections(1.0, 1.01, false), 1);
+        EXPECT_EQ(IDGeneration::GetNbSubsections(1.0, 2.0, false), 20);
+        EXPECT_EQ(IDGeneration::GetNbSubsections(1.0, 0.0, false), 100);
+        EXPECT_EQ(IDGeneration::GetNbSubsections(1.0, 1e-6, true), 100);
+        EXPECT_EQ(IDGeneration::GetNbSubsections(1.0, 2.0, true), 15);
+    }
+    TEST(AnglemapGeneration, AliasSamplingMatchesCDFSampling) {
+        MolflowSimFacet facet;
+        facet.sh.desorbType = DES_ANGLEMAP;
+        auto &params = facet.sh.anglemapParams;
+        params.phiWidth = 12;
+        params.thetaLimit = PI / 2.0;
+        params.thetaLowerRes = 9;
+        params.thetaHigherRes = 0;
+        std::mt19937_64 generator(42);
+        std::uniform_int_distribution<size_t> hits(0, 50);
+        facet.angleMap.pdf.resize(params.GetMapSize());
+        for (auto &bin : facet.angleMap.pdf)
+            bin = hits(generator);
+        for (size_t phiIndex = 0; phiIndex < params.phiWidth; phiIndex++)
+            facet.angleMap.pdf[3 * params.phiWidth + phiIndex] = 0; // line without hits
+        ASSERT_NO_THROW(facet.InitializeAngleMap());
+        ASSERT_EQ(facet.angleMap.phiBinAliases.size(), params.thetaLowerRes);
+
+        // Both methods sample the pdf interpolated between bin midpoints, compare their 2D histograms
+        const int nbThetaBins = 30;
+        const int nbPhiBins = 36;
+        std::vector<double> cdfHistogram(nbThetaBins * nbPhiBins, 0.0);
+        std::vector<double> aliasHistogram(nbThetaBins * nbPhiBins, 0.0);
+        auto binIndex = [&](double theta, double phi) {
+            const int thetaBin = std::min(nbThetaBins - 1, (int) (theta / (PI / 2.0) * nbThetaBins));
+            const int phiBin = std::min(nbPhiBins - 1, (int) ((phi + PI) / (2.0 * PI) * nbPhiBins));
+            return thetaBin * nbPhiBins + phiBin;
+        };
+        std::uniform_real_distribution<double> rnd(0.0, 1.0);
+        const size_t nbSamples = 1000000;
+        for (size_t i = 0; i < nbSamples; i++) {
+            auto[theta, thetaLowerIndex, thetaOvershoot] = AnglemapGeneration::GenerateThetaFromAngleMap(params, facet.angleMap, rnd(generator));
+            const double phi = AnglemapGeneration::GeneratePhiFromAngleMap(thetaLowerIndex, thetaOvershoot, params, facet.angleMap, rnd(generator));
+            cdfHistogram[binIndex(theta, phi)]++;
+
+            const double rndTheta = rnd(generator);
+            auto[aliasTheta, aliasPhi] = AnglemapGeneration::GenerateAnglesFromAliases(params, facet.angleMap, rndTheta, rnd(generator));
+            ASSERT_GE(aliasTheta, 0.0);
+            ASSERT_LE(aliasTheta, PI / 2.0);
+            ASSERT_GE(aliasPhi, -PI);
+            ASSERT_LT(aliasPhi, PI);
+            aliasHistogram[binIndex(aliasTheta, aliasPhi)]++;
+        }
+
+        double chi2 = 0.0;
+        size_t dof = 0;
+        for (size_t i = 0; i < cdfHistogram.size(); i++) {
+            if (cdfHistogram[i] + aliasHistogram[i] > 0.0) {
+                chi2 += std::pow(cdfHistogram[i] - aliasHistogram[i], 2) / (cdfHistogram[i] + aliasHistogram[i]);
+                dof++;
+            }
+        }
+        EXPECT_LT(chi2, (double) dof + 6.0 * std::sqrt(2.0 * (double) dof));
+    }
 }  // namespace
 
 int main(int argc, char **argv) {